@@ -0,0 +1,773 @@
+//
+//  bvh.cpp
+//  
+//
+//  Created by Brendan Martin on 10/19/26.
+//
+
+#include "bvh.hpp"
+#include <algorithm>
+#include <limits>
+#include <stdint.h>
+#include <atomic>
+#include <deque>
+#include <thread>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// Interior nodes store the index of their left child in first, and the
+// right child directly follows it. Leaves store a range of indices.
+struct BVHNode {
+    vec3 boundsMin;
+    int first;
+    vec3 boundsMax;
+    // Number of primitives in a leaf, 0 for interior nodes
+    int count;
+};
+
+// Leaves are split until they hold at most this many primitives, few enough
+// for the 3 bits a wide node has for their count
+static const int maxLeafSize = 4;
+
+// Cost of testing a ray against a node's box, relative to testing a sphere
+static const float traversalCost = 1.0f;
+
+// Trees smaller than this are refitted on the calling thread
+static const size_t minParallelNodes = 4096;
+
+BVH::BVH() {
+    buildCost = -1.0f;
+    rebuildThreshold = 1.5f;
+    builder = BVHSAH;
+    buildSeconds = 0.0f;
+}
+
+void BVH::clear() {
+    nodes.clear();
+    indices.clear();
+    buildCost = -1.0f;
+    buildSeconds = 0.0f;
+}
+
+void BVH::setRebuildThreshold(float threshold) {
+    rebuildThreshold = threshold;
+}
+
+// Candidate split planes per axis for the SAH builder are the borders
+// between this many bins
+static const int binCount = 16;
+
+// Deeper nodes are split at the median, so trees always fit within the
+// traversal stack however unevenly the other builders split
+static const int maxSplitDepth = 30;
+
+// Subtrees with fewer primitives than this are built on the current thread
+static const int minParallelPrimitives = 4096;
+
+static float boxArea(vec3 boundsMin, vec3 boundsMax) {
+    vec3 extent = boundsMax - boundsMin;
+    return 2.0f * (extent.x * extent.y + extent.y * extent.z + extent.z * extent.x);
+}
+
+static float surfaceArea(const BVHNode &node) {
+    return boxArea(node.boundsMin, node.boundsMax);
+}
+
+// 2^exponent for exponents of normal floats
+static inline float powerOfTwo(int exponent) {
+    uint32_t bits = (uint32_t)(exponent + 127) << 23;
+    float value;
+    memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+// Spreads the low 10 bits of v out to every third bit
+static uint32_t spreadBits(uint32_t v) {
+    v = (v | (v << 16)) & 0x030000ff;
+    v = (v | (v << 8)) & 0x0300f00f;
+    v = (v | (v << 4)) & 0x030c30c3;
+    v = (v | (v << 2)) & 0x09249249;
+    return v;
+}
+
+// Shared by every thread of one build. Threads only ever touch their own
+// range of indices.
+struct BuildState {
+    BVHBuilder builder;
+    std::vector<BoundingBox> &boxes;
+    std::vector<vec3> centers;
+    // Morton code of every primitive's center, for the Morton builder
+    std::vector<uint32_t> codes;
+    std::vector<int> &indices;
+    // Subtrees above this depth are handed to new threads
+    int spawnDepth;
+
+    BuildState(std::vector<BoundingBox> &b, std::vector<int> &i) : boxes(b), indices(i) {}
+};
+
+static int splitMedian(BuildState &state, int first, int count, int axis) {
+    int mid = first + count / 2;
+    std::vector<vec3> &centers = state.centers;
+    std::nth_element(state.indices.begin() + first, state.indices.begin() + mid, state.indices.begin() + first + count,
+                     [&](int a, int b) { return centers[a][axis] < centers[b][axis]; });
+    return mid;
+}
+
+// Sorts the centers into bins along each axis and splits at the bin border
+// with the lowest SAH cost. Returns -1 if the centers can not be separated.
+static int splitSAH(BuildState &state, int first, int count, vec3 centerMin, vec3 centerMax) {
+    float bestCost = std::numeric_limits<float>::infinity();
+    int bestAxis = -1;
+    int bestPlane = 0;
+
+    // Every primitive goes into a bin along each of the three axes at once
+    vec3 scale = vec3(binCount) / glm::max(centerMax - centerMin, vec3(1e-20f));
+    int counts[3][binCount] = {};
+    vec3 binMin[3][binCount];
+    vec3 binMax[3][binCount];
+    for (int axis = 0; axis < 3; axis++) {
+        for (int b = 0; b < binCount; b++) {
+            binMin[axis][b] = vec3(std::numeric_limits<float>::infinity());
+            binMax[axis][b] = vec3(-std::numeric_limits<float>::infinity());
+        }
+    }
+    for (int i = first; i < first + count; i++) {
+        BoundingBox &box = state.boxes[state.indices[i]];
+        vec3 bin = (state.centers[state.indices[i]] - centerMin) * scale;
+        for (int axis = 0; axis < 3; axis++) {
+            int b = std::min(binCount - 1, (int)bin[axis]);
+            counts[axis][b]++;
+            binMin[axis][b] = glm::min(binMin[axis][b], box.boundsMin);
+            binMax[axis][b] = glm::max(binMax[axis][b], box.boundsMax);
+        }
+    }
+
+    for (int axis = 0; axis < 3; axis++) {
+        if (centerMax[axis] <= centerMin[axis]) {
+            continue;
+        }
+
+        // Area times count of everything left of each plane, then of
+        // everything right of it
+        float leftCost[binCount - 1];
+        int leftCount[binCount - 1];
+        vec3 sweepMin = vec3(std::numeric_limits<float>::infinity());
+        vec3 sweepMax = vec3(-std::numeric_limits<float>::infinity());
+        int sweepCount = 0;
+        for (int p = 0; p < binCount - 1; p++) {
+            sweepMin = glm::min(sweepMin, binMin[axis][p]);
+            sweepMax = glm::max(sweepMax, binMax[axis][p]);
+            sweepCount += counts[axis][p];
+            leftCount[p] = sweepCount;
+            leftCost[p] = sweepCount > 0 ? boxArea(sweepMin, sweepMax) * sweepCount : 0.0f;
+        }
+        sweepMin = vec3(std::numeric_limits<float>::infinity());
+        sweepMax = vec3(-std::numeric_limits<float>::infinity());
+        sweepCount = 0;
+        for (int p = binCount - 2; p >= 0; p--) {
+            sweepMin = glm::min(sweepMin, binMin[axis][p + 1]);
+            sweepMax = glm::max(sweepMax, binMax[axis][p + 1]);
+            sweepCount += counts[axis][p + 1];
+            if (leftCount[p] == 0 || sweepCount == 0) {
+                continue;
+            }
+            float cost = leftCost[p] + boxArea(sweepMin, sweepMax) * sweepCount;
+            if (cost < bestCost) {
+                bestCost = cost;
+                bestAxis = axis;
+                bestPlane = p;
+            }
+        }
+    }
+
+    if (bestAxis < 0) {
+        return -1;
+    }
+
+    std::vector<int>::iterator mid = std::partition(state.indices.begin() + first, state.indices.begin() + first + count, [&](int i) {
+        return std::min(binCount - 1, (int)((state.centers[i][bestAxis] - centerMin[bestAxis]) * scale[bestAxis])) <= bestPlane;
+    });
+    return mid - state.indices.begin();
+}
+
+// The primitives of every node are sorted by Morton code, so a node is split
+// where the highest bit in which its codes differ changes from 0 to 1.
+// Returns -1 if all codes are the same.
+static int splitMorton(BuildState &state, int first, int count) {
+    std::vector<uint32_t> &codes = state.codes;
+    std::vector<int> &indices = state.indices;
+    uint32_t firstCode = codes[indices[first]];
+    uint32_t lastCode = codes[indices[first + count - 1]];
+    if (firstCode == lastCode) {
+        return -1;
+    }
+
+    uint32_t bit = 1u << 31;
+    while ((firstCode & bit) == (lastCode & bit)) {
+        bit >>= 1;
+    }
+    return std::partition_point(indices.begin() + first, indices.begin() + first + count,
+                                [&](int i) { return (codes[i] & bit) == 0; }) - indices.begin();
+}
+
+// Fits the node around its primitives, then splits it into two children that
+// are built the same way
+static void buildNode(BuildState &state, std::vector<BVHNode> &nodes, int node, int depth) {
+    int first = nodes[node].first;
+    int count = nodes[node].count;
+
+    vec3 boundsMin = vec3(std::numeric_limits<float>::infinity());
+    vec3 boundsMax = vec3(-std::numeric_limits<float>::infinity());
+    vec3 centerMin = boundsMin;
+    vec3 centerMax = boundsMax;
+    for (int i = first; i < first + count; i++) {
+        BoundingBox &box = state.boxes[state.indices[i]];
+        boundsMin = glm::min(boundsMin, box.boundsMin);
+        boundsMax = glm::max(boundsMax, box.boundsMax);
+        centerMin = glm::min(centerMin, state.centers[state.indices[i]]);
+        centerMax = glm::max(centerMax, state.centers[state.indices[i]]);
+    }
+    nodes[node].boundsMin = boundsMin;
+    nodes[node].boundsMax = boundsMax;
+
+    vec3 extent = centerMax - centerMin;
+    int axis = 0;
+    if (extent.y > extent[axis]) { axis = 1; }
+    if (extent.z > extent[axis]) { axis = 2; }
+
+    // Primitives with the same center still get split, so leaves stay small
+    if (count <= maxLeafSize) {
+        return;
+    }
+
+    int mid = -1;
+    if (depth < maxSplitDepth && state.builder == BVHSAH) {
+        mid = splitSAH(state, first, count, centerMin, centerMax);
+    } else if (depth < maxSplitDepth && state.builder == BVHMorton) {
+        mid = splitMorton(state, first, count);
+    }
+    if (mid <= first || mid >= first + count) {
+        mid = splitMedian(state, first, count, axis);
+    }
+
+    int left = nodes.size();
+    BVHNode leftNode = { vec3(0.0f), first, vec3(0.0f), mid - first };
+    BVHNode rightNode = { vec3(0.0f), mid, vec3(0.0f), first + count - mid };
+    nodes.push_back(leftNode);
+    nodes.push_back(rightNode);
+    nodes[node].first = left;
+    nodes[node].count = 0;
+
+    // The right subtree is built first and the left one is appended after
+    // it, so the left one can be built on another thread into a list of its
+    // own and the tree still comes out the same for any number of threads
+    if (depth >= state.spawnDepth || count < minParallelPrimitives) {
+        buildNode(state, nodes, left + 1, depth + 1);
+        buildNode(state, nodes, left, depth + 1);
+        return;
+    }
+
+    std::vector<BVHNode> leftNodes(1, leftNode);
+    std::thread worker(buildNode, std::ref(state), std::ref(leftNodes), 0, depth + 1);
+    buildNode(state, nodes, left + 1, depth + 1);
+    worker.join();
+
+    int offset = nodes.size() - 1;
+    for (size_t n = 0; n < leftNodes.size(); n++) {
+        if (leftNodes[n].count == 0) {
+            leftNodes[n].first += offset;
+        }
+    }
+    nodes[left] = leftNodes[0];
+    nodes.insert(nodes.end(), leftNodes.begin() + 1, leftNodes.end());
+}
+
+// Boxes around spheres, which the tree is built and fitted from
+static void sphereBoxes(std::vector<Sphere> &spheres, std::vector<BoundingBox> &boxes) {
+    boxes.resize(spheres.size());
+    for (size_t i = 0; i < spheres.size(); i++) {
+        boxes[i].boundsMin = spheres[i].getPosition() - vec3(spheres[i].getRadius());
+        boxes[i].boundsMax = spheres[i].getPosition() + vec3(spheres[i].getRadius());
+    }
+}
+
+void BVH::build(std::vector<Sphere> &spheres, int threads) {
+    std::vector<BoundingBox> boxes;
+    sphereBoxes(spheres, boxes);
+    build(boxes, threads);
+}
+
+void BVH::build(std::vector<BoundingBox> &boxes, int threads) {
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    clear();
+    if (boxes.empty()) {
+        return;
+    }
+    if (threads <= 0) {
+        threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+
+    std::vector<BVHNode> binary;
+    std::vector<int> binaryIndices(boxes.size());
+    BuildState state(boxes, binaryIndices);
+    state.builder = builder;
+    // A couple of subtrees per thread, so threads that finish early are
+    // not left idle
+    state.spawnDepth = 0;
+    while (threads > 1 && (1 << state.spawnDepth) < threads * 2) {
+        state.spawnDepth++;
+    }
+
+    state.centers.resize(boxes.size());
+    vec3 centerMin = vec3(std::numeric_limits<float>::infinity());
+    vec3 centerMax = vec3(-std::numeric_limits<float>::infinity());
+    for (size_t i = 0; i < boxes.size(); i++) {
+        state.centers[i] = (boxes[i].boundsMin + boxes[i].boundsMax) * 0.5f;
+        centerMin = glm::min(centerMin, state.centers[i]);
+        centerMax = glm::max(centerMax, state.centers[i]);
+        binaryIndices[i] = i;
+    }
+
+    if (builder == BVHMorton) {
+        // 10 bits per axis within the box around all centers
+        vec3 scale = 1023.0f / glm::max(centerMax - centerMin, vec3(1e-20f));
+        state.codes.resize(boxes.size());
+        for (size_t i = 0; i < boxes.size(); i++) {
+            glm::uvec3 cell = glm::uvec3((state.centers[i] - centerMin) * scale);
+            state.codes[i] = (spreadBits(cell.x) << 2) | (spreadBits(cell.y) << 1) | spreadBits(cell.z);
+        }
+        std::vector<uint32_t> &codes = state.codes;
+        std::sort(binaryIndices.begin(), binaryIndices.end(), [&](int a, int b) {
+            return codes[a] < codes[b] || (codes[a] == codes[b] && a < b);
+        });
+    }
+
+    binary.reserve(2 * boxes.size());
+    BVHNode root = { vec3(0.0f), 0, vec3(0.0f), (int)boxes.size() };
+    binary.push_back(root);
+    buildNode(state, binary, 0, 0);
+
+    nodes.reserve(binary.size() / 4 + 1);
+    indices.reserve(boxes.size());
+    nodes.resize(1);
+    collapse(binary, binaryIndices, 0, 0);
+
+    buildCost = cost();
+    buildSeconds = std::chrono::duration<float>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Stores the boxes of a node's children, whose slots must already be
+// filled in, relative to the box around all of them. Returns that box.
+static void quantize(WideNode &node, const vec3* childMin, const vec3* childMax, vec3 &boundsMin, vec3 &boundsMax) {
+    boundsMin = vec3(std::numeric_limits<float>::infinity());
+    boundsMax = vec3(-std::numeric_limits<float>::infinity());
+    for (int c = 0; c < 8; c++) {
+        if (node.meta[c] != 0 || (node.interiorMask >> c & 1)) {
+            boundsMin = glm::min(boundsMin, childMin[c]);
+            boundsMax = glm::max(boundsMax, childMax[c]);
+        }
+    }
+
+    for (int axis = 0; axis < 3; axis++) {
+        // The smallest power of two step that spans the box in 255 steps
+        float extent = boundsMax[axis] - boundsMin[axis];
+        int exponent = extent > 0.0f ? (int)std::ceil(std::log2(extent / 255.0f)) : -126;
+        exponent = std::max(-126, std::min(127, exponent));
+        while (exponent < 127 && std::ldexp(255.0f, exponent) < extent) {
+            exponent++;
+        }
+        float step = powerOfTwo(exponent);
+
+        node.origin[axis] = boundsMin[axis];
+        node.exponent[axis] = exponent;
+        for (int c = 0; c < 8; c++) {
+            if (node.meta[c] == 0 && !(node.interiorMask >> c & 1)) {
+                node.boundsMin[axis][c] = 0;
+                node.boundsMax[axis][c] = 0;
+                continue;
+            }
+            float low = std::floor((childMin[c][axis] - boundsMin[axis]) / step);
+            float high = std::ceil((childMax[c][axis] - boundsMin[axis]) / step);
+            node.boundsMin[axis][c] = (uint8_t)std::max(0.0f, std::min(255.0f, low));
+            node.boundsMax[axis][c] = (uint8_t)std::max(0.0f, std::min(255.0f, high));
+        }
+    }
+}
+
+static void decodeChild(const WideNode &node, int c, vec3 &boundsMin, vec3 &boundsMax) {
+    for (int axis = 0; axis < 3; axis++) {
+        float step = powerOfTwo(node.exponent[axis]);
+        boundsMin[axis] = node.origin[axis] + node.boundsMin[axis][c] * step;
+        boundsMax[axis] = node.origin[axis] + node.boundsMax[axis][c] * step;
+    }
+}
+
+static bool isChild(const WideNode &node, int c) {
+    return node.meta[c] != 0 || (node.interiorMask >> c & 1);
+}
+
+// Makes nodes[wide] out of the binary node, pulling up the children with
+// the largest boxes until it has eight. Interior children are given nodes
+// of their own, right after each other, and collapsed the same way.
+void BVH::collapse(std::vector<BVHNode> &binary, std::vector<int> &binaryIndices, int binaryNode, int wide) {
+    std::vector<int> children(1, binaryNode);
+    while (children.size() < 8) {
+        int largest = -1;
+        for (size_t c = 0; c < children.size(); c++) {
+            if (binary[children[c]].count == 0 && (largest < 0 || surfaceArea(binary[children[c]]) > surfaceArea(binary[children[largest]]))) {
+                largest = c;
+            }
+        }
+        if (largest < 0) {
+            break;
+        }
+        int node = children[largest];
+        children[largest] = binary[node].first;
+        children.insert(children.begin() + largest + 1, binary[node].first + 1);
+    }
+
+    WideNode node;
+    memset(&node, 0, sizeof(node));
+    node.childBase = nodes.size();
+    node.primitiveBase = indices.size();
+
+    vec3 childMin[8];
+    vec3 childMax[8];
+    int interior = 0;
+    int primitives = 0;
+    for (size_t c = 0; c < children.size(); c++) {
+        const BVHNode &child = binary[children[c]];
+        childMin[c] = child.boundsMin;
+        childMax[c] = child.boundsMax;
+        if (child.count == 0) {
+            node.interiorMask |= 1 << c;
+            node.meta[c] = interior++;
+        } else {
+            node.meta[c] = primitives << 3 | child.count;
+            indices.insert(indices.end(), binaryIndices.begin() + child.first, binaryIndices.begin() + child.first + child.count);
+            primitives += child.count;
+        }
+    }
+    vec3 boundsMin, boundsMax;
+    quantize(node, childMin, childMax, boundsMin, boundsMax);
+
+    // Room for the interior children is made before any of them is
+    // collapsed, so they stay next to each other
+    nodes[wide] = node;
+    nodes.resize(nodes.size() + interior);
+    for (size_t c = 0; c < children.size(); c++) {
+        if (binary[children[c]].count == 0) {
+            collapse(binary, binaryIndices, children[c], node.childBase + node.meta[c]);
+        }
+    }
+}
+
+BVHStats BVH::getStats() {
+    BVHStats stats = { builder, buildSeconds, (int)nodes.size(), 0, 0, cost(), 0 };
+    stats.bytes = nodes.size() * sizeof(WideNode) + indices.size() * sizeof(int);
+    if (nodes.empty()) {
+        return stats;
+    }
+
+    std::vector< std::pair<int, int> > stack(1, std::make_pair(0, 1));
+    while (!stack.empty()) {
+        std::pair<int, int> entry = stack.back();
+        stack.pop_back();
+        const WideNode &node = nodes[entry.first];
+        stats.depth = std::max(stats.depth, entry.second);
+        for (int c = 0; c < 8; c++) {
+            if (node.interiorMask >> c & 1) {
+                stack.push_back(std::make_pair(node.childBase + node.meta[c], entry.second + 1));
+            } else if (node.meta[c] != 0) {
+                stats.leaves++;
+            }
+        }
+    }
+    return stats;
+}
+
+void BVH::setBuilder(BVHBuilder builder) {
+    this->builder = builder;
+}
+
+bool BVH::parseBuilder(string name, BVHBuilder &builder) {
+    for (int b = BVHMedian; b <= BVHMorton; b++) {
+        if (name == builderName((BVHBuilder)b)) {
+            builder = (BVHBuilder)b;
+            return true;
+        }
+    }
+    return false;
+}
+
+const char* BVH::builderName(BVHBuilder builder) {
+    static const char* names[] = { "median", "sah", "morton" };
+    return names[builder];
+}
+
+float BVH::cost() {
+    if (nodes.empty()) {
+        return 0.0f;
+    }
+
+    // A ray that hits the root hits each box with a probability of the
+    // box's area over the root's
+    float total = 0.0f;
+    float rootArea = 0.0f;
+    for (size_t n = 0; n < nodes.size(); n++) {
+        vec3 nodeMin = vec3(std::numeric_limits<float>::infinity());
+        vec3 nodeMax = vec3(-std::numeric_limits<float>::infinity());
+        for (int c = 0; c < 8; c++) {
+            if (!isChild(nodes[n], c)) {
+                continue;
+            }
+            vec3 childMin, childMax;
+            decodeChild(nodes[n], c, childMin, childMax);
+            nodeMin = glm::min(nodeMin, childMin);
+            nodeMax = glm::max(nodeMax, childMax);
+            if (!(nodes[n].interiorMask >> c & 1)) {
+                total += boxArea(childMin, childMax) * (nodes[n].meta[c] & 7);
+            }
+        }
+        float area = boxArea(nodeMin, nodeMax);
+        total += area * traversalCost;
+        if (n == 0) {
+            rootArea = area;
+        }
+    }
+    return rootArea > 0.0f ? total / rootArea : traversalCost;
+}
+
+// Fits the boxes of a node's children around their primitives, or around
+// the children's own nodes, which must be fitted already
+void BVH::fitNode(int n, std::vector<BoundingBox> &boxes, std::vector<vec3> &nodeMin, std::vector<vec3> &nodeMax) {
+    WideNode &node = nodes[n];
+    vec3 childMin[8];
+    vec3 childMax[8];
+    for (int c = 0; c < 8; c++) {
+        if (node.interiorMask >> c & 1) {
+            childMin[c] = nodeMin[node.childBase + node.meta[c]];
+            childMax[c] = nodeMax[node.childBase + node.meta[c]];
+        } else if (node.meta[c] != 0) {
+            childMin[c] = vec3(std::numeric_limits<float>::infinity());
+            childMax[c] = vec3(-std::numeric_limits<float>::infinity());
+            int first = node.primitiveBase + (node.meta[c] >> 3);
+            for (int i = first; i < first + (node.meta[c] & 7); i++) {
+                childMin[c] = glm::min(childMin[c], boxes[indices[i]].boundsMin);
+                childMax[c] = glm::max(childMax[c], boxes[indices[i]].boundsMax);
+            }
+        }
+    }
+    quantize(node, childMin, childMax, nodeMin[n], nodeMax[n]);
+}
+
+// Children always come after their parent, so walking a subtree's nodes
+// from the last one back fits every child before its parent
+void BVH::refitNode(int node, std::vector<BoundingBox> &boxes, std::vector<vec3> &nodeMin, std::vector<vec3> &nodeMax) {
+    std::vector<int> order;
+    std::vector<int> stack(1, node);
+    while (!stack.empty()) {
+        int n = stack.back();
+        stack.pop_back();
+        order.push_back(n);
+        for (int c = 0; c < 8; c++) {
+            if (nodes[n].interiorMask >> c & 1) {
+                stack.push_back(nodes[n].childBase + nodes[n].meta[c]);
+            }
+        }
+    }
+
+    std::sort(order.begin(), order.end());
+    for (size_t o = order.size(); o-- > 0; ) {
+        fitNode(order[o], boxes, nodeMin, nodeMax);
+    }
+}
+
+void BVH::refit(std::vector<Sphere> &spheres, int threads) {
+    std::vector<BoundingBox> boxes;
+    sphereBoxes(spheres, boxes);
+    refit(boxes, threads);
+}
+
+void BVH::refit(std::vector<BoundingBox> &boxes, int threads) {
+    if (nodes.empty()) {
+        return;
+    }
+    if (threads <= 0) {
+        threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+
+    // Exact boxes of every node, which the quantized boxes of its parent
+    // are made from
+    std::vector<vec3> nodeMin(nodes.size());
+    std::vector<vec3> nodeMax(nodes.size());
+    if (threads == 1 || nodes.size() < minParallelNodes) {
+        for (size_t n = nodes.size(); n-- > 0; ) {
+            fitNode(n, boxes, nodeMin, nodeMax);
+        }
+        return;
+    }
+
+    // Splits the top of the tree breadth first into a few subtrees per
+    // thread, so threads that finish early can pick up the rest
+    std::vector<int> top;
+    std::deque<int> queue(1, 0);
+    while (!queue.empty() && queue.size() < (size_t)threads * 4) {
+        int node = queue.front();
+        queue.pop_front();
+        top.push_back(node);
+        for (int c = 0; c < 8; c++) {
+            if (nodes[node].interiorMask >> c & 1) {
+                queue.push_back(nodes[node].childBase + nodes[node].meta[c]);
+            }
+        }
+    }
+    std::vector<int> subtrees(queue.begin(), queue.end());
+
+    std::atomic<size_t> next(0);
+    std::vector<std::thread> workers;
+    for (int t = 0; t < threads; t++) {
+        workers.push_back(std::thread([&]() {
+            for (size_t s; (s = next++) < subtrees.size(); ) {
+                refitNode(subtrees[s], boxes, nodeMin, nodeMax);
+            }
+        }));
+    }
+    for (size_t t = 0; t < workers.size(); t++) {
+        workers[t].join();
+    }
+
+    // The nodes above the subtrees, children before parents
+    std::sort(top.begin(), top.end());
+    for (size_t o = top.size(); o-- > 0; ) {
+        fitNode(top[o], boxes, nodeMin, nodeMax);
+    }
+}
+
+BVHUpdate BVH::update(std::vector<Sphere> &spheres, int threads) {
+    if (nodes.empty() || indices.size() != spheres.size()) {
+        build(spheres, threads);
+        return BVHRebuilt;
+    }
+
+    // Trees loaded from a compiled scene were not built here
+    if (buildCost < 0.0f) {
+        buildCost = cost();
+    }
+
+    refit(spheres, threads);
+    if (cost() > buildCost * rebuildThreshold) {
+        build(spheres, threads);
+        return BVHRebuilt;
+    }
+    return BVHRefit;
+}
+
+RayBoxes::RayBoxes(const Ray &ray) {
+    origin = ray.origin;
+    for (int axis = 0; axis < 3; axis++) {
+        invPath[axis] = 1.0f / ray.path[axis];
+        if (!(std::fabs(invPath[axis]) < 1e30f)) {
+            invPath[axis] = std::copysign(1e30f, invPath[axis]);
+        }
+        negative[axis] = invPath[axis] < 0.0f;
+    }
+}
+
+#if defined(__SSE2__)
+
+// Four bytes as four floats
+static inline __m128 loadBytes(const uint8_t* bytes) {
+    int32_t packed;
+    memcpy(&packed, bytes, sizeof(packed));
+    __m128i zero = _mm_setzero_si128();
+    __m128i words = _mm_unpacklo_epi8(_mm_cvtsi32_si128(packed), zero);
+    return _mm_cvtepi32_ps(_mm_unpacklo_epi16(words, zero));
+}
+
+// Slab test of all eight children at once, four per SSE register. Returns
+// a bit for every slot whose box the ray hits within (minTime, maxTime),
+// and the distance at which it enters each box.
+int BVH::intersectChildren(const WideNode &node, const RayBoxes &ray, float minTime, float maxTime, float entry[8]) {
+    int hits = 0;
+    for (int half = 0; half < 8; half += 4) {
+        __m128 enter = _mm_set1_ps(minTime);
+        __m128 exit = _mm_set1_ps(maxTime);
+        for (int axis = 0; axis < 3; axis++) {
+            __m128 origin = _mm_set1_ps(node.origin[axis]);
+            __m128 step = _mm_set1_ps(powerOfTwo(node.exponent[axis]));
+            __m128 rayOrigin = _mm_set1_ps(ray.origin[axis]);
+            __m128 invPath = _mm_set1_ps(ray.invPath[axis]);
+            const uint8_t* nearBytes = ray.negative[axis] ? node.boundsMax[axis] : node.boundsMin[axis];
+            const uint8_t* farBytes = ray.negative[axis] ? node.boundsMin[axis] : node.boundsMax[axis];
+
+            __m128 nearPlane = _mm_add_ps(origin, _mm_mul_ps(loadBytes(nearBytes + half), step));
+            __m128 farPlane = _mm_add_ps(origin, _mm_mul_ps(loadBytes(farBytes + half), step));
+            enter = _mm_max_ps(enter, _mm_mul_ps(_mm_sub_ps(nearPlane, rayOrigin), invPath));
+            exit = _mm_min_ps(exit, _mm_mul_ps(_mm_sub_ps(farPlane, rayOrigin), invPath));
+        }
+        _mm_storeu_ps(entry + half, enter);
+        hits |= _mm_movemask_ps(_mm_cmple_ps(enter, exit)) << half;
+    }
+    return hits;
+}
+
+#else
+
+// Slab test of all eight children, one at a time. Returns a bit for every
+// slot whose box the ray hits within (minTime, maxTime), and the distance
+// at which it enters each box.
+int BVH::intersectChildren(const WideNode &node, const RayBoxes &ray, float minTime, float maxTime, float entry[8]) {
+    int hits = 0;
+    for (int c = 0; c < 8; c++) {
+        float enter = minTime;
+        float exit = maxTime;
+        for (int axis = 0; axis < 3; axis++) {
+            float step = powerOfTwo(node.exponent[axis]);
+            uint8_t nearStep = ray.negative[axis] ? node.boundsMax[axis][c] : node.boundsMin[axis][c];
+            uint8_t farStep = ray.negative[axis] ? node.boundsMin[axis][c] : node.boundsMax[axis][c];
+            enter = std::max(enter, (node.origin[axis] + nearStep * step - ray.origin[axis]) * ray.invPath[axis]);
+            exit = std::min(exit, (node.origin[axis] + farStep * step - ray.origin[axis]) * ray.invPath[axis]);
+        }
+        entry[c] = enter;
+        hits |= (enter <= exit) << c;
+    }
+    return hits;
+}
+
+#endif
+
+bool BVH::intersects(Ray ray, Sphere* spheres, Hit &hit, float minTime) {
+    bool found = false;
+    traverse(ray, minTime, hit.time, [&](int i, float &maxTime) {
+        // maxTime shrinks to the closest hit found so far
+        if (spheres[i].intersects(ray, hit.time, minTime, maxTime)) {
+            maxTime = hit.time;
+            hit.primitive = i;
+            found = true;
+        }
+        return false;
+    });
+    return found;
+}
+
+bool BVH::occluded(Ray ray, Sphere* spheres, float minTime, float maxTime) {
+    bool hit = false;
+    traverse(ray, minTime, maxTime, [&](int i, float &maxTime) {
+        hit = spheres[i].intersects(ray, minTime, maxTime);
+        return hit;
+    });
+    return hit;
+}
+
+std::vector<WideNode> &BVH::getNodes() {
+    return nodes;
+}
+
+std::vector<int> &BVH::getIndices() {
+    return indices;
+}
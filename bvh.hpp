@@ -0,0 +1,222 @@
+//
+//  bvh.hpp
+//  
+//
+//  Created by Brendan Martin on 10/19/26.
+//
+
+#ifndef bvh_hpp
+#define bvh_hpp
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <glm/glm.hpp>
+#include "geometry.hpp"
+
+typedef glm::vec3 vec3;
+typedef std::string string;
+
+// Node of the tree that is traced: up to eight children, whose boxes are
+// stored as 8-bit offsets from the node's origin in steps of a power of two
+// per axis, rounded outwards. Eight float boxes alone would take 192 bytes;
+// the whole node takes 80. Interior children are stored together from
+// childBase on and the spheres of all leaf children from primitiveBase on,
+// both in slot order.
+struct WideNode {
+    float origin[3];
+    int8_t exponent[3];
+    // Bit set for every slot that holds an interior child
+    uint8_t interiorMask;
+    uint32_t childBase;
+    uint32_t primitiveBase;
+    // Interior children: index from childBase. Leaf children: number of
+    // spheres in the low 3 bits and index from primitiveBase in the high 5.
+    // Empty slots are 0.
+    uint8_t meta[8];
+    // Quantized box of every slot, axis by axis so four slots load at once
+    uint8_t boundsMin[3][8];
+    uint8_t boundsMax[3][8];
+};
+
+// How the tree is split. Median splits at the middle sphere along the
+// widest axis; SAH chooses among 16 candidate planes per axis by the
+// surface area heuristic, giving the fastest trees to trace; Morton sorts
+// the spheres along a space filling curve once and splits where the curve
+// crosses the middle of a cell, which is the fastest to build.
+enum BVHBuilder {
+    BVHMedian,
+    BVHSAH,
+    BVHMorton
+};
+
+// Measurements of a tree, for comparing builders on a scene
+struct BVHStats {
+    BVHBuilder builder;
+    // 0 for trees that were loaded rather than built
+    float seconds;
+    int nodes;
+    int leaves;
+    int depth;
+    float cost;
+    size_t bytes;
+};
+
+// What update() did to the tree
+enum BVHUpdate {
+    BVHUnchanged,
+    BVHRefit,
+    BVHRebuilt
+};
+
+// Node of the binary tree the builders produce
+struct BVHNode;
+
+struct BoundingBox {
+    vec3 boundsMin;
+    vec3 boundsMax;
+};
+
+// What every box test of one ray needs
+struct RayBoxes {
+    vec3 origin;
+    // Huge rather than infinite for axes the ray runs parallel to, so no
+    // box test multiplies infinity by zero
+    vec3 invPath;
+    // Whether the ray runs towards negative x, y and z, so it enters boxes
+    // on their max side
+    bool negative[3];
+
+    RayBoxes(const Ray &ray);
+};
+
+// Bounding volume hierarchy over an array of primitives, given by their
+// boxes. The builders split the primitives into a binary tree, which is
+// then collapsed into a tree of eight-wide nodes for tracing.
+class BVH {
+    std::vector<WideNode> nodes;
+    // Primitive indices, ordered so the leaf children of every node cover
+    // a contiguous range
+    std::vector<int> indices;
+
+    // SAH cost right after the tree was built, or negative if not known yet
+    float buildCost;
+    // Refitted trees are rebuilt once their cost grows past this factor
+    float rebuildThreshold;
+    BVHBuilder builder;
+    float buildSeconds;
+
+    void collapse(std::vector<BVHNode> &binary, std::vector<int> &binaryIndices, int binaryNode, int wide);
+    void fitNode(int node, std::vector<BoundingBox> &boxes, std::vector<vec3> &nodeMin, std::vector<vec3> &nodeMax);
+    void refitNode(int node, std::vector<BoundingBox> &boxes, std::vector<vec3> &nodeMin, std::vector<vec3> &nodeMax);
+    static int intersectChildren(const WideNode &node, const RayBoxes &ray, float minTime, float maxTime, float entry[8]);
+
+public:
+    BVH();
+    // Builds the tree with the chosen builder. The top levels are split on
+    // several threads; threads <= 0 uses one per hardware thread.
+    void build(std::vector<BoundingBox> &boxes, int threads = 0);
+    void build(std::vector<Sphere> &spheres, int threads = 0);
+    void clear();
+
+    // Fits every node around its spheres again after they moved, keeping
+    // the structure of the tree. Spheres must not be added or removed.
+    // Subtrees are refitted on several threads; threads <= 0 uses one per
+    // hardware thread.
+    void refit(std::vector<BoundingBox> &boxes, int threads = 0);
+    void refit(std::vector<Sphere> &spheres, int threads = 0);
+    // Refits the tree, and rebuilds it instead if refitting has made it
+    // too slow to trace or the number of spheres changed
+    BVHUpdate update(std::vector<Sphere> &spheres, int threads = 0);
+
+    // Surface area heuristic: the expected cost of tracing a ray through
+    // the tree, relative to intersecting one sphere
+    float cost();
+    void setRebuildThreshold(float threshold);
+    void setBuilder(BVHBuilder builder);
+    BVHStats getStats();
+
+    // Builder names as used on the command line: median, sah and morton
+    static bool parseBuilder(string name, BVHBuilder &builder);
+    static const char* builderName(BVHBuilder builder);
+
+    // Calls test(primitive, maxTime) for the primitives of every leaf the
+    // ray reaches within (minTime, maxTime), nearer leaves first. The test
+    // may lower maxTime to cull farther leaves, and returns true to stop.
+    template <class Test>
+    void traverse(const Ray &ray, float minTime, float maxTime, Test test);
+
+    // Lowers the hit to the closest sphere within (minTime, hit.time), and
+    // returns whether there was one
+    bool intersects(Ray ray, Sphere* spheres, Hit &hit, float minTime);
+    // Returns true if any sphere is hit within (minTime, maxTime)
+    bool occluded(Ray ray, Sphere* spheres, float minTime, float maxTime);
+
+    std::vector<WideNode> &getNodes();
+    std::vector<int> &getIndices();
+};
+
+// Deepest tree the traversal can walk. Built trees stay far below it, and
+// trees read from files are rejected past it.
+static const int maxTreeDepth = 64;
+// Children of a node that wait on the traversal stack, for trees up to
+// maxTreeDepth levels deep
+static const int traversalStackSize = 7 * maxTreeDepth + 1;
+
+template <class Test>
+void BVH::traverse(const Ray &ray, float minTime, float maxTime, Test test) {
+    if (nodes.empty()) {
+        return;
+    }
+
+    RayBoxes boxes(ray);
+    int stack[traversalStackSize];
+    int top = 0;
+    stack[top++] = 0;
+
+    while (top > 0) {
+        const WideNode &node = nodes[stack[--top]];
+        float entry[8];
+        int hits = intersectChildren(node, boxes, minTime, maxTime, entry);
+
+        // Children that were hit, nearest first
+        int order[8];
+        int count = 0;
+        for (int c = 0; c < 8; c++) {
+            if (!(hits >> c & 1) || (node.meta[c] == 0 && !(node.interiorMask >> c & 1))) {
+                continue;
+            }
+            int i = count++;
+            while (i > 0 && entry[order[i - 1]] > entry[c]) {
+                order[i] = order[i - 1];
+                i--;
+            }
+            order[i] = c;
+        }
+
+        // Leaves are tested nearest first so that maxTime shrinks to the
+        // closest hit before the farther ones, whose boxes may then be
+        // culled. Interior children are pushed so the nearest comes next.
+        for (int i = 0; i < count; i++) {
+            int c = order[i];
+            if ((node.interiorMask >> c & 1) || entry[c] > maxTime) {
+                continue;
+            }
+            int first = node.primitiveBase + (node.meta[c] >> 3);
+            for (int p = first; p < first + (node.meta[c] & 7); p++) {
+                if (test(indices[p], maxTime)) {
+                    return;
+                }
+            }
+        }
+        for (int i = count; i-- > 0; ) {
+            int c = order[i];
+            if ((node.interiorMask >> c & 1) && entry[c] <= maxTime) {
+                stack[top++] = node.childBase + node.meta[c];
+            }
+        }
+    }
+}
+
+#endif /* bvh_hpp */
@@ -0,0 +1,215 @@
+//
+//  distribute.cpp
+//  
+//
+//  Created by Brendan Martin on 10/19/26.
+//
+
+#include "distribute.hpp"
+#include <iostream>
+#include <deque>
+#include <map>
+#include <memory>
+#include <spawn.h>
+#include <sys/wait.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+extern char** environ;
+
+bool renderPartial(Renderer &renderer, Scene &scene, const RenderSettings &settings, TileGrid grid,
+                   int firstTile, int lastTile, string file) {
+    PartialFile partial;
+    partial.grid = grid;
+
+    // Every tile is its own render so the pool works on all of them at once
+    int count = lastTile - firstTile + 1;
+    std::vector< std::unique_ptr<Framebuffer> > films(count);
+    std::vector<int> jobs(count);
+    for (int t = 0; t < count; t++) {
+        int x0, y0, x1, y1;
+        grid.getTile(firstTile + t, x0, y0, x1, y1);
+        films[t].reset(new Framebuffer(x1 - x0, y1 - y0));
+
+        RenderRequest request;
+        request.scene = &scene;
+        request.film = films[t].get();
+        request.firstColumn = x0;
+        request.firstRow = y0;
+        request.settings = settings;
+        jobs[t] = renderer.submit(request);
+    }
+
+    for (int t = 0; t < count; t++) {
+        RenderResult result = renderer.wait(jobs[t]);
+        if (result.passes > 0) {
+            partial.addTile(firstTile + t, settings.firstSample, result.passes, *films[t]);
+        }
+    }
+
+    return partial.save(file);
+}
+
+// Prints tile indices as ranges, such as "0-3, 7"
+static string tileRanges(std::vector<int> &tiles) {
+    string text;
+    for (size_t t = 0; t < tiles.size(); ) {
+        size_t end = t;
+        while (end + 1 < tiles.size() && tiles[end + 1] == tiles[end] + 1) {
+            end++;
+        }
+        text += (text.empty() ? "" : ", ") + std::to_string(tiles[t]);
+        if (end > t) {
+            text += "-" + std::to_string(tiles[end]);
+        }
+        t = end + 1;
+    }
+    return text;
+}
+
+bool mergePartials(std::vector<string> files, int minSamples, Framebuffer &film) {
+    PartialMerger merger;
+    bool merged = false;
+    for (size_t f = 0; f < files.size(); f++) {
+        // Bad files are reported and left out; their tiles show up as missing
+        merged = merger.add(files[f]) || merged;
+    }
+    if (!merged) {
+        std::cerr << "No partial renders to merge" << std::endl;
+        return false;
+    }
+
+    std::vector<int> missing = merger.missingTiles(minSamples);
+    if (!missing.empty()) {
+        std::cerr << "Tiles " << tileRanges(missing) << " of " << merger.getGrid().getCount()
+                  << " still need to be rendered" << std::endl;
+        return false;
+    }
+
+    merger.resolve(film);
+    return true;
+}
+
+
+// Coordinator
+
+Coordinator::Coordinator(string program, string sceneFile, const RenderSettings &settings, int tileSize, int workers,
+                         int threadsPerWorker, string partialDir) {
+    this->program = program;
+    this->sceneFile = sceneFile;
+    this->settings = settings;
+    this->grid = TileGrid(settings.width, settings.height, tileSize);
+    this->workers = std::max(1, workers);
+    this->threadsPerWorker = threadsPerWorker;
+    this->partialDir = partialDir;
+}
+
+// Starts a worker process for the range and returns its pid, or -1
+int Coordinator::spawn(Range &range) {
+    std::vector<string> args = {
+        program, sceneFile, "--partial", range.file,
+        "--tiles", std::to_string(range.firstTile) + "-" + std::to_string(range.lastTile),
+        "--tile-size", std::to_string(grid.tileSize),
+        "--width", std::to_string(settings.width), "--height", std::to_string(settings.height),
+        "--sample-range", std::to_string(settings.firstSample) + "-" + std::to_string(settings.firstSample + settings.numSamples - 1),
+        "--light-samples", std::to_string(settings.lightSamples),
+        "--threads", std::to_string(threadsPerWorker)
+    };
+    std::vector<char*> argv;
+    for (size_t a = 0; a < args.size(); a++) {
+        argv.push_back((char*)args[a].c_str());
+    }
+    argv.push_back(NULL);
+
+    pid_t pid;
+    if (posix_spawnp(&pid, program.c_str(), NULL, NULL, argv.data(), environ) != 0) {
+        return -1;
+    }
+    return pid;
+}
+
+// A worker that exits cleanly may still have written a bad or incomplete file
+bool Coordinator::check(Range &range) {
+    PartialFile partial;
+    if (!partial.load(range.file) || partial.grid.width != grid.width || partial.grid.height != grid.height ||
+        partial.grid.tileSize != grid.tileSize) {
+        return false;
+    }
+    std::vector<bool> covered(range.lastTile - range.firstTile + 1, false);
+    for (size_t t = 0; t < partial.tiles.size(); t++) {
+        int index = partial.tiles[t].index;
+        if (index >= range.firstTile && index <= range.lastTile) {
+            covered[index - range.firstTile] = true;
+        }
+    }
+    for (size_t t = 0; t < covered.size(); t++) {
+        if (!covered[t]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool Coordinator::render(Framebuffer &film) {
+    mkdir(partialDir.c_str(), 0755);
+
+    // A few ranges per worker, so a slow range does not hold up the frame
+    int count = grid.getCount();
+    int rangeCount = std::min(count, workers * 4);
+    std::deque<Range> pending;
+    std::vector<string> files;
+    for (int r = 0; r < rangeCount; r++) {
+        Range range;
+        range.firstTile = (long long)count * r / rangeCount;
+        range.lastTile = (long long)count * (r + 1) / rangeCount - 1;
+        range.attempts = 0;
+        range.file = partialDir + "/tiles-" + std::to_string(range.firstTile) + "-" + std::to_string(range.lastTile) + ".part";
+        pending.push_back(range);
+        files.push_back(range.file);
+    }
+
+    std::map<pid_t, Range> running;
+    while (!pending.empty() || !running.empty()) {
+        while (!pending.empty() && (int)running.size() < workers) {
+            Range range = pending.front();
+            pending.pop_front();
+            range.attempts++;
+            unlink(range.file.c_str());
+
+            pid_t pid = spawn(range);
+            if (pid < 0) {
+                std::cerr << "Could not start " << program << std::endl;
+                return false;
+            }
+            running[pid] = range;
+        }
+
+        int status;
+        pid_t pid = waitpid(-1, &status, 0);
+        if (pid < 0 || running.count(pid) == 0) {
+            continue;
+        }
+        Range range = running[pid];
+        running.erase(pid);
+
+        if (WIFEXITED(status) && WEXITSTATUS(status) == 0 && check(range)) {
+            continue;
+        }
+        if (range.attempts >= 3) {
+            std::cerr << "Tiles " << range.firstTile << "-" << range.lastTile << " failed " << range.attempts
+                      << " times, giving up" << std::endl;
+            continue;
+        }
+        std::cerr << "Tiles " << range.firstTile << "-" << range.lastTile << " failed, queueing them again" << std::endl;
+        pending.push_back(range);
+    }
+
+    if (!mergePartials(files, settings.numSamples, film)) {
+        return false;
+    }
+    for (size_t f = 0; f < files.size(); f++) {
+        unlink(files[f].c_str());
+    }
+    rmdir(partialDir.c_str());
+    return true;
+}
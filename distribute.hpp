@@ -0,0 +1,60 @@
+//
+//  distribute.hpp
+//  
+//
+//  Created by Brendan Martin on 10/19/26.
+//
+
+#ifndef distribute_hpp
+#define distribute_hpp
+
+#include <stdio.h>
+#include <string>
+#include <vector>
+#include "scene.hpp"
+#include "renderer.hpp"
+#include "partialfile.hpp"
+
+typedef std::string string;
+
+// Renders tiles [firstTile, lastTile] of the grid into a partial file.
+// settings.firstSample and numSamples select the sample range.
+bool renderPartial(Renderer &renderer, Scene &scene, const RenderSettings &settings, TileGrid grid,
+                   int firstTile, int lastTile, string file);
+
+// Merges partial files into film. Tiles that no partial covers, or with
+// fewer than minSamples samples, are listed as ranges that still need
+// rendering and nothing is merged.
+bool mergePartials(std::vector<string> files, int minSamples, Framebuffer &film);
+
+// Renders a frame with local worker processes: the tiles are split into
+// ranges, each range is rendered by running "program sceneFile --partial
+// ..." and the partials are merged into film. Ranges whose worker fails or
+// whose partial is missing or damaged are queued again, up to three times.
+class Coordinator {
+    string program;
+    string sceneFile;
+    RenderSettings settings;
+    TileGrid grid;
+    int workers;
+    int threadsPerWorker;
+    string partialDir;
+
+    struct Range {
+        int firstTile;
+        int lastTile;
+        int attempts;
+        string file;
+    };
+
+    int spawn(Range &range);
+    bool check(Range &range);
+
+public:
+    Coordinator(string program, string sceneFile, const RenderSettings &settings, int tileSize, int workers,
+                int threadsPerWorker, string partialDir);
+
+    bool render(Framebuffer &film);
+};
+
+#endif /* distribute_hpp */
@@ -0,0 +1,122 @@
+//
+//  framebuffer.cpp
+//  
+//
+//  Created by Brendan Martin on 10/19/26.
+//
+
+#include "framebuffer.hpp"
+#include <algorithm>
+#include <fstream>
+
+Framebuffer::Framebuffer() {
+    width = 0;
+    height = 0;
+}
+
+Framebuffer::Framebuffer(int w, int h) {
+    set(w, h);
+}
+
+void Framebuffer::set(int w, int h) {
+    width = w;
+    height = h;
+    pixels.assign((size_t)w * h, vec3(0.0f));
+}
+
+int Framebuffer::getWidth() {
+    return width;
+}
+
+int Framebuffer::getHeight() {
+    return height;
+}
+
+void Framebuffer::add(int x, int y, vec3 radiance) {
+    pixels[(size_t)y * width + x] += radiance;
+}
+
+vec3 Framebuffer::get(int x, int y) {
+    return pixels[(size_t)y * width + x];
+}
+
+vec3* Framebuffer::getRow(int y) {
+    return &pixels[(size_t)y * width];
+}
+
+void Framebuffer::clear() {
+    std::fill(pixels.begin(), pixels.end(), vec3(0.0f));
+}
+
+void Framebuffer::toBitmap(FIBITMAP* bitmap, int samples) {
+    float scale = 1.0f / samples;
+
+    for (int y = 0; y < height; y++) {
+        // vec3 is three packed floats, so a row is one flat array
+        const float* src = &getRow(y)->x;
+        BYTE* dst = FreeImage_GetScanLine(bitmap, y);
+
+        // The x component has always been written to the blue channel. Values
+        // are truncated through int, as the old RGBQUAD assignment did
+        for (int i = 0; i < width; i++) {
+            dst[3*i + FI_RGBA_BLUE]  = (BYTE)(int)std::min(src[3*i + 0] * scale, 255.0f);
+            dst[3*i + FI_RGBA_GREEN] = (BYTE)(int)std::min(src[3*i + 1] * scale, 255.0f);
+            dst[3*i + FI_RGBA_RED]   = (BYTE)(int)std::min(src[3*i + 2] * scale, 255.0f);
+        }
+    }
+}
+
+bool Framebuffer::saveHDR(string file, int samples) {
+    if (FreeImage_GetFIFFromFilename(file.c_str()) == FIF_EXR) {
+        return saveEXR(file, samples);
+    }
+    return savePFM(file, samples);
+}
+
+bool Framebuffer::savePFM(string file, int samples) {
+    std::ofstream out(file, std::ios::binary);
+    if (!out.is_open()) {
+        return false;
+    }
+
+    // A negative scale marks the data as little-endian. PFM rows also start
+    // at the bottom of the image, so rows are written in storage order
+    out << "PF\n" << width << " " << height << "\n-1.0\n";
+
+    float scale = 1.0f / samples;
+    std::vector<float> line(3 * width);
+    for (int y = 0; y < height; y++) {
+        vec3* row = getRow(y);
+        for (int i = 0; i < width; i++) {
+            // Channels are swapped to match the PNG output
+            line[3*i + 0] = row[i].z * scale;
+            line[3*i + 1] = row[i].y * scale;
+            line[3*i + 2] = row[i].x * scale;
+        }
+        out.write((const char*)line.data(), line.size() * sizeof(float));
+    }
+
+    return out.good();
+}
+
+bool Framebuffer::saveEXR(string file, int samples) {
+    FIBITMAP* bitmap = FreeImage_AllocateT(FIT_RGBF, width, height);
+    if (bitmap == NULL) {
+        return false;
+    }
+
+    float scale = 1.0f / samples;
+    for (int y = 0; y < height; y++) {
+        vec3* row = getRow(y);
+        FIRGBF* dst = (FIRGBF*)FreeImage_GetScanLine(bitmap, y);
+        for (int i = 0; i < width; i++) {
+            dst[i].red = row[i].z * scale;
+            dst[i].green = row[i].y * scale;
+            dst[i].blue = row[i].x * scale;
+        }
+    }
+
+    bool success = FreeImage_Save(FIF_EXR, bitmap, file.c_str(), 0);
+    FreeImage_Unload(bitmap);
+    return success;
+}
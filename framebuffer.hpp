@@ -0,0 +1,51 @@
+//
+//  framebuffer.hpp
+//  
+//
+//  Created by Brendan Martin on 10/19/26.
+//
+
+#ifndef framebuffer_hpp
+#define framebuffer_hpp
+
+#include <stdio.h>
+#include <vector>
+#include <string>
+#include <FreeImage.h>
+#include <glm/glm.hpp>
+
+typedef glm::vec3 vec3;
+typedef std::string string;
+
+class Framebuffer {
+    // Accumulated radiance, stored row by row with row 0 at the bottom
+    // of the image (the same layout as FreeImage scanlines)
+    int width;
+    int height;
+    std::vector<vec3> pixels;
+
+public:
+    Framebuffer();
+    Framebuffer(int w, int h);
+    void set(int w, int h);
+
+    int getWidth();
+    int getHeight();
+
+    void add(int x, int y, vec3 radiance);
+    vec3 get(int x, int y);
+    vec3* getRow(int y);
+    void clear();
+
+    // Writes the mean of the accumulated radiance, clamped to 255,
+    // directly into the scanlines of a 24-bit bitmap
+    void toBitmap(FIBITMAP* bitmap, int samples);
+
+    // Writes the unclamped mean radiance as floating point. Files ending in
+    // ".exr" go through FreeImage, anything else is written as a PFM
+    bool saveHDR(string file, int samples);
+    bool savePFM(string file, int samples);
+    bool saveEXR(string file, int samples);
+};
+
+#endif /* framebuffer_hpp */
@@ -24,6 +24,20 @@ struct Ray {
     vec3 path;
 };
 
+// The closest hit a search has found so far. Searches only record when
+// and which primitive was hit; where, its normal and its material are
+// worked out once, for the closest hit.
+struct Hit {
+    // Searches only look for hits before this time
+    float time;
+    // Sphere, triangle or particle, -1 while nothing has been hit
+    int primitive;
+    // Barycentric coordinates of the second and third corners of a
+    // triangle that was hit
+    float beta;
+    float gamma;
+};
+
 struct Camera {
     vec3 position;
     vec3 direction;
@@ -47,30 +61,12 @@ public:
     bool intersects(Ray ray, float minTime, float maxTime );
     bool intersects(Ray ray, float &time, float minTime, float maxTime);
     bool intersects(Ray ray, vec3 &location, vec3 &normal, float &time, float minTime, float maxTime);
+    // Normal of a point on the surface
+    vec3 getNormal(vec3 location);
     
     void sampleLight(vec3 location, vec3 &direction, float &probability);
 
 };
 
-class Mesh {
-    // Vertices are stored counterclockwise
-    float vertices[9];
-    Material* material;
-
-public:
-    Mesh();
-    Mesh(float verts[], Material* mat);
-    void set(float verts[], Material* mat);
-    
-    vec3 getVertex( int ind );
-    vec3 getNormal();
-    Material* getMaterial();
-    
-    bool intersects(Ray ray, float minTime, float maxTime );
-    bool intersects(Ray ray, float &time, float minTime, float maxTime);
-    bool intersects(Ray ray, vec3 &location, vec3 &normal, float &time, float minTime, float maxTime);
-};
-
-
 
 #endif /* geometry_hpp */
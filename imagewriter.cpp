@@ -0,0 +1,271 @@
+//
+//  imagewriter.cpp
+//  
+//
+//  Created by Brendan Martin on 10/19/26.
+//
+
+#include "imagewriter.hpp"
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <chrono>
+#include <cstdlib>
+#include <algorithm>
+#include <zlib.h>
+
+// ImageWriter Class
+
+ImageWriter::ImageWriter() {
+    busy = false;
+    stopping = false;
+    worker = std::thread(&ImageWriter::run, this);
+}
+
+ImageWriter::~ImageWriter() {
+    {
+        std::unique_lock<std::mutex> guard(lock);
+        stopping = true;
+    }
+    wake.notify_all();
+    worker.join();
+}
+
+void ImageWriter::run() {
+    while (true) {
+        std::function<void()> job;
+        {
+            std::unique_lock<std::mutex> guard(lock);
+            while (jobs.empty() && !stopping) {
+                wake.wait(guard);
+            }
+            // Remaining jobs are still written when the writer is destroyed
+            if (jobs.empty()) {
+                return;
+            }
+            job = jobs.front();
+            jobs.pop_front();
+            busy = true;
+        }
+
+        job();
+
+        {
+            std::unique_lock<std::mutex> guard(lock);
+            busy = false;
+            if (jobs.empty()) {
+                idle.notify_all();
+            }
+        }
+    }
+}
+
+void ImageWriter::save(FIBITMAP* bitmap, string file) {
+    queue([bitmap, file]() {
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+        bool success;
+        if (FreeImage_GetFIFFromFilename(file.c_str()) == FIF_PNG) {
+            success = saveParallelPNG(bitmap, file);
+        } else {
+            success = FreeImage_Save(FreeImage_GetFIFFromFilename(file.c_str()), bitmap, file.c_str(), 0);
+        }
+        FreeImage_Unload(bitmap);
+
+        if (success) {
+            std::cout << "Encoded " << file << " in "
+                      << std::chrono::duration<float>(std::chrono::steady_clock::now() - start).count()
+                      << " s" << std::endl;
+        } else {
+            std::cout << "Could not write " << file << std::endl;
+        }
+    });
+}
+
+void ImageWriter::queue(std::function<void()> job) {
+    {
+        std::unique_lock<std::mutex> guard(lock);
+        jobs.push_back(job);
+    }
+    wake.notify_one();
+}
+
+void ImageWriter::finish() {
+    std::unique_lock<std::mutex> guard(lock);
+    while (!jobs.empty() || busy) {
+        idle.wait(guard);
+    }
+}
+
+
+// Parallel PNG encoding
+
+// Images below this many rows per thread are not worth splitting
+static const int minStripRows = 64;
+
+static void writeChunk(std::vector<unsigned char>& out, const char* type, const unsigned char* data, size_t size) {
+    unsigned char header[8] = {
+        (unsigned char)(size >> 24), (unsigned char)(size >> 16), (unsigned char)(size >> 8), (unsigned char)size,
+        (unsigned char)type[0], (unsigned char)type[1], (unsigned char)type[2], (unsigned char)type[3]
+    };
+    uLong crc = crc32(0L, Z_NULL, 0);
+    crc = crc32(crc, header + 4, 4);
+    if (size > 0) {
+        crc = crc32(crc, data, (uInt)size);
+    }
+    unsigned char footer[4] = {
+        (unsigned char)(crc >> 24), (unsigned char)(crc >> 16), (unsigned char)(crc >> 8), (unsigned char)crc
+    };
+
+    out.insert(out.end(), header, header + 8);
+    out.insert(out.end(), data, data + size);
+    out.insert(out.end(), footer, footer + 4);
+}
+
+static unsigned char paeth(int a, int b, int c) {
+    int p = a + b - c;
+    int pa = abs(p - a);
+    int pb = abs(p - b);
+    int pc = abs(p - c);
+    if (pa <= pb && pa <= pc) { return a; }
+    if (pb <= pc) { return b; }
+    return c;
+}
+
+// Fills one PNG row (filter byte followed by RGB) from a FreeImage scanline,
+// using the Paeth filter against the row above it in the image
+static void filterRow(FIBITMAP* bitmap, int row, int width, int height, unsigned char* dst, std::vector<unsigned char>& prev, std::vector<unsigned char>& cur) {
+    // PNG rows go top to bottom, FreeImage scanlines bottom to top
+    BYTE* src = FreeImage_GetScanLine(bitmap, height - 1 - row);
+    for (int i = 0; i < width; i++) {
+        cur[3*i + 0] = src[3*i + FI_RGBA_RED];
+        cur[3*i + 1] = src[3*i + FI_RGBA_GREEN];
+        cur[3*i + 2] = src[3*i + FI_RGBA_BLUE];
+    }
+
+    dst[0] = 4;
+    for (int k = 0; k < 3 * width; k++) {
+        int a = k >= 3 ? cur[k-3] : 0;
+        int c = k >= 3 ? prev[k-3] : 0;
+        dst[k+1] = cur[k] - paeth(a, prev[k], c);
+    }
+    prev.swap(cur);
+}
+
+// Deflates rows [first, last) as a raw deflate stream. Every strip but the
+// last ends on a byte boundary (Z_SYNC_FLUSH), so strips can be concatenated.
+static void deflateStrip(FIBITMAP* bitmap, int first, int last, int width, int height, bool final, std::vector<unsigned char>& out, uLong& adler) {
+    size_t rowBytes = 3 * width + 1;
+    std::vector<unsigned char> raw(rowBytes * (last - first));
+    std::vector<unsigned char> prev(3 * width, 0);
+    std::vector<unsigned char> cur(3 * width);
+
+    // The Paeth filter needs the unfiltered row just above the strip
+    if (first > 0) {
+        BYTE* src = FreeImage_GetScanLine(bitmap, height - first);
+        for (int i = 0; i < width; i++) {
+            prev[3*i + 0] = src[3*i + FI_RGBA_RED];
+            prev[3*i + 1] = src[3*i + FI_RGBA_GREEN];
+            prev[3*i + 2] = src[3*i + FI_RGBA_BLUE];
+        }
+    }
+    for (int row = first; row < last; row++) {
+        filterRow(bitmap, row, width, height, &raw[rowBytes * (row - first)], prev, cur);
+    }
+
+    adler = adler32(adler32(0L, Z_NULL, 0), raw.data(), (uInt)raw.size());
+
+    z_stream stream = {};
+    deflateInit2(&stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY);
+    out.resize(deflateBound(&stream, raw.size()) + 16);
+    stream.next_in = raw.data();
+    stream.avail_in = (uInt)raw.size();
+    stream.next_out = out.data();
+    stream.avail_out = (uInt)out.size();
+    deflate(&stream, final ? Z_FINISH : Z_SYNC_FLUSH);
+    out.resize(stream.total_out);
+    deflateEnd(&stream);
+}
+
+bool saveParallelPNG(FIBITMAP* bitmap, string file, int threads) {
+    if (FreeImage_GetBPP(bitmap) != 24) {
+        return FreeImage_Save(FIF_PNG, bitmap, file.c_str(), 0);
+    }
+
+    std::vector<unsigned char> png;
+    encodeParallelPNG(bitmap, png, threads);
+
+    std::ofstream out(file, std::ios::binary);
+    if (!out.is_open()) {
+        return false;
+    }
+    out.write((const char*)png.data(), png.size());
+    return out.good();
+}
+
+bool encodeParallelPNG(FIBITMAP* bitmap, std::vector<unsigned char>& png, int threads) {
+    int width = FreeImage_GetWidth(bitmap);
+    int height = FreeImage_GetHeight(bitmap);
+    png.clear();
+    if (FreeImage_GetBPP(bitmap) != 24) {
+        return false;
+    }
+
+    if (threads <= 0) {
+        threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+    int strips = std::max(1, std::min(threads, height / minStripRows));
+
+    // Compress every strip independently
+    std::vector< std::vector<unsigned char> > compressed(strips);
+    std::vector<uLong> adlers(strips);
+    std::vector<int> bounds(strips + 1);
+    for (int s = 0; s <= strips; s++) {
+        bounds[s] = (int)((long long)height * s / strips);
+    }
+
+    std::vector<std::thread> workers;
+    for (int s = 0; s < strips; s++) {
+        workers.push_back(std::thread(deflateStrip, bitmap, bounds[s], bounds[s+1], width, height,
+                                      s == strips - 1, std::ref(compressed[s]), std::ref(adlers[s])));
+    }
+    for (size_t t = 0; t < workers.size(); t++) {
+        workers[t].join();
+    }
+
+    // Stitch the strips into one zlib stream: header, deflate data, and the
+    // Adler-32 of the whole image combined from the per-strip checksums
+    std::vector<unsigned char> idat;
+    idat.push_back(0x78);
+    idat.push_back(0x9C);
+    uLong adler = adler32(0L, Z_NULL, 0);
+    for (int s = 0; s < strips; s++) {
+        idat.insert(idat.end(), compressed[s].begin(), compressed[s].end());
+        z_off_t length = (z_off_t)(bounds[s+1] - bounds[s]) * (3 * width + 1);
+        adler = adler32_combine(adler, adlers[s], length);
+    }
+    idat.push_back((unsigned char)(adler >> 24));
+    idat.push_back((unsigned char)(adler >> 16));
+    idat.push_back((unsigned char)(adler >> 8));
+    idat.push_back((unsigned char)adler);
+
+    const unsigned char signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+    png.insert(png.end(), signature, signature + 8);
+
+    // 8 bits per channel, truecolor, default compression and filtering, no interlace
+    unsigned char ihdr[13] = {
+        (unsigned char)(width >> 24), (unsigned char)(width >> 16), (unsigned char)(width >> 8), (unsigned char)width,
+        (unsigned char)(height >> 24), (unsigned char)(height >> 16), (unsigned char)(height >> 8), (unsigned char)height,
+        8, 2, 0, 0, 0
+    };
+    writeChunk(png, "IHDR", ihdr, 13);
+
+    // Keep IDAT chunks to a reasonable size for readers that buffer whole chunks
+    const size_t chunkSize = 1 << 20;
+    for (size_t offset = 0; offset < idat.size(); offset += chunkSize) {
+        writeChunk(png, "IDAT", idat.data() + offset, std::min(chunkSize, idat.size() - offset));
+    }
+    writeChunk(png, "IEND", NULL, 0);
+
+    return true;
+}
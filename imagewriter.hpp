@@ -0,0 +1,57 @@
+//
+//  imagewriter.hpp
+//  
+//
+//  Created by Brendan Martin on 10/19/26.
+//
+
+#ifndef imagewriter_hpp
+#define imagewriter_hpp
+
+#include <stdio.h>
+#include <string>
+#include <deque>
+#include <vector>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <FreeImage.h>
+
+typedef std::string string;
+
+// Encodes and saves images on a background thread, so that writing one
+// frame overlaps rendering the next. Jobs are saved in the order they
+// were queued.
+class ImageWriter {
+    std::deque< std::function<void()> > jobs;
+    std::mutex lock;
+    std::condition_variable wake;
+    std::condition_variable idle;
+    bool busy;
+    bool stopping;
+    std::thread worker;
+
+    void run();
+
+public:
+    ImageWriter();
+    ~ImageWriter();
+
+    // Saves a bitmap as PNG (or any format FreeImage recognizes from the
+    // file name) and unloads it afterwards. The writer owns the bitmap.
+    void save(FIBITMAP* bitmap, string file);
+    // Queues any other output work, such as writing a float image
+    void queue(std::function<void()> job);
+    // Blocks until every queued job has been written
+    void finish();
+};
+
+// Writes a 24-bit bitmap as PNG, deflating horizontal strips of the image
+// on separate threads and stitching the compressed streams together.
+// Small images are written as a single strip.
+bool saveParallelPNG(FIBITMAP* bitmap, string file, int threads = 0);
+// Same as saveParallelPNG, but produces the PNG file in memory
+bool encodeParallelPNG(FIBITMAP* bitmap, std::vector<unsigned char>& png, int threads = 0);
+
+#endif /* imagewriter_hpp */
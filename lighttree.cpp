@@ -0,0 +1,141 @@
+//
+//  lighttree.cpp
+//  
+//
+//  Created by Brendan Martin on 10/19/26.
+//
+
+#include "lighttree.hpp"
+#include "random.hpp"
+#include <algorithm>
+#include <limits>
+#include <cmath>
+
+LightTree::LightTree() {
+
+}
+
+void LightTree::build(std::vector<Sphere> &spheres, std::vector<int> &lights) {
+    clear();
+    if (lights.empty()) {
+        return;
+    }
+
+    // A sphere of radius r emits in proportion to its emission times r^2
+    std::vector<LightNode> leaves(lights.size());
+    std::vector<int> order(lights.size());
+    for (size_t l = 0; l < lights.size(); l++) {
+        Sphere &s = spheres[lights[l]];
+        vec3 emissive = s.getMaterial()->getEmissive();
+        leaves[l].boundsMin = s.getPosition() - vec3(s.getRadius());
+        leaves[l].boundsMax = s.getPosition() + vec3(s.getRadius());
+        leaves[l].power = (emissive.x + emissive.y + emissive.z) / 3.0f * s.getRadius() * s.getRadius();
+        leaves[l].child = 0;
+        leaves[l].light = l;
+        order[l] = l;
+    }
+
+    nodes.reserve(2 * lights.size() - 1);
+    nodes.resize(1);
+    buildNode(0, leaves, order, 0, lights.size());
+}
+
+// Splits at the middle light along the axis the lights' centers spread
+// furthest across
+void LightTree::buildNode(int node, std::vector<LightNode> &leaves, std::vector<int> &order, int first, int last) {
+    if (last - first == 1) {
+        nodes[node] = leaves[order[first]];
+        return;
+    }
+
+    LightNode &n = nodes[node];
+    n.boundsMin = vec3(std::numeric_limits<float>::infinity());
+    n.boundsMax = vec3(-std::numeric_limits<float>::infinity());
+    n.power = 0.0f;
+    vec3 centerMin = n.boundsMin;
+    vec3 centerMax = n.boundsMax;
+    for (int i = first; i < last; i++) {
+        LightNode &leaf = leaves[order[i]];
+        n.boundsMin = glm::min(n.boundsMin, leaf.boundsMin);
+        n.boundsMax = glm::max(n.boundsMax, leaf.boundsMax);
+        n.power += leaf.power;
+        vec3 center = (leaf.boundsMin + leaf.boundsMax) * 0.5f;
+        centerMin = glm::min(centerMin, center);
+        centerMax = glm::max(centerMax, center);
+    }
+    vec3 extent = centerMax - centerMin;
+    int axis = extent.x >= extent.y && extent.x >= extent.z ? 0 : (extent.y >= extent.z ? 1 : 2);
+
+    int middle = (first + last) / 2;
+    std::nth_element(order.begin() + first, order.begin() + middle, order.begin() + last, [&](int a, int b) {
+        return leaves[a].boundsMin[axis] + leaves[a].boundsMax[axis] < leaves[b].boundsMin[axis] + leaves[b].boundsMax[axis];
+    });
+
+    int child = nodes.size();
+    n.child = child;
+    n.light = -1;
+    nodes.resize(child + 2);
+    buildNode(child, leaves, order, first, middle);
+    buildNode(child + 1, leaves, order, middle, last);
+}
+
+void LightTree::clear() {
+    nodes.clear();
+}
+
+bool LightTree::empty() {
+    return nodes.empty();
+}
+
+// Power over squared distance, times the largest cosine between the normal
+// and any direction into the node's bounding sphere. That cosine is only 0
+// when every light of the node is below the horizon, so every light that
+// can add something keeps a chance of being picked.
+float LightTree::importance(const LightNode &node, vec3 location, vec3 normal) {
+    vec3 center = (node.boundsMin + node.boundsMax) * 0.5f;
+    float radius = glm::length(node.boundsMax - center);
+    vec3 toCenter = center - location;
+    float distanceSquared = glm::dot(toCenter, toCenter);
+
+    // Points inside the bounding sphere may have lights in any direction
+    if (distanceSquared <= radius * radius) {
+        return node.power / std::max(radius * radius, std::numeric_limits<float>::min());
+    }
+
+    float distance = std::sqrt(distanceSquared);
+    float cosNormal = glm::dot(normal, toCenter) / distance;
+    float sinNormal = std::sqrt(std::max(0.0f, 1.0f - cosNormal * cosNormal));
+    float sinBounds = radius / distance;
+    float cosBounds = std::sqrt(1.0f - sinBounds * sinBounds);
+    float cosine = cosNormal >= cosBounds ? 1.0f : cosNormal * cosBounds + sinNormal * sinBounds;
+    if (cosine <= 0.0f) {
+        return 0.0f;
+    }
+    return node.power * cosine / distanceSquared;
+}
+
+int LightTree::pick(vec3 location, vec3 normal, float &probability) {
+    if (nodes.empty() || importance(nodes[0], location, normal) <= 0.0f) {
+        return -1;
+    }
+
+    probability = 1.0f;
+    int node = 0;
+    while (nodes[node].light < 0) {
+        int child = nodes[node].child;
+        float left = importance(nodes[child], location, normal);
+        float right = importance(nodes[child + 1], location, normal);
+        if (left + right <= 0.0f) {
+            return -1;
+        }
+        float chance = left / (left + right);
+        if (right <= 0.0f || randomFloat() < chance) {
+            node = child;
+            probability *= chance;
+        } else {
+            node = child + 1;
+            probability *= 1.0f - chance;
+        }
+    }
+    return nodes[node].light;
+}
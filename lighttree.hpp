@@ -0,0 +1,58 @@
+//
+//  lighttree.hpp
+//  
+//
+//  Created by Brendan Martin on 10/19/26.
+//
+
+#ifndef lighttree_hpp
+#define lighttree_hpp
+
+#include <stdio.h>
+#include <vector>
+#include <glm/glm.hpp>
+#include "geometry.hpp"
+
+typedef glm::vec3 vec3;
+
+// Node of the light tree: the box around its lights and the power they
+// emit together. Interior nodes have their two children next to each
+// other from child on; leaves hold one light.
+struct LightNode {
+    vec3 boundsMin;
+    vec3 boundsMax;
+    float power;
+    int child;
+    // Index into the scene's lights, -1 for interior nodes
+    int light;
+};
+
+// Binary tree over the lights of a scene for picking one light to sample
+// from a point, with a probability that follows how much each light is
+// likely to add there: its power, falling off with distance, and none for
+// lights entirely below the point's horizon. Picking walks from the root
+// to one leaf, so it costs the depth of the tree however many lights there
+// are. Spherical lights shine in every direction, so nodes need no cone of
+// emitting directions; only the normal at the point limits what it sees.
+class LightTree {
+    std::vector<LightNode> nodes;
+
+    void buildNode(int node, std::vector<LightNode> &leaves, std::vector<int> &order, int first, int last);
+    static float importance(const LightNode &node, vec3 location, vec3 normal);
+
+public:
+    LightTree();
+
+    // Builds the tree over lights, which are indices into spheres. Power is
+    // taken from the emission of every light's material.
+    void build(std::vector<Sphere> &spheres, std::vector<int> &lights);
+    void clear();
+    bool empty();
+
+    // Picks a light to sample from a point with the given normal. Returns
+    // its index into the scene's lights and the probability it was picked
+    // with, or -1 if no light can reach the point.
+    int pick(vec3 location, vec3 normal, float &probability);
+};
+
+#endif /* lighttree_hpp */
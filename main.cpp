@@ -7,176 +7,261 @@
 
 #include <stdio.h>
 #include <iostream>
+#include <chrono>
+#include <cstring>
+#include <cstdlib>
+#include <cerrno>
+#include <climits>
+#include <vector>
+#include <thread>
+#include <memory>
 #include <FreeImage.h>
 #include <glm/glm.hpp>
 #include "geometry.hpp"
 #include "material.hpp"
 //#include "variables.hpp"
 #include "parser.hpp"
+#include "framebuffer.hpp"
+#include "streamwriter.hpp"
+#include "imagewriter.hpp"
+#include "scene.hpp"
+#include "scenefile.hpp"
+#include "renderer.hpp"
+#include "server.hpp"
+#include "distribute.hpp"
+#include "ply.hpp"
 
 typedef glm::mat3 mat3;
 typedef glm::mat4 mat4;
 typedef glm::vec3 vec3;
 typedef glm::vec4 vec4;
 
-// screenHeight and screenWidth are expressed in pixels
-float screenHeight = 500;
-float screenWidth = 500;
+// Loads either a layout file or a compiled scene, so that the scene and
+// its BVH are ready for tracing, optionally printing measurements of the BVH
+bool loadScene(char* file, Scene &scene, bool printStats) {
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
 
-Sphere lights[10];
-int numLights;
+    if (!scene.load(file)) {
+        return false;
+    }
 
-Camera cam;
-//{ vec3(0,5,0), vec3(0,-1,0), 1 };
+    uint64_t particles = 0;
+    size_t particleBytes = 0;
+    for (size_t p = 0; p < scene.particles.size(); p++) {
+        particles += scene.particles[p].getCount();
+        particleBytes += scene.particles[p].getBytes();
+    }
 
-Sphere objects[10];
-//Mesh objects[10];
-int numObjects;
-Material materials[10];
+    std::cout << "Loaded " << scene.objects.size() - scene.lights.size() << " objects";
+    if (!scene.instances.empty()) {
+        std::cout << ", " << scene.instances.size() << " instances of " << scene.groups.size() << " groups";
+    }
+    if (particles > 0) {
+        std::cout << ", " << particles << " particles";
+    }
+    size_t triangles = 0;
+    size_t meshBytes = 0;
+    for (size_t m = 0; m < scene.meshes.size(); m++) {
+        triangles += scene.meshes[m].getTriangleCount();
+        meshBytes += scene.meshes[m].getBytes();
+    }
+    if (triangles > 0) {
+        std::cout << ", " << triangles << " triangles";
+    }
+    uint64_t pagedTriangles = 0;
+    int chunks = 0;
+    for (size_t m = 0; m < scene.pagedMeshes.size(); m++) {
+        pagedTriangles += scene.pagedMeshes[m].getTriangleCount();
+        chunks += scene.pagedMeshes[m].getChunkCount();
+    }
+    if (pagedTriangles > 0) {
+        std::cout << ", " << pagedTriangles << " paged triangles";
+    }
+    std::cout << " and " << scene.lights.size() << " lights in "
+              << std::chrono::duration<float>(std::chrono::steady_clock::now() - start).count() << " s" << std::endl;
 
-Ray genCameraRay( int xCoor, int yCoor ) {
-    float worldHeight = screenHeight / 100;
-    float worldWidth = screenWidth / 100;
-    
-    vec3 right = glm::normalize( glm::cross( cam.direction, vec3(0.0,0.0,1.0) ) );
-    vec3 up = glm::normalize( glm::cross( right, cam.direction ) );
-    
-    float u = (-worldWidth/2) + worldWidth*(xCoor+0.5)/screenWidth;
-    float v = (-worldHeight/2) + worldHeight*(yCoor+0.5)/screenHeight;
-    
-    Ray camRay;
-    camRay.origin = cam.position;
-    // FreeImage begins at the lower left corner
-    camRay.path = (cam.focalLength * glm::normalize(cam.direction)) + (u*right) + (v*up);
-    
-    return camRay;
+    if (printStats && !scene.objects.empty()) {
+        BVHStats stats = scene.bvh.getStats();
+        std::cout << "BVH: " << (stats.seconds > 0.0f ? BVH::builderName(stats.builder) : "compiled") << ", "
+                  << stats.nodes << " nodes, " << stats.leaves << " leaves, depth " << stats.depth << ", SAH cost "
+                  << stats.cost << ", " << stats.bytes / 1024 << " KB";
+        if (stats.seconds > 0.0f) {
+            std::cout << ", built in " << stats.seconds << " s";
+        }
+        std::cout << std::endl;
+    }
+    if (printStats && !scene.groups.empty()) {
+        size_t groupObjects = 0;
+        size_t groupBytes = 0;
+        for (size_t g = 0; g < scene.groups.size(); g++) {
+            groupObjects += scene.groups[g].objects.size();
+            groupBytes += scene.groups[g].bvh.getStats().bytes;
+        }
+        std::cout << "Instances: " << scene.groups.size() << " groups of " << groupObjects << " spheres with "
+                  << groupBytes / 1024 << " KB of BVHs, " << scene.instances.size() << " instances with a "
+                  << scene.instanceBVH.getStats().bytes / 1024 << " KB BVH" << std::endl;
+    }
+    if (printStats && triangles > 0) {
+        size_t vertices = 0;
+        for (size_t m = 0; m < scene.meshes.size(); m++) {
+            vertices += scene.meshes[m].getVertexCount();
+        }
+        std::cout << "Meshes: " << scene.meshes.size() << " meshes, " << vertices << " vertices, " << meshBytes / 1024
+                  << " KB, " << (float)meshBytes / triangles << " bytes per triangle" << std::endl;
+    }
+    if (printStats && pagedTriangles > 0) {
+        std::cout << "Paged meshes: " << scene.pagedMeshes.size() << " meshes in " << chunks << " chunks, ";
+        if (scene.chunkCache.getBudget() > 0) {
+            std::cout << scene.chunkCache.getBudget() / (1024 * 1024) << " MB budget" << std::endl;
+        } else {
+            std::cout << "no budget" << std::endl;
+        }
+    }
+    if (printStats && particles > 0) {
+        std::cout << "Particles: " << scene.particles.size() << " sets, " << particleBytes / 1024 << " KB, "
+                  << (float)particleBytes / particles << " bytes per particle" << std::endl;
+    }
+    return true;
 }
 
-//vec3 genDirect(float cosThetaMax, vec3 location, Sphere light) {
-//
-//}
-
-int findClosestObject(Ray ray, vec3 &location, vec3 &normal, float &time, float minTime, float maxTime) {
-    
-    int closestObj = -1;
-    for (int obj = 0; obj < numObjects; obj++) {
-        // If the current object is intersected and closer than the previous object
-        if (objects[obj].intersects(ray, location, normal, time, minTime, time)) {
-            closestObj = obj;
-        }
+// Option values must be numbers up to their last character. Errors are
+// printed.
+bool parseInt(const char* option, const char* text, int &value) {
+    char* end;
+    errno = 0;
+    long parsed = strtol(text, &end, 10);
+    if (end == text || *end != '\0' || errno == ERANGE || parsed < INT_MIN || parsed > INT_MAX) {
+        std::cout << "Invalid number for " << option << ": " << text << std::endl;
+        return false;
     }
-    return closestObj;
+    value = parsed;
+    return true;
 }
 
-int findClosestLight(Ray ray, float &time, float minTime, float maxTime) {
+bool parseFloat(const char* option, const char* text, float &value) {
+    char* end;
+    errno = 0;
+    float parsed = strtof(text, &end);
+    if (end == text || *end != '\0' || errno == ERANGE) {
+        std::cout << "Invalid number for " << option << ": " << text << std::endl;
+        return false;
+    }
+    value = parsed;
+    return true;
+}
 
-    int closestLight = -1;
-    for (int l = 0; l < numLights; l++) {
-        // If the current object is intersected and closer than the previous object
-        if (lights[l].intersects(ray, time, 0.01, maxTime)) {
-            closestLight = l;
-        }
+// Reads "first-last" or a single number, checked the same way. Errors are
+// printed.
+bool parseRange(const char* option, const char* text, int &first, int &last) {
+    char* end;
+    errno = 0;
+    long parsedFirst = strtol(text, &end, 10);
+    long parsedLast = parsedFirst;
+    bool valid = end != text;
+    if (valid && *end == '-') {
+        const char* second = end + 1;
+        parsedLast = strtol(second, &end, 10);
+        valid = end != second;
+    }
+    if (!valid || *end != '\0' || errno == ERANGE || parsedFirst > INT_MAX || parsedLast > INT_MAX) {
+        std::cout << "Invalid number for " << option << ": " << text << std::endl;
+        return false;
+    }
+    if (parsedFirst < 0 || parsedFirst > parsedLast) {
+        std::cout << "Invalid range for " << option << ": " << text << std::endl;
+        return false;
     }
-    return closestLight;
+    first = parsedFirst;
+    last = parsedLast;
+    return true;
 }
 
-// Function is called once per view ray
-vec3 tracepath( Ray ray, int depth = 0 ) {
-    
-    vec3 color = vec3(0.0f);
-    
-    // Find the closest object
-    vec3 location = vec3(0.0f);
-    vec3 normal = vec3(0.0f);  // Expressed in space coordinates, not local
-    
-    
-    float time = std::numeric_limits<float>::infinity();
-    int closestObj = findClosestObject(ray, location, normal, time, 0.01, time);
-    
-    // Find closest light
-    float lightTime = std::numeric_limits<float>::infinity();
-    int closestLight = findClosestLight(ray, lightTime, 0.01, time);
-    
-    // Check if a light has been hit and the light is closer than the nearest object
-    if (closestLight != -1 && lightTime < time)
-    {
-        // Return the emission of the light
-        return vec3(0.0f);
-//        return lights[closestLight].getMaterial()->getEmissive();
+// Writes the mean radiance of the film, film holding the sum of samples
+// passes, as a PNG and optionally as a floating point image
+void writeImage(Framebuffer &film, int samples, const char* file, const char* hdrFile) {
+    FreeImage_Initialise();
+
+    int bitsPerPixel = 24;
+    FIBITMAP* bitmap = FreeImage_Allocate(film.getWidth(), film.getHeight(), bitsPerPixel);
+
+    // Conversion is timed separately from rendering. Encoding happens on
+    // the writer's thread and reports its own time
+    typedef std::chrono::steady_clock clock;
+    ImageWriter writer;
+    clock::time_point outputStart = clock::now();
+    film.toBitmap(bitmap, samples);
+    std::cout << "Output: conversion " << std::chrono::duration<float>(clock::now() - outputStart).count()
+              << " s" << std::endl;
+
+    writer.save(bitmap, file);
+    if (hdrFile != NULL) {
+        writer.queue([&film, hdrFile, samples]() {
+            if (!film.saveHDR(hdrFile, samples)) {
+                std::cout << "Could not write " << hdrFile << std::endl;
+            }
+        });
     }
-    
-    // Otherwise, if an object has been hit
-    if (closestObj != -1)
-    {
-        
-        // Sample direct illumination
-//        if (depth == 0)
-//        {
-            for (int l = 0; l < numLights; l++)
-            { // for every light
-                
-                // sample a point on the spherical light
-                vec3 incoming;
-                float prob;
-                lights[l].sampleLight(location, incoming, prob);
-                
-                // calculate distance to light source (shadowBound)
-                Ray directRay = {location, incoming};
-                float shadowBound;
-                lights[l].intersects(directRay, shadowBound, 0.01, std::numeric_limits<float>::infinity());
-                
-                // Check if the light is obstructed
-                bool inShadow = false;
-                int obj = 0;
-                while (!inShadow && obj < numObjects)
-                {
-                    inShadow = objects[obj].intersects(directRay, 0.01, shadowBound);
-                    obj++;
-                }
-                
-                // If the light is not shadowed, calculate direct lighting contribution
-                if (!inShadow)
-                {
-                    float cos_theta = glm::dot(incoming, normal);
-                    
-                    vec3 brdf = objects[closestObj].getMaterial()->BRDF(normal, incoming, -glm::normalize(ray.path));
-
-                    color += brdf * lights[l].getMaterial()->getEmissive() * cos_theta / prob;
-                }
+    writer.finish();
+    FreeImage_DeInitialise();
+}
+
+// Renders frames [firstFrame, lastFrame] of an animated scene from every
+// camera, as image0000.png, or image0000-cam1.png with several cameras. The
+// scene, renderer and writer are kept for the whole sequence, so each image
+// is encoded while the next one renders, and the BVH is only refitted for
+// frames where spheres move.
+void renderSequence(Scene &scene, RenderSettings settings, Renderer &renderer, int firstFrame, int lastFrame,
+                    const char* hdrFile) {
+    FreeImage_Initialise();
+    ImageWriter writer;
+
+    typedef std::chrono::steady_clock clock;
+    clock::time_point start = clock::now();
+    int cameras = std::max(1, (int)scene.cameras.size());
+    int refits = 0;
+    int rebuilds = 0;
+    for (int frame = firstFrame; frame <= lastFrame; frame++) {
+        BVHUpdate update = scene.setFrame(frame, renderer.getThreads());
+        refits += update == BVHRefit;
+        rebuilds += update == BVHRebuilt;
+
+        for (int c = 0; c < cameras; c++) {
+            scene.cam = scene.getCamera(c, frame);
+            std::shared_ptr<Framebuffer> film = std::make_shared<Framebuffer>();
+            RenderResult result = renderer.render(scene, settings, *film);
+            int passes = result.passes;
+
+            char suffix[32];
+            if (cameras > 1) {
+                snprintf(suffix, sizeof(suffix), "%04d-cam%d", frame, c);
+            } else {
+                snprintf(suffix, sizeof(suffix), "%04d", frame);
+            }
+            std::cout << "Frame " << suffix << ": " << passes << " samples per pixel in " << result.seconds << " s" << std::endl;
+
+            FIBITMAP* bitmap = FreeImage_Allocate(film->getWidth(), film->getHeight(), 24);
+            film->toBitmap(bitmap, passes);
+            writer.save(bitmap, string("image") + suffix + ".png");
+
+            if (hdrFile != NULL) {
+                // The frame number goes before the extension
+                string file = hdrFile;
+                size_t dot = file.find_last_of('.');
+                file.insert(dot == string::npos ? file.size() : dot, suffix);
+                writer.queue([film, file, passes]() {
+                    if (!film->saveHDR(file, passes)) {
+                        std::cout << "Could not write " << file << std::endl;
+                    }
+                });
             }
-            
-//        }
-        
-        // Sample Indirect Lighting
-        
-        // Exit Condition: Russian Roulette
-        float rouletteCutoff = 0.2;
-        float roulette = static_cast <float> (rand()) / static_cast <float> (RAND_MAX);
-        
-        if (roulette > rouletteCutoff)
-        {
-        
-            // Generate new random direction and the probability of choosing that direction
-            vec3 incoming;
-            vec3 prob;
-            objects[closestObj].getMaterial()->sampleDir(normal, -glm::normalize(ray.path), incoming, prob);
-            
-            // Calculate the amount of incoming light reflected in the outgoing direction
-            vec3 brdf = objects[closestObj].getMaterial()->BRDF(normal, incoming, -glm::normalize(ray.path));
-            
-            // Calculate the cos of angle between normal vector and incoming light
-            float cos_theta = glm::dot(incoming, normal);
-            
-            // Record new ray to trace
-            ray.origin = location;
-            ray.path = incoming;
-            
-            // Compute the transport equation, continue to recurse
-            color += brdf * tracepath(ray, depth+1) * cos_theta / (prob * (1-rouletteCutoff));
         }
     }
-    
-    return color;
+    writer.finish();
+
+    std::cout << (lastFrame - firstFrame + 1) * cameras << " images in "
+              << std::chrono::duration<float>(clock::now() - start).count() << " s, BVH refitted for "
+              << refits << " and rebuilt for " << rebuilds << " frames" << std::endl;
+    FreeImage_DeInitialise();
 }
 
 int main(int argc, char* argv[]) {
@@ -213,38 +298,369 @@ int main(int argc, char* argv[]) {
 ////    std::cout << glm::dot(w, glm::normalize(vec3(0.0,0.0,1.0)));
 ////    std::cout << w[0] << " " << w[1] << " " << w[2];
     
-    Parser parse = Parser();
+    // Image size, sample count and optional wall-clock limit in seconds;
+    // without a limit a fixed number of samples is rendered
+    RenderSettings settings;
+    // Optional floating point copy of the image (.pfm or .exr)
+    char* hdrFile = NULL;
+    // Optional file that bands of rows are streamed to as they finish (.pfm or .ppm)
+    char* streamFile = NULL;
+    int bandRows = 16;
+    // Worker threads shared by all renders; 0 uses every hardware thread
+    int threads = 0;
+    // With --compile, the layout is written to outputFile as a compiled scene
+    bool compile = false;
+    char* outputFile = NULL;
+    // With --page-mesh, a PLY mesh is cut into chunks of chunkTriangles
+    // triangles and written to outputFile as a paged mesh
+    char* pageMesh = NULL;
+    int chunkTriangles = 65536;
+    // Memory for the chunks of paged meshes in MB, 0 for no limit
+    size_t geometryBudget = 0;
+    // With --partitions, the spheres are split among that many worker
+    // processes instead of being kept in this one
+    int partitions = 0;
+    // With --serve, render jobs are accepted on a Unix socket
+    char* socketPath = NULL;
+    // With --partial, only some tiles or samples are rendered, into a file
+    // that --merge combines with others. --distribute runs the workers itself
+    char* partialFile = NULL;
+    char* tileRange = NULL;
+    char* sampleRange = NULL;
+    int tileSize = 64;
+    bool merge = false;
+    bool samplesGiven = false;
+    int distribute = 0;
+    char* partialDir = NULL;
+    // Frames of an animation to render, all by default
+    char* frameRange = NULL;
+    // Growth of the BVH's cost at which refitting gives way to a rebuild
+    float rebuildThreshold = 0.0f;
+    // How the BVH is built, and whether to print its measurements
+    BVHBuilder builder = BVHSAH;
+    bool bvhStats = false;
+    // The layout file, or the partial files to merge
+    std::vector<char*> inputs;
+    int value;
+    for (int a = 1; a < argc; a++) {
+        if (strcmp(argv[a], "--time-budget") == 0 && a+1 < argc) {
+            if (!parseFloat(argv[a], argv[a+1], settings.timeBudget)) {
+                return 1;
+            }
+            a++;
+        } else if (strcmp(argv[a], "--samples") == 0 && a+1 < argc) {
+            if (!parseInt(argv[a], argv[a+1], value)) {
+                return 1;
+            }
+            settings.numSamples = std::max(1, value);
+            a++;
+            samplesGiven = true;
+        } else if (strcmp(argv[a], "--light-samples") == 0 && a+1 < argc) {
+            if (!parseInt(argv[a], argv[a+1], value)) {
+                return 1;
+            }
+            settings.lightSamples = std::max(0, value);
+            a++;
+        } else if (strcmp(argv[a], "--width") == 0 && a+1 < argc) {
+            if (!parseInt(argv[a], argv[a+1], value)) {
+                return 1;
+            }
+            settings.width = std::max(1, value);
+            a++;
+        } else if (strcmp(argv[a], "--height") == 0 && a+1 < argc) {
+            if (!parseInt(argv[a], argv[a+1], value)) {
+                return 1;
+            }
+            settings.height = std::max(1, value);
+            a++;
+        } else if (strcmp(argv[a], "--hdr") == 0 && a+1 < argc) {
+            hdrFile = argv[++a];
+        } else if (strcmp(argv[a], "--stream") == 0 && a+1 < argc) {
+            streamFile = argv[++a];
+        } else if (strcmp(argv[a], "--band-rows") == 0 && a+1 < argc) {
+            if (!parseInt(argv[a], argv[a+1], value)) {
+                return 1;
+            }
+            bandRows = std::max(1, value);
+            a++;
+        } else if (strcmp(argv[a], "--threads") == 0 && a+1 < argc) {
+            if (!parseInt(argv[a], argv[a+1], value)) {
+                return 1;
+            }
+            threads = std::max(0, value);
+            a++;
+        } else if (strcmp(argv[a], "--compile") == 0) {
+            compile = true;
+        } else if (strcmp(argv[a], "--page-mesh") == 0 && a+1 < argc) {
+            pageMesh = argv[++a];
+        } else if (strcmp(argv[a], "--chunk-triangles") == 0 && a+1 < argc) {
+            if (!parseInt(argv[a], argv[a+1], value)) {
+                return 1;
+            }
+            chunkTriangles = std::max(1, value);
+            a++;
+        } else if (strcmp(argv[a], "--partitions") == 0 && a+1 < argc) {
+            if (!parseInt(argv[a], argv[a+1], value)) {
+                return 1;
+            }
+            partitions = std::max(0, value);
+            a++;
+        } else if (strcmp(argv[a], "--geometry-budget") == 0 && a+1 < argc) {
+            if (!parseInt(argv[a], argv[a+1], value)) {
+                return 1;
+            }
+            geometryBudget = std::max(0, value);
+            a++;
+        } else if (strcmp(argv[a], "-o") == 0 && a+1 < argc) {
+            outputFile = argv[++a];
+        } else if (strcmp(argv[a], "--serve") == 0 && a+1 < argc) {
+            socketPath = argv[++a];
+        } else if (strcmp(argv[a], "--partial") == 0 && a+1 < argc) {
+            partialFile = argv[++a];
+        } else if (strcmp(argv[a], "--tiles") == 0 && a+1 < argc) {
+            tileRange = argv[++a];
+        } else if (strcmp(argv[a], "--sample-range") == 0 && a+1 < argc) {
+            sampleRange = argv[++a];
+        } else if (strcmp(argv[a], "--tile-size") == 0 && a+1 < argc) {
+            if (!parseInt(argv[a], argv[a+1], value)) {
+                return 1;
+            }
+            tileSize = std::max(1, value);
+            a++;
+        } else if (strcmp(argv[a], "--frames") == 0 && a+1 < argc) {
+            frameRange = argv[++a];
+        } else if (strcmp(argv[a], "--rebuild-threshold") == 0 && a+1 < argc) {
+            if (!parseFloat(argv[a], argv[a+1], rebuildThreshold)) {
+                return 1;
+            }
+            a++;
+        } else if (strcmp(argv[a], "--bvh") == 0 && a+1 < argc) {
+            if (!BVH::parseBuilder(argv[++a], builder)) {
+                std::cout << "Unknown BVH builder " << argv[a] << ", expected median, sah or morton" << std::endl;
+                return 1;
+            }
+        } else if (strcmp(argv[a], "--bvh-stats") == 0) {
+            bvhStats = true;
+        } else if (strcmp(argv[a], "--merge") == 0) {
+            merge = true;
+        } else if (strcmp(argv[a], "--distribute") == 0 && a+1 < argc) {
+            if (!parseInt(argv[a], argv[a+1], value)) {
+                return 1;
+            }
+            distribute = std::max(1, value);
+            a++;
+        } else if (strcmp(argv[a], "--partial-dir") == 0 && a+1 < argc) {
+            partialDir = argv[++a];
+        } else {
+            inputs.push_back(argv[a]);
+        }
+    }
+    char* layoutFile = inputs.empty() ? NULL : inputs.back();
 
-    if (argc>0) {
-        parse.load(argv[1]);
+    // Only a whole-image render in this process splits the scene among
+    // partition workers; every other mode would silently render unsplit
+    if (partitions > 0) {
+        const char* other = socketPath != NULL ? "--serve" : compile ? "--compile" : pageMesh != NULL ? "--page-mesh" :
+                            merge ? "--merge" : partialFile != NULL ? "--partial" : distribute > 0 ? "--distribute" :
+                            streamFile != NULL ? "--stream" : NULL;
+        if (other != NULL) {
+            std::cout << "--partitions can not be combined with " << other << std::endl;
+            return 1;
+        }
+    }
+    // Streamed images are written band by band and never held whole; a
+    // floating point stream is asked for with a .pfm stream file instead
+    if (hdrFile != NULL && streamFile != NULL) {
+        std::cout << "--hdr can not be combined with --stream" << std::endl;
+        return 1;
+    }
 
+    Scene scene;
+    scene.bvh.setBuilder(builder);
+    scene.chunkCache.setBudget(geometryBudget << 20);
+
+    if (socketPath != NULL) {
         FreeImage_Initialise();
+        RenderServer server(threads);
+        bool success = server.run(socketPath);
+        FreeImage_DeInitialise();
+        return success ? 0 : 1;
+    }
+    else if (compile) {
+        if (layoutFile == NULL || outputFile == NULL) {
+            std::cout << "Usage: pathtracer --compile layout.txt -o scene.bin" << std::endl;
+            return 1;
+        }
+        if (!loadScene(layoutFile, scene, bvhStats) || !SceneFile().save(outputFile, scene)) {
+            return 1;
+        }
+        std::cout << "Compiled " << layoutFile << " to " << outputFile << std::endl;
+    }
+    else if (pageMesh != NULL) {
+        if (outputFile == NULL) {
+            std::cout << "Usage: pathtracer --page-mesh mesh.ply -o mesh.pages [--chunk-triangles n]" << std::endl;
+            return 1;
+        }
+        Mesh mesh;
+        if (!PLYFile().load(pageMesh, mesh, threads) || !PagedMesh::write(outputFile, mesh, chunkTriangles, threads)) {
+            return 1;
+        }
+        std::cout << "Paged " << mesh.getTriangleCount() << " triangles of " << pageMesh << " into "
+                  << (mesh.getTriangleCount() + chunkTriangles - 1) / chunkTriangles << " chunks in " << outputFile
+                  << std::endl;
+    }
+    else if (merge) {
+        Framebuffer film;
+        std::vector<string> files(inputs.begin(), inputs.end());
+        if (!mergePartials(files, samplesGiven ? settings.numSamples : 1, film)) {
+            return 1;
+        }
+        // Merged films already hold the mean radiance
+        writeImage(film, 1, outputFile != NULL ? outputFile : "image.png", hdrFile);
+    }
+    else if (layoutFile != NULL && partialFile != NULL) {
+        if (!loadScene(layoutFile, scene, bvhStats)) {
+            return 1;
+        }
 
-        int bitsPerPixel = 24;
-        FIBITMAP* bitmap = FreeImage_Allocate(screenWidth, screenHeight, bitsPerPixel);
-
-        int numSamples = 20;
-        vec3 colVec;
-        RGBQUAD color;
-        for (int i = 0; i < screenWidth; i++) {
-            for (int j = 0; j < screenHeight; j++) {
-                colVec = vec3(0.0f);
-                for (int n = 0; n < numSamples; n++) {
-                    colVec += tracepath( genCameraRay(i,j) );
+        TileGrid grid(settings.width, settings.height, tileSize);
+        int firstTile = 0;
+        int lastTile = grid.getCount() - 1;
+        if (tileRange != NULL && !parseRange("--tiles", tileRange, firstTile, lastTile)) {
+            return 1;
+        }
+        if (lastTile >= grid.getCount()) {
+            std::cout << "Tile range must lie within 0-" << grid.getCount() - 1 << std::endl;
+            return 1;
+        }
+        int firstSample, lastSample;
+        if (sampleRange != NULL) {
+            if (!parseRange("--sample-range", sampleRange, firstSample, lastSample)) {
+                return 1;
+            }
+            settings.firstSample = firstSample;
+            settings.numSamples = lastSample - firstSample + 1;
+        }
+
+        Renderer renderer(threads);
+        if (!renderPartial(renderer, scene, settings, grid, firstTile, lastTile, partialFile)) {
+            return 1;
+        }
+        std::cout << "Rendered tiles " << firstTile << "-" << lastTile << " to " << partialFile << std::endl;
+    }
+    else if (layoutFile != NULL && distribute > 0) {
+        // Workers split the machine between them unless told otherwise
+        int threadsPerWorker = threads;
+        if (threadsPerWorker == 0) {
+            threadsPerWorker = std::max(1, (int)std::thread::hardware_concurrency() / distribute);
+        }
+
+        Framebuffer film;
+        Coordinator coordinator(argv[0], layoutFile, settings, tileSize, distribute, threadsPerWorker,
+                                partialDir != NULL ? partialDir : "partials");
+        if (!coordinator.render(film)) {
+            return 1;
+        }
+        writeImage(film, 1, outputFile != NULL ? outputFile : "image.png", hdrFile);
+    }
+    else if (layoutFile != NULL && streamFile != NULL) {
+        if (!loadScene(layoutFile, scene, bvhStats)) {
+            return 1;
+        }
+
+        int width = settings.width;
+        int height = settings.height;
+
+        // Only one band is held in memory; each is fully sampled and then
+        // appended to the file. A time budget would need uneven sample counts
+        // across bands, so streaming always uses the fixed count.
+        StreamWriter writer;
+        if (!writer.open(streamFile, width, height)) {
+            std::cout << "Could not write " << streamFile << std::endl;
+            return 1;
+        }
+
+        typedef std::chrono::steady_clock clock;
+        clock::time_point start = clock::now();
+
+        Renderer renderer(threads);
+        Framebuffer band;
+        unsigned long long rays = 0;
+        for (int rows = 0; rows < height; rows += bandRows) {
+            int bandHeight = std::min(bandRows, height - rows);
+            int firstRow = writer.nextBand(bandHeight);
+
+            band.set(width, bandHeight);
+            rays += renderer.renderBand(scene, settings, band, firstRow).rays;
+            // A full disk or failing device would otherwise only show once
+            // every band had been rendered
+            if (!writer.writeBand(band, settings.numSamples)) {
+                std::cout << "Could not write " << streamFile << std::endl;
+                return 1;
+            }
+        }
+
+        if (!writer.close()) {
+            std::cout << "Could not write " << streamFile << std::endl;
+            return 1;
+        }
+
+        float elapsed = std::chrono::duration<float>(clock::now() - start).count();
+        std::cout << settings.numSamples << " samples per pixel in " << elapsed << " s ("
+                  << rays / elapsed << " rays/s)" << std::endl;
+    }
+    else if (layoutFile != NULL) {
+        if (!loadScene(layoutFile, scene, bvhStats)) {
+            return 1;
+        }
+        // Workers are forked before the renderer starts its threads
+        if (partitions > 0) {
+            scene.partitions = std::make_shared<PartitionSet>();
+            if (!scene.partitions->start(scene, partitions)) {
+                return 1;
+            }
+            if (bvhStats) {
+                std::vector<size_t> counts = scene.partitions->getSphereCounts();
+                std::cout << "Partitions: " << counts.size() << " processes across " << "xyz"[scene.partitions->getAxis()]
+                          << " with";
+                for (size_t p = 0; p < counts.size(); p++) {
+                    std::cout << (p == 0 ? " " : ", ") << counts[p];
                 }
-                colVec = colVec / (float)numSamples;
-
-                // Clamp color values
-                colVec = glm::min(colVec, vec3(255));
-                color.rgbRed = colVec.z;
-                color.rgbGreen = colVec.y;
-                color.rgbBlue = colVec.x;
-                FreeImage_SetPixelColor(bitmap,i,j,&color);
+                std::cout << " spheres" << std::endl;
             }
         }
 
-        FreeImage_Save(FIF_PNG, bitmap, "image.png", 0);
-        FreeImage_DeInitialise();
+        Renderer renderer(threads);
+        if (scene.isAnimated()) {
+            int firstFrame = 0;
+            int lastFrame = scene.frames - 1;
+            if (frameRange != NULL && !parseRange("--frames", frameRange, firstFrame, lastFrame)) {
+                return 1;
+            }
+            if (lastFrame >= scene.frames) {
+                std::cout << "Frame range must lie within 0-" << scene.frames - 1 << std::endl;
+                return 1;
+            }
+            if (rebuildThreshold > 0.0f) {
+                scene.bvh.setRebuildThreshold(rebuildThreshold);
+            }
+            renderSequence(scene, settings, renderer, firstFrame, lastFrame, hdrFile);
+            return 0;
+        }
+
+        // Radiance is accumulated over whole passes (one sample per pixel each),
+        // so the image can be written after any completed pass
+        Framebuffer film;
+        RenderResult result = renderer.render(scene, settings, film);
+
+        std::cout << result.passes << " samples per pixel in " << result.seconds << " s ("
+                  << result.rays / result.seconds << " rays/s)" << std::endl;
+        if (bvhStats && !scene.pagedMeshes.empty()) {
+            std::cout << "Chunks: " << scene.chunkCache.getLoads() << " reads, " << scene.chunkCache.getEvictions()
+                      << " evictions, " << scene.chunkCache.getBytes() / 1024 << " KB in memory" << std::endl;
+        }
+
+        writeImage(film, result.passes, "image.png", hdrFile);
     }
     else {
         std::cout << "No file name provided";
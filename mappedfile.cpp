@@ -0,0 +1,85 @@
+//
+//  mappedfile.cpp
+//  
+//
+//  Created by Brendan Martin on 10/19/26.
+//
+
+#include "mappedfile.hpp"
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <algorithm>
+
+MappedFile::MappedFile() {
+    data = NULL;
+    size = 0;
+}
+
+MappedFile::~MappedFile() {
+    close();
+}
+
+bool MappedFile::open(string file, MappedAccess access) {
+    close();
+
+    int fd = ::open(file.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+
+    struct stat info;
+    if (fstat(fd, &info) != 0) {
+        ::close(fd);
+        return false;
+    }
+    size = info.st_size;
+
+    // mmap rejects empty mappings, but an empty file is still a valid file
+    if (size > 0) {
+        void* mapped = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (mapped == MAP_FAILED) {
+            ::close(fd);
+            size = 0;
+            return false;
+        }
+        data = (const char*)mapped;
+        madvise(mapped, size, access == AccessSequential ? MADV_SEQUENTIAL :
+                              access == AccessRandom ? MADV_RANDOM : MADV_NORMAL);
+    }
+
+    // The mapping stays valid after the descriptor is closed
+    ::close(fd);
+    return true;
+}
+
+void MappedFile::close() {
+    if (data != NULL) {
+        munmap((void*)data, size);
+    }
+    data = NULL;
+    size = 0;
+}
+
+void MappedFile::release(size_t offset, size_t length) {
+    if (data == NULL || offset >= size) {
+        return;
+    }
+    // madvise needs a page-aligned start; only whole pages in the range are
+    // dropped, so neighbouring data stays resident
+    size_t page = sysconf(_SC_PAGESIZE);
+    size_t first = (offset + page - 1) / page * page;
+    size_t last = std::min(offset + length, size) / page * page;
+    if (last > first) {
+        madvise((void*)(data + first), last - first, MADV_DONTNEED);
+    }
+}
+
+const char* MappedFile::getData() {
+    return data;
+}
+
+size_t MappedFile::getSize() {
+    return size;
+}
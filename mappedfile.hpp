@@ -0,0 +1,48 @@
+//
+//  mappedfile.hpp
+//  
+//
+//  Created by Brendan Martin on 10/19/26.
+//
+
+#ifndef mappedfile_hpp
+#define mappedfile_hpp
+
+#include <stdio.h>
+#include <string>
+
+typedef std::string string;
+
+// How a mapping will be read, passed on to the system so it reads ahead
+// only where that helps
+enum MappedAccess {
+    // Read once from start to end, like a layout being parsed
+    AccessSequential,
+    // Read in no particular order, like the chunks of a paged mesh
+    AccessRandom,
+    // Both: read through once while loading, then looked up in place
+    AccessNormal
+};
+
+// A read-only view of a whole file mapped into memory
+class MappedFile {
+    const char* data;
+    size_t size;
+
+public:
+    MappedFile();
+    ~MappedFile();
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    bool open(string file, MappedAccess access);
+    void close();
+    // Lets the system drop the pages of [offset, offset + length) from
+    // memory. They are read from the file again if touched.
+    void release(size_t offset, size_t length);
+
+    const char* getData();
+    size_t getSize();
+};
+
+#endif /* mappedfile_hpp */
@@ -6,6 +6,7 @@
 //
 
 #include "material.hpp"
+#include "random.hpp"
 
 // Material Class
 
@@ -48,6 +49,30 @@ vec3 Material::getEmissive() {
     return emissive;
 }
 
+string Material::getMethod() {
+    return method;
+}
+
+string Material::getDistribution() {
+    return distribution;
+}
+
+string Material::getType() {
+    return material;
+}
+
+float Material::getRoughness() {
+    return roughness;
+}
+
+vec3 Material::getDiffuseColor() {
+    return diffuseColor;
+}
+
+vec3 Material::getFresnel() {
+    return F0;
+}
+
 mat3 Material::genCoorFrame(vec3 z_axis) {
 //    vec3 basis[3];
 //    basis[2] = glm::normalize(z_axis);
@@ -181,8 +206,8 @@ void Material::LambertSampleDir(vec3 normal, vec3 &direction, vec3 &probability)
     float PI = glm::pi<float>();
     
     // Generate two random floats in range (0,1)
-    float cosTheta = static_cast <float> (rand()) / static_cast <float> (RAND_MAX);
-    float phi = static_cast <float> (rand()) / static_cast <float> (RAND_MAX);
+    float cosTheta = randomFloat();
+    float phi = randomFloat();
     phi = phi * PI * 2;
 
     float sinTheta = glm::sqrt(1 - (cosTheta*cosTheta));
@@ -342,7 +367,7 @@ void Material::SamplePhase(vec3 microNormal, vec3 incoming, vec3& outgoing, vec3
         weight = sf;
     }
     else if (material == "dielectric") {
-        float u = static_cast <float> (rand()) / static_cast <float> (RAND_MAX);
+        float u = randomFloat();
         
         for (int i = 0; i < 3; i++) {
             if (u < sf[i]) {
@@ -388,7 +413,7 @@ vec3 Material::Phase(vec3 incoming, vec3 outgoing) {
 }
 
 float Material::SampleHeight(vec3 direction, float height) {
-    float u = static_cast <float> (rand()) / static_cast <float> (RAND_MAX);
+    float u = randomFloat();
     
     float sg = SmithG(direction, height);
     
@@ -487,8 +512,8 @@ vec3 Material::SampleNorm(vec3 direction, float ax, float ay) {
 
 void Material::SampleBeckmann(float theta_i, float& slope_x, float& slope_y) {
     // Random numbers
-    float U1 = static_cast <float> (rand()) / static_cast <float> (RAND_MAX);
-    float U2 = static_cast <float> (rand()) / static_cast <float> (RAND_MAX);
+    float U1 = randomFloat();
+    float U2 = randomFloat();
     
     // special case (normal incidence)
     if (theta_i < 0.0001) {
@@ -550,8 +575,8 @@ void Material::SampleBeckmann(float theta_i, float& slope_x, float& slope_y) {
 
 void Material::SampleGGX(float theta_i, float& slope_x, float& slope_y) {
     // Random numbers
-    float U1 = static_cast <float> (rand()) / static_cast <float> (RAND_MAX);
-    float U2 = static_cast <float> (rand()) / static_cast <float> (RAND_MAX);
+    float U1 = randomFloat();
+    float U2 = randomFloat();
 
     // special case (normal incidence)
     if(theta_i < 0.0001) {
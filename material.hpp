@@ -45,6 +45,12 @@ public:
     
     bool isLight();
     vec3 getEmissive();
+    string getMethod();
+    string getDistribution();
+    string getType();
+    float getRoughness();
+    vec3 getDiffuseColor();
+    vec3 getFresnel();
     
     mat3 genCoorFrame(vec3 z_axis);
     vec3 BRDF(vec3 normal, vec3 incoming, vec3 outgoing);
@@ -0,0 +1,208 @@
+//
+//  mesh.cpp
+//  
+//
+//  Created by Brendan Martin on 10/19/26.
+//
+
+#include "mesh.hpp"
+#include <algorithm>
+#include <limits>
+
+Mesh::Mesh() {
+    mappedVertices = NULL;
+    mappedCount = 0;
+}
+
+uint32_t Mesh::addVertex(vec3 position) {
+    vertices.push_back(position);
+    return vertices.size() - 1;
+}
+
+bool Mesh::addTriangle(uint32_t a, uint32_t b, uint32_t c, Material* material) {
+    // Meshes rarely use more than a few materials, and faces that are next
+    // to each other mostly share one, so the last one is checked first
+    int index = materials.empty() ? -1 : (faceMaterials.empty() ? 0 : faceMaterials.back());
+    if (index < 0 || materials[index] != material) {
+        index = std::find(materials.begin(), materials.end(), material) - materials.begin();
+        if (index == (int)materials.size()) {
+            // Faces store their material in 16 bits
+            if (materials.size() == maxMaterials) {
+                return false;
+            }
+            materials.push_back(material);
+        }
+    }
+
+    indices.push_back(a);
+    indices.push_back(b);
+    indices.push_back(c);
+    if (index != 0 && faceMaterials.empty()) {
+        // The second material: every earlier face used the first
+        faceMaterials.resize(indices.size() / 3 - 1, 0);
+    }
+    if (!faceMaterials.empty()) {
+        faceMaterials.push_back(index);
+    }
+    return true;
+}
+
+void Mesh::reserve(size_t vertexCount, size_t triangleCount) {
+    vertices.reserve(vertexCount);
+    indices.reserve(triangleCount * 3);
+}
+
+void Mesh::adoptVertices(std::shared_ptr<MappedFile> file, const vec3* data, size_t count) {
+    std::vector<vec3>().swap(vertices);
+    mapping = file;
+    mappedVertices = data;
+    mappedCount = count;
+}
+
+void Mesh::setMaterial(Material* material) {
+    materials.assign(1, material);
+    faceMaterials.clear();
+}
+
+std::vector<vec3> &Mesh::getVertexBuffer() {
+    return vertices;
+}
+
+std::vector<uint32_t> &Mesh::getIndexBuffer() {
+    return indices;
+}
+
+const vec3* Mesh::getVertexData() {
+    return mapping ? mappedVertices : vertices.data();
+}
+
+void Mesh::build(int threads) {
+    size_t count = getTriangleCount();
+    std::vector<BoundingBox> boxes(count);
+    for (size_t t = 0; t < count; t++) {
+        boxes[t].boundsMin = glm::min(glm::min(getVertex(t, 0), getVertex(t, 1)), getVertex(t, 2));
+        boxes[t].boundsMax = glm::max(glm::max(getVertex(t, 0), getVertex(t, 1)), getVertex(t, 2));
+    }
+    bvh.build(boxes, threads);
+
+    // Triangles are put in the order the leaves reference them, so the
+    // triangles of a leaf are next to each other in memory
+    std::vector<int> &order = bvh.getIndices();
+    std::vector<uint32_t> sorted(indices.size());
+    std::vector<uint16_t> sortedMaterials(faceMaterials.size());
+    for (size_t i = 0; i < order.size(); i++) {
+        for (int corner = 0; corner < 3; corner++) {
+            sorted[i * 3 + corner] = indices[order[i] * 3 + corner];
+        }
+        if (!faceMaterials.empty()) {
+            sortedMaterials[i] = faceMaterials[order[i]];
+        }
+        order[i] = i;
+    }
+    indices.swap(sorted);
+    faceMaterials.swap(sortedMaterials);
+}
+
+// Solves for the barycentric coordinates and time with Cramer's rule
+bool Mesh::intersectTriangle(int triangle, const Ray &ray, float &time, float &beta, float &gamma, float minTime, float maxTime) {
+    const uint32_t* corners = &indices[triangle * 3];
+    const vec3* positions = getVertexData();
+    vec3 a = positions[corners[0]];
+    vec3 edge_ba = a - positions[corners[1]];
+    vec3 edge_ca = a - positions[corners[2]];
+    vec3 aMinusOrigin = a - ray.origin;
+
+    float ei_hf = edge_ca[1] * ray.path[2] - ray.path[1] * edge_ca[2];
+    float gf_di = -(edge_ca[0] * ray.path[2] - ray.path[0] * edge_ca[2]);
+    float dh_eg = edge_ca[0] * ray.path[1] - ray.path[0] * edge_ca[1];
+
+    float M = edge_ba[0] * ei_hf + edge_ba[1] * gf_di + edge_ba[2] * dh_eg;
+
+    beta = (aMinusOrigin[0] * ei_hf + aMinusOrigin[1] * gf_di + aMinusOrigin[2] * dh_eg) / M;
+
+    // Condition for early termination
+    if (beta < 0 || beta > 1) {
+        return false;
+    }
+
+    float ak_jb = edge_ba[0] * aMinusOrigin[1] - aMinusOrigin[0] * edge_ba[1];
+    float jc_al = -(edge_ba[0] * aMinusOrigin[2] - aMinusOrigin[0] * edge_ba[2]);
+    float bl_kc = edge_ba[1] * aMinusOrigin[2] - aMinusOrigin[1] * edge_ba[2];
+
+    gamma = (ray.path[2] * ak_jb + ray.path[1] * jc_al + ray.path[0] * bl_kc) / M;
+
+    // Condition for early termination
+    if (gamma < 0 || gamma > 1-beta) {
+        return false;
+    }
+
+    // If we have gotten this far, the ray has hit the triangle
+    float t = -(edge_ca[2] * ak_jb + edge_ca[1] * jc_al + edge_ca[0] * bl_kc) / M;
+    if (t > minTime && t < maxTime) {
+        time = t;
+        return true;
+    }
+
+    return false;
+}
+
+bool Mesh::intersects(Ray ray, Hit &hit, float minTime) {
+    bool found = false;
+    bvh.traverse(ray, minTime, hit.time, [&](int triangle, float &maxTime) {
+        float beta, gamma;
+        if (intersectTriangle(triangle, ray, hit.time, beta, gamma, minTime, maxTime)) {
+            maxTime = hit.time;
+            hit.primitive = triangle;
+            hit.beta = beta;
+            hit.gamma = gamma;
+            found = true;
+        }
+        return false;
+    });
+    return found;
+}
+
+bool Mesh::occluded(Ray ray, float minTime, float maxTime) {
+    bool hit = false;
+    bvh.traverse(ray, minTime, maxTime, [&](int triangle, float &maxTime) {
+        float time, beta, gamma;
+        hit = intersectTriangle(triangle, ray, time, beta, gamma, minTime, maxTime);
+        return hit;
+    });
+    return hit;
+}
+
+vec3 Mesh::getVertex(int triangle, int corner) {
+    return getVertexData()[indices[triangle * 3 + corner]];
+}
+
+vec3 Mesh::getNormal(int triangle) {
+    vec3 edge1 = getVertex(triangle, 1) - getVertex(triangle, 0);
+    vec3 edge2 = getVertex(triangle, 2) - getVertex(triangle, 0);
+    return glm::normalize( glm::cross(edge1, edge2) );
+}
+
+Material* Mesh::getMaterial(int triangle) {
+    return materials[faceMaterials.empty() ? 0 : faceMaterials[triangle]];
+}
+
+std::vector<Material*> &Mesh::getMaterials() {
+    return materials;
+}
+
+size_t Mesh::getVertexCount() {
+    return mapping ? mappedCount : vertices.size();
+}
+
+size_t Mesh::getTriangleCount() {
+    return indices.size() / 3;
+}
+
+size_t Mesh::getBytes() {
+    return getVertexCount() * sizeof(vec3) + indices.size() * sizeof(uint32_t) + faceMaterials.size() * sizeof(uint16_t) +
+           bvh.getStats().bytes;
+}
+
+BVH &Mesh::getBVH() {
+    return bvh;
+}
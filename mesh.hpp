@@ -0,0 +1,90 @@
+//
+//  mesh.hpp
+//  
+//
+//  Created by Brendan Martin on 10/19/26.
+//
+
+#ifndef mesh_hpp
+#define mesh_hpp
+
+#include <stdio.h>
+#include <stdint.h>
+#include <vector>
+#include <memory>
+#include <glm/glm.hpp>
+#include "geometry.hpp"
+#include "material.hpp"
+#include "bvh.hpp"
+#include "mappedfile.hpp"
+
+typedef glm::vec3 vec3;
+
+// Triangles that share their vertices. Every vertex is stored once and
+// every triangle as three 32-bit indices into the vertices, counterclockwise,
+// which takes about a third of the memory of three vertices per triangle.
+// Faces all use the first material unless the mesh has several, in which
+// case every face stores the index of its own; a mesh can use up to 65536
+// materials.
+class Mesh {
+    std::vector<vec3> vertices;
+    // Vertices used in place inside a mapped file instead of vertices,
+    // kept alive by the mapping
+    std::shared_ptr<MappedFile> mapping;
+    const vec3* mappedVertices;
+    size_t mappedCount;
+    std::vector<uint32_t> indices;
+    std::vector<Material*> materials;
+    // Index into materials of every face, empty while there is only one
+    std::vector<uint16_t> faceMaterials;
+    BVH bvh;
+
+    bool intersectTriangle(int triangle, const Ray &ray, float &time, float &beta, float &gamma, float minTime, float maxTime);
+    const vec3* getVertexData();
+
+public:
+    Mesh();
+
+    static const size_t maxMaterials = 65536;
+
+    // Returns the index of the new vertex
+    uint32_t addVertex(vec3 position);
+    // Vertices must have been added before the triangles that use them.
+    // Returns false, without adding the triangle, if it would take the mesh
+    // past maxMaterials materials.
+    bool addTriangle(uint32_t a, uint32_t b, uint32_t c, Material* material);
+    void reserve(size_t vertexCount, size_t triangleCount);
+    // Uses count vertices inside a mapped file without copying them. The
+    // data must be aligned for floats.
+    void adoptVertices(std::shared_ptr<MappedFile> file, const vec3* data, size_t count);
+    // Gives every face the same material
+    void setMaterial(Material* material);
+
+    // For loaders that fill the buffers directly: three indices per triangle
+    std::vector<vec3> &getVertexBuffer();
+    std::vector<uint32_t> &getIndexBuffer();
+
+    // Builds the BVH over the triangles and reorders them to match it
+    void build(int threads = 0);
+
+    // Lowers the hit to the closest triangle within (minTime, hit.time), and
+    // returns whether there was one
+    bool intersects(Ray ray, Hit &hit, float minTime);
+    // Returns true if any triangle is hit within (minTime, maxTime)
+    bool occluded(Ray ray, float minTime, float maxTime);
+
+    vec3 getVertex(int triangle, int corner);
+    vec3 getNormal(int triangle);
+    Material* getMaterial(int triangle);
+    // Every material the faces use, for fixing pointers when the scene's
+    // materials move
+    std::vector<Material*> &getMaterials();
+
+    size_t getVertexCount();
+    size_t getTriangleCount();
+    // Memory taken by the vertices, indices, face materials and BVH
+    size_t getBytes();
+    BVH &getBVH();
+};
+
+#endif /* mesh_hpp */
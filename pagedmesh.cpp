@@ -0,0 +1,454 @@
+//
+//  pagedmesh.cpp
+//  
+//
+//  Created by Brendan Martin on 10/19/26.
+//
+
+#include "pagedmesh.hpp"
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <cstring>
+
+static const char pageMagic[8] = { 'M', 'E', 'S', 'H', 'P', 'A', 'G', 'E' };
+
+// Chunks start on page boundaries, so dropping one chunk's pages never
+// drops part of another
+static const uint64_t pageSize = 4096;
+
+static uint64_t alignPage(uint64_t offset) {
+    return (offset + pageSize - 1) & ~(pageSize - 1);
+}
+
+static void pad(std::ofstream &out, uint64_t offset) {
+    while ((uint64_t)out.tellp() < offset) {
+        out.put(0);
+    }
+}
+
+static uint64_t chunkBytes(const PageChunk &chunk) {
+    return (uint64_t)chunk.vertexCount * sizeof(vec3) + (uint64_t)chunk.triangleCount * 3 * sizeof(uint32_t) +
+           (uint64_t)chunk.nodeCount * sizeof(WideNode);
+}
+
+static void error(string file, string message) {
+    std::cerr << file << ": " << message << std::endl;
+}
+
+// Time at which a ray enters a chunk's box, infinite if it misses it
+static float entryTime(const PageChunk &chunk, const Ray &ray) {
+    float enter = -std::numeric_limits<float>::infinity();
+    float exit = std::numeric_limits<float>::infinity();
+    for (int axis = 0; axis < 3; axis++) {
+        float inverse = 1.0f / ray.path[axis];
+        float near = (chunk.boundsMin[axis] - ray.origin[axis]) * inverse;
+        float far = (chunk.boundsMax[axis] - ray.origin[axis]) * inverse;
+        if (near > far) {
+            std::swap(near, far);
+        }
+        // Rays parallel to a slab give NaN when they start on its plane
+        enter = near > enter ? near : enter;
+        exit = far < exit ? far : exit;
+    }
+    return enter <= exit ? enter : std::numeric_limits<float>::infinity();
+}
+
+ChunkCache::ChunkCache() {
+    budget = 0;
+    bytes = 0;
+    loads = 0;
+    evictions = 0;
+}
+
+std::shared_ptr<Mesh> ChunkCache::find(Slot &slot) {
+    std::lock_guard<std::mutex> guard(lock);
+    if (slot.mesh) {
+        uses.splice(uses.begin(), uses, slot.use);
+    }
+    return slot.mesh;
+}
+
+std::shared_ptr<Mesh> ChunkCache::insert(Slot &slot, std::shared_ptr<Mesh> mesh) {
+    size_t size = mesh->getBytes();
+    std::lock_guard<std::mutex> guard(lock);
+    if (slot.mesh) {
+        uses.splice(uses.begin(), uses, slot.use);
+        return slot.mesh;
+    }
+    slot.mesh = mesh;
+    slot.use = uses.insert(uses.begin(), &slot);
+    slot.bytes = size;
+    bytes += size;
+    loads++;
+
+    // The chunk just read stays even if it alone is over the budget
+    while (budget > 0 && bytes > budget && uses.size() > 1) {
+        Slot* oldest = uses.back();
+        uses.pop_back();
+        bytes -= oldest->bytes;
+        oldest->mesh.reset();
+        evictions++;
+    }
+    return mesh;
+}
+
+void ChunkCache::remove(Slot &slot) {
+    std::lock_guard<std::mutex> guard(lock);
+    if (slot.mesh) {
+        uses.erase(slot.use);
+        bytes -= slot.bytes;
+        slot.mesh.reset();
+    }
+}
+
+void ChunkCache::setBudget(size_t size) {
+    std::lock_guard<std::mutex> guard(lock);
+    budget = size;
+}
+
+size_t ChunkCache::getBudget() {
+    return budget;
+}
+
+size_t ChunkCache::getBytes() {
+    std::lock_guard<std::mutex> guard(lock);
+    return bytes;
+}
+
+uint64_t ChunkCache::getLoads() {
+    std::lock_guard<std::mutex> guard(lock);
+    return loads;
+}
+
+uint64_t ChunkCache::getEvictions() {
+    std::lock_guard<std::mutex> guard(lock);
+    return evictions;
+}
+
+ChunkSlots::~ChunkSlots() {
+    for (size_t s = 0; s < slots.size(); s++) {
+        cache->remove(slots[s]);
+    }
+}
+
+PagedMesh::PagedMesh() {
+    material = NULL;
+    triangleCount = 0;
+}
+
+bool PagedMesh::write(string file, Mesh &mesh, int chunkTriangles, int threads) {
+    size_t count = mesh.getTriangleCount();
+    if (count == 0) {
+        error(file, "mesh has no triangles");
+        return false;
+    }
+    chunkTriangles = std::max(chunkTriangles, 1);
+
+    // After building, triangles are in the order of the BVH's leaves, so
+    // consecutive triangles are close together and every chunk is a compact
+    // piece of the mesh
+    mesh.build(threads);
+
+    std::ofstream out(file, std::ios::binary);
+    if (!out) {
+        error(file, "could not open file for writing");
+        return false;
+    }
+
+    std::vector<PageChunk> table((count + chunkTriangles - 1) / chunkTriangles);
+    PageHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, pageMagic, 8);
+    header.version = version;
+    header.chunkCount = table.size();
+    header.triangleCount = count;
+    header.tableOffset = sizeof(header);
+    uint64_t offset = alignPage(header.tableOffset + table.size() * sizeof(PageChunk));
+
+    // Vertices are renumbered within each chunk, and vertices shared by two
+    // chunks are stored in both
+    std::vector<uint32_t> local(mesh.getVertexCount(), std::numeric_limits<uint32_t>::max());
+    std::vector<uint32_t> used;
+    std::vector<uint32_t> &indices = mesh.getIndexBuffer();
+    for (size_t c = 0; c < table.size(); c++) {
+        size_t first = c * chunkTriangles;
+        size_t last = std::min(first + chunkTriangles, count);
+        Mesh piece;
+        for (size_t t = first; t < last; t++) {
+            uint32_t corners[3];
+            for (int corner = 0; corner < 3; corner++) {
+                uint32_t vertex = indices[t * 3 + corner];
+                if (local[vertex] == std::numeric_limits<uint32_t>::max()) {
+                    local[vertex] = piece.addVertex(mesh.getVertex(t, corner));
+                    used.push_back(vertex);
+                }
+                corners[corner] = local[vertex];
+            }
+            piece.addTriangle(corners[0], corners[1], corners[2], NULL);
+        }
+        for (size_t v = 0; v < used.size(); v++) {
+            local[used[v]] = std::numeric_limits<uint32_t>::max();
+        }
+        used.clear();
+        piece.build(threads);
+
+        std::vector<vec3> &vertices = piece.getVertexBuffer();
+        PageChunk &chunk = table[c];
+        memset(&chunk, 0, sizeof(chunk));
+        vec3 boundsMin = vertices[0];
+        vec3 boundsMax = vertices[0];
+        for (size_t v = 1; v < vertices.size(); v++) {
+            boundsMin = glm::min(boundsMin, vertices[v]);
+            boundsMax = glm::max(boundsMax, vertices[v]);
+        }
+        for (int axis = 0; axis < 3; axis++) {
+            chunk.boundsMin[axis] = boundsMin[axis];
+            chunk.boundsMax[axis] = boundsMax[axis];
+        }
+        chunk.vertexCount = vertices.size();
+        chunk.triangleCount = last - first;
+        chunk.nodeCount = piece.getBVH().getNodes().size();
+        chunk.offset = offset;
+
+        pad(out, offset);
+        out.write((const char*)vertices.data(), vertices.size() * sizeof(vec3));
+        out.write((const char*)piece.getIndexBuffer().data(), piece.getIndexBuffer().size() * sizeof(uint32_t));
+        out.write((const char*)piece.getBVH().getNodes().data(), chunk.nodeCount * sizeof(WideNode));
+        offset = alignPage(offset + chunkBytes(chunk));
+    }
+
+    out.seekp(0);
+    out.write((const char*)&header, sizeof(header));
+    out.write((const char*)table.data(), table.size() * sizeof(PageChunk));
+    return out.good();
+}
+
+bool PagedMesh::load(string file, Material* mat, ChunkCache &cache) {
+    *this = PagedMesh();
+    material = mat;
+
+    std::shared_ptr<MappedFile> mapped = std::make_shared<MappedFile>();
+    if (!mapped->open(file, AccessRandom)) {
+        error(file, "could not open file");
+        return false;
+    }
+    const char* data = mapped->getData();
+    size_t size = mapped->getSize();
+    if (size < sizeof(PageHeader) || memcmp(data, pageMagic, 8) != 0) {
+        error(file, "not a paged mesh");
+        return false;
+    }
+    PageHeader header;
+    memcpy(&header, data, sizeof(header));
+    if (header.version != version) {
+        error(file, "written with paged mesh format version " + std::to_string(header.version) +
+                    ", expected " + std::to_string(version));
+        return false;
+    }
+    if (header.tableOffset > size || (size - header.tableOffset) / sizeof(PageChunk) < header.chunkCount) {
+        error(file, "file is truncated");
+        return false;
+    }
+
+    chunks.resize(header.chunkCount);
+    memcpy(chunks.data(), data + header.tableOffset, chunks.size() * sizeof(PageChunk));
+    std::vector<BoundingBox> boxes(chunks.size());
+    uint64_t triangles = 0;
+    for (size_t c = 0; c < chunks.size(); c++) {
+        const PageChunk &chunk = chunks[c];
+        if (chunk.offset > size || size - chunk.offset < chunkBytes(chunk) || chunk.offset % pageSize != 0) {
+            error(file, "file is truncated");
+            return false;
+        }
+        boxes[c].boundsMin = vec3(chunk.boundsMin[0], chunk.boundsMin[1], chunk.boundsMin[2]);
+        boxes[c].boundsMax = vec3(chunk.boundsMax[0], chunk.boundsMax[1], chunk.boundsMax[2]);
+        triangles += chunk.triangleCount;
+    }
+    if (triangles != header.triangleCount) {
+        error(file, "chunks hold " + std::to_string(triangles) + " triangles, expected " +
+                    std::to_string(header.triangleCount));
+        return false;
+    }
+
+    mapping = mapped;
+    filename = file;
+    bvh.build(boxes);
+    slots = std::make_shared<ChunkSlots>();
+    slots->cache = &cache;
+    slots->slots.resize(chunks.size());
+    triangleCount = header.triangleCount;
+    return true;
+}
+
+std::shared_ptr<Mesh> PagedMesh::readChunk(int c) {
+    const PageChunk &chunk = chunks[c];
+    const char* data = mapping->getData() + chunk.offset;
+    std::shared_ptr<Mesh> mesh = std::make_shared<Mesh>();
+
+    std::vector<vec3> &vertices = mesh->getVertexBuffer();
+    std::vector<uint32_t> &indices = mesh->getIndexBuffer();
+    std::vector<WideNode> &nodes = mesh->getBVH().getNodes();
+    std::vector<int> &order = mesh->getBVH().getIndices();
+    const vec3* fileVertices = (const vec3*)data;
+    const uint32_t* fileIndices = (const uint32_t*)(data + chunk.vertexCount * sizeof(vec3));
+    const WideNode* fileNodes = (const WideNode*)(fileIndices + chunk.triangleCount * 3);
+    vertices.assign(fileVertices, fileVertices + chunk.vertexCount);
+    indices.assign(fileIndices, fileIndices + chunk.triangleCount * 3);
+    nodes.assign(fileNodes, fileNodes + chunk.nodeCount);
+    // Triangles were stored in the order of the chunk's leaves
+    order.resize(chunk.triangleCount);
+    for (uint32_t t = 0; t < chunk.triangleCount; t++) {
+        order[t] = t;
+    }
+    mesh->setMaterial(NULL);
+
+    // The copy is what is kept, so the file's pages are not needed any more
+    mapping->release(chunk.offset, chunkBytes(chunk));
+
+    // Chunks are checked as they are read, so a damaged chunk is reported
+    // and left empty rather than traced
+    bool valid = true;
+    for (size_t i = 0; i < indices.size(); i++) {
+        valid = valid && indices[i] < chunk.vertexCount;
+    }
+    std::vector<int> depth(chunk.nodeCount, 1);
+    for (uint32_t n = 0; n < chunk.nodeCount; n++) {
+        valid = valid && depth[n] <= maxTreeDepth;
+        for (int s = 0; s < 8; s++) {
+            uint32_t meta = nodes[n].meta[s];
+            if (nodes[n].interiorMask >> s & 1) {
+                uint64_t child = (uint64_t)nodes[n].childBase + meta;
+                valid = valid && child > n && child < chunk.nodeCount;
+                if (valid) {
+                    depth[child] = std::max(depth[child], depth[n] + 1);
+                }
+            } else if (meta != 0) {
+                valid = valid && (uint64_t)nodes[n].primitiveBase + (meta >> 3) + (meta & 7) <= chunk.triangleCount;
+            }
+        }
+    }
+    if (!valid) {
+        error(filename, "chunk " + std::to_string(c) + " is damaged");
+        indices.clear();
+        nodes.clear();
+        order.clear();
+    }
+    return mesh;
+}
+
+std::shared_ptr<Mesh> PagedMesh::getChunk(int c) {
+    ChunkCache::Slot &slot = slots->slots[c];
+    std::shared_ptr<Mesh> mesh = slots->cache->find(slot);
+    if (!mesh) {
+        mesh = slots->cache->insert(slot, readChunk(c));
+    }
+    return mesh;
+}
+
+bool PagedMesh::intersects(Ray ray, vec3 &location, vec3 &normal, float &time, float minTime, float maxTime) {
+    // The chunk of the closest hit is kept until its normal is known
+    Hit hit = { maxTime, -1, 0.0f, 0.0f };
+    std::shared_ptr<Mesh> closest;
+    bvh.traverse(ray, minTime, maxTime, [&](int c, float &maxTime) {
+        std::shared_ptr<Mesh> chunk = getChunk(c);
+        if (chunk->intersects(ray, hit, minTime)) {
+            maxTime = hit.time;
+            closest = chunk;
+        }
+        return false;
+    });
+    if (!closest) {
+        return false;
+    }
+
+    time = hit.time;
+    location = ray.origin + (time * ray.path);
+    normal = closest->getNormal(hit.primitive);
+    return true;
+}
+
+bool PagedMesh::occluded(Ray ray, float minTime, float maxTime) {
+    bool hit = false;
+    bvh.traverse(ray, minTime, maxTime, [&](int c, float &maxTime) {
+        hit = getChunk(c)->occluded(ray, minTime, maxTime);
+        return hit;
+    });
+    return hit;
+}
+
+void PagedMesh::intersects(const std::vector<Ray> &rays, std::vector<PagedHit> &hits, float minTime) {
+    // The chunk may be dropped before the ray is done, so every closer hit
+    // is worked out while the chunk is at hand
+    auto trace = [&](Mesh &mesh, size_t r) {
+        Hit hit = { hits[r].time, -1, 0.0f, 0.0f };
+        if (mesh.intersects(rays[r], hit, minTime)) {
+            hits[r].time = hit.time;
+            hits[r].location = rays[r].origin + (hit.time * rays[r].path);
+            hits[r].normal = mesh.getNormal(hit.primitive);
+            hits[r].material = material;
+        }
+    };
+
+    // Chunks in memory are traced right away, the rest wait
+    std::vector< std::vector<int> > waiting(chunks.size());
+    for (size_t r = 0; r < rays.size(); r++) {
+        bvh.traverse(rays[r], minTime, hits[r].time, [&](int c, float &maxTime) {
+            std::shared_ptr<Mesh> mesh = slots->cache->find(slots->slots[c]);
+            if (mesh) {
+                trace(*mesh, r);
+                maxTime = hits[r].time;
+            } else {
+                waiting[c].push_back(r);
+            }
+            return false;
+        });
+    }
+
+    // Chunks with the most rays waiting go first. Every chunk is read once
+    // for all of its rays, and a chunk is not read at all if the rays
+    // waiting on it have since hit something in front of it.
+    std::vector<int> order;
+    for (size_t c = 0; c < chunks.size(); c++) {
+        if (!waiting[c].empty()) {
+            order.push_back(c);
+        }
+    }
+    std::stable_sort(order.begin(), order.end(), [&](int a, int b) {
+        return waiting[a].size() > waiting[b].size();
+    });
+    for (size_t i = 0; i < order.size(); i++) {
+        std::vector<int> &rayList = waiting[order[i]];
+        rayList.erase(std::remove_if(rayList.begin(), rayList.end(), [&](int r) {
+            return entryTime(chunks[order[i]], rays[r]) >= hits[r].time;
+        }), rayList.end());
+        if (rayList.empty()) {
+            continue;
+        }
+        std::shared_ptr<Mesh> mesh = getChunk(order[i]);
+        for (size_t r = 0; r < rayList.size(); r++) {
+            trace(*mesh, rayList[r]);
+        }
+    }
+}
+
+Material* PagedMesh::getMaterial() {
+    return material;
+}
+
+void PagedMesh::setMaterial(Material* mat) {
+    material = mat;
+}
+
+uint64_t PagedMesh::getTriangleCount() {
+    return triangleCount;
+}
+
+int PagedMesh::getChunkCount() {
+    return chunks.size();
+}
+
+BVH &PagedMesh::getBVH() {
+    return bvh;
+}
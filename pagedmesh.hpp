@@ -0,0 +1,157 @@
+//
+//  pagedmesh.hpp
+//  
+//
+//  Created by Brendan Martin on 10/19/26.
+//
+
+#ifndef pagedmesh_hpp
+#define pagedmesh_hpp
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <glm/glm.hpp>
+#include "geometry.hpp"
+#include "material.hpp"
+#include "bvh.hpp"
+#include "mesh.hpp"
+#include "mappedfile.hpp"
+
+typedef glm::vec3 vec3;
+typedef std::string string;
+
+// Paged mesh files start with this header, followed by a table of
+// chunkCount chunks. Each chunk is a piece of the mesh with its own
+// vertices, triangles as three indices into them and BVH nodes, stored in
+// that order from a page-aligned offset, so one chunk can be read and
+// dropped without touching the others. Values are in the byte order of the
+// machine that wrote the file.
+struct PageHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t chunkCount;
+    uint64_t triangleCount;
+    uint64_t tableOffset;
+};
+
+struct PageChunk {
+    float boundsMin[3];
+    float boundsMax[3];
+    uint32_t vertexCount;
+    uint32_t triangleCount;
+    uint32_t nodeCount;
+    uint32_t padding;
+    uint64_t offset;
+};
+
+// The closest hit of a ray, for rays traced as a batch
+struct PagedHit {
+    vec3 location;
+    vec3 normal;
+    // Rays are only traced up to the time already in the hit
+    float time;
+    // NULL while nothing has been hit
+    Material* material;
+};
+
+// Chunks of paged meshes that are in memory. Every paged mesh of a scene
+// shares one cache, so one budget bounds them all; once the chunks take
+// more than the budget the least recently used ones are dropped. Chunks
+// still being traced by another thread are freed when it is done with them.
+class ChunkCache {
+public:
+    struct Slot {
+        std::shared_ptr<Mesh> mesh;
+        std::list<Slot*>::iterator use;
+        size_t bytes;
+    };
+
+private:
+    std::mutex lock;
+    // Slots holding a chunk, most recently used first
+    std::list<Slot*> uses;
+    size_t budget;
+    size_t bytes;
+    uint64_t loads;
+    uint64_t evictions;
+
+public:
+    ChunkCache();
+    ChunkCache(const ChunkCache&) = delete;
+    ChunkCache& operator=(const ChunkCache&) = delete;
+
+    // Returns the slot's chunk, or NULL if it is not in memory
+    std::shared_ptr<Mesh> find(Slot &slot);
+    // Puts a chunk that was just read into its slot and drops chunks until
+    // the cache fits its budget again. If another thread read the chunk
+    // first, its copy is returned instead.
+    std::shared_ptr<Mesh> insert(Slot &slot, std::shared_ptr<Mesh> mesh);
+    void remove(Slot &slot);
+
+    // Bytes of chunks kept in memory, 0 for no limit
+    void setBudget(size_t budget);
+    size_t getBudget();
+    size_t getBytes();
+    uint64_t getLoads();
+    uint64_t getEvictions();
+};
+
+// The cache slots of one paged mesh, shared by its copies and taken out of
+// the cache with the last of them
+struct ChunkSlots {
+    ChunkCache* cache;
+    std::vector<ChunkCache::Slot> slots;
+
+    ~ChunkSlots();
+};
+
+// A triangle mesh too large to keep in memory. Only a BVH over the boxes of
+// its chunks is loaded up front; chunks are read from the mapped file when
+// a ray first reaches them and kept in a ChunkCache. Every face shares one
+// material.
+class PagedMesh {
+    string filename;
+    std::shared_ptr<MappedFile> mapping;
+    std::vector<PageChunk> chunks;
+    std::shared_ptr<ChunkSlots> slots;
+    BVH bvh;
+    Material* material;
+    uint64_t triangleCount;
+
+    std::shared_ptr<Mesh> getChunk(int chunk);
+    std::shared_ptr<Mesh> readChunk(int chunk);
+
+public:
+    // Increased whenever the layout of the file changes
+    static const uint32_t version = 1;
+
+    PagedMesh();
+
+    // Builds the mesh's BVH, cuts its triangles into chunks of up to
+    // chunkTriangles consecutive leaves, and writes them as a paged file
+    static bool write(string file, Mesh &mesh, int chunkTriangles, int threads = 0);
+    // Maps a paged file and reads its chunk table. Errors are printed.
+    bool load(string file, Material* material, ChunkCache &cache);
+
+    // Single rays read the chunks they reach on the spot
+    bool intersects(Ray ray, vec3 &location, vec3 &normal, float &time, float minTime, float maxTime);
+    bool occluded(Ray ray, float minTime, float maxTime);
+    // Traces a batch of rays, only lowering hits that are nearer than the
+    // ones already found. Rays reaching chunks that are not in memory wait
+    // in a queue per chunk, and every chunk is then read once for all the
+    // rays waiting on it.
+    void intersects(const std::vector<Ray> &rays, std::vector<PagedHit> &hits, float minTime);
+
+    Material* getMaterial();
+    void setMaterial(Material* mat);
+    uint64_t getTriangleCount();
+    int getChunkCount();
+    BVH &getBVH();
+};
+
+#endif /* pagedmesh_hpp */
@@ -6,211 +6,818 @@
 //
 
 #include "parser.hpp"
+#include "mappedfile.hpp"
+#include "ply.hpp"
+#include <charconv>
+#include <thread>
+#include <algorithm>
+#include <cstring>
+#include <map>
+
+// Tokenizer Class
+
+Tokenizer::Tokenizer(const char* data, size_t size, int firstLine) {
+    cur = data;
+    end = data + size;
+    lineStart = data;
+    tokenStart = data;
+    line = firstLine;
+    started = false;
+}
+
+bool Tokenizer::nextLine() {
+    if (started) {
+        // Skip whatever is left of the current line
+        while (cur < end && *cur != '\n') {
+            cur++;
+        }
+        if (cur == end) {
+            return false;
+        }
+        cur++;
+        line++;
+    }
+    started = true;
+
+    lineStart = cur;
+    tokenStart = cur;
+    return cur < end;
+}
+
+bool Tokenizer::next(string_view &token) {
+    while (cur < end && (*cur == ' ' || *cur == '\t' || *cur == '\r')) {
+        cur++;
+    }
+    tokenStart = cur;
+    if (cur == end || *cur == '\n') {
+        return false;
+    }
+
+    while (cur < end && *cur != ' ' && *cur != '\t' && *cur != '\r' && *cur != '\n') {
+        cur++;
+    }
+    token = string_view(tokenStart, cur - tokenStart);
+    return true;
+}
+
+int Tokenizer::getLine() {
+    return line;
+}
+
+int Tokenizer::getColumn() {
+    return (int)(tokenStart - lineStart) + 1;
+}
+
+
+// Parser Class
 
 Parser::Parser() {
+    errors = 0;
+}
+
+// Numbers may be followed by a comma, as in "vec3(1,2,3), 0.5,"
+bool Parser::parseFloat(string_view token, float &value) {
+    const char* first = token.data();
+    const char* last = first + token.size();
+    std::from_chars_result result = std::from_chars(first, last, value);
+    if (result.ec != std::errc() || result.ptr == first) {
+        return false;
+    }
+    return result.ptr == last || (*result.ptr == ',' && result.ptr + 1 == last);
+}
+
+// Reads count numbers written as prefix(a,b,...)
+static bool parseComponents(string_view token, const char* prefix, int count, float* values) {
+    size_t length = strlen(prefix);
+    if (token.compare(0, length, prefix) != 0) {
+        return false;
+    }
+
+    const char* p = token.data() + length;
+    const char* last = token.data() + token.size();
+    for (int i = 0; i < count; i++) {
+        std::from_chars_result result = std::from_chars(p, last, values[i]);
+        if (result.ec != std::errc() || result.ptr == p || result.ptr == last) {
+            return false;
+        }
+        p = result.ptr;
+
+        // Components are separated by commas and closed by a parenthesis
+        if (*p != (i < count - 1 ? ',' : ')')) {
+            return false;
+        }
+        p++;
+    }
+
+    return p == last || (*p == ',' && p + 1 == last);
+}
+
+// Vectors are written as vec3(x,y,z)
+bool Parser::parseVec(string_view token, vec3 &value) {
+    float values[3];
+    if (!parseComponents(token, "vec3(", 3, values)) {
+        return false;
+    }
+    value = vec3(values[0], values[1], values[2]);
+    return true;
+}
+
+// Matrices are written as mat4(...) with sixteen numbers, row by row
+bool Parser::parseMat(string_view token, mat4 &value) {
+    float values[16];
+    if (!parseComponents(token, "mat4(", 16, values)) {
+        return false;
+    }
+    for (int row = 0; row < 4; row++) {
+        for (int column = 0; column < 4; column++) {
+            value[column][row] = values[row * 4 + column];
+        }
+    }
+    return true;
+}
+
+void Parser::error(Tokenizer &tokens, ParseChunk &chunk, string message) {
+    ParseError e = { tokens.getLine(), tokens.getColumn(), message };
+    chunk.errors.push_back(e);
+}
+
+bool Parser::expectFloat(Tokenizer &tokens, ParseChunk &chunk, float &value, const char* name) {
+    string_view token;
+    if (!tokens.next(token)) {
+        error(tokens, chunk, string("expected ") + name);
+        return false;
+    }
+    if (!parseFloat(token, value)) {
+        error(tokens, chunk, string("invalid number for ") + name + ": " + string(token));
+        return false;
+    }
+    return true;
+}
+
+bool Parser::expectVec(Tokenizer &tokens, ParseChunk &chunk, vec3 &value, const char* name) {
+    string_view token;
+    if (!tokens.next(token)) {
+        error(tokens, chunk, string("expected ") + name);
+        return false;
+    }
+    if (!parseVec(token, value)) {
+        error(tokens, chunk, string("invalid vec3 for ") + name + ": " + string(token));
+        return false;
+    }
+    return true;
+}
+
+bool Parser::expectWord(Tokenizer &tokens, ParseChunk &chunk, string_view &value, const char* name) {
+    if (!tokens.next(value)) {
+        error(tokens, chunk, string("expected ") + name);
+        return false;
+    }
+    return true;
+}
+
+bool Parser::expectInt(Tokenizer &tokens, ParseChunk &chunk, int &value, const char* name) {
+    string_view token;
+    if (!tokens.next(token)) {
+        error(tokens, chunk, string("expected ") + name);
+        return false;
+    }
+    const char* last = token.data() + token.size();
+    if (std::from_chars(token.data(), last, value).ptr != last || value < 0) {
+        error(tokens, chunk, string("invalid number for ") + name + ": " + string(token));
+        return false;
+    }
+    return true;
+}
+
+// Keyframes refer to cam#, obj# or light#, counting cameras, spheres outside
+// groups and lights in the order they appear in the file
+bool Parser::expectTarget(Tokenizer &tokens, ParseChunk &chunk, KeyTarget &target, int &index) {
+    string_view token;
+    if (!tokens.next(token)) {
+        error(tokens, chunk, "expected cam#, obj# or light#");
+        return false;
+    }
+
+    size_t prefix = 0;
+    if (token.compare(0, 3, "cam") == 0) {
+        target = KeyCamera;
+        prefix = 3;
+    } else if (token.compare(0, 3, "obj") == 0) {
+        target = KeyObject;
+        prefix = 3;
+    } else if (token.compare(0, 5, "light") == 0) {
+        target = KeyLight;
+        prefix = 5;
+    }
+    const char* first = token.data() + prefix;
+    const char* last = token.data() + token.size();
+    if (prefix == 0 || first == last || std::from_chars(first, last, index).ptr != last || index < 0) {
+        error(tokens, chunk, "invalid keyframe target: " + string(token));
+        return false;
+    }
+    return true;
+}
 
+// Instances are placed by a mat4 transform, or moved by a vec3 offset
+bool Parser::expectTransform(Tokenizer &tokens, ParseChunk &chunk, mat4 &value) {
+    string_view token;
+    if (!tokens.next(token)) {
+        error(tokens, chunk, "expected transform");
+        return false;
+    }
+    vec3 offset;
+    if (parseVec(token, offset)) {
+        value = mat4(1.0f);
+        value[3] = vec4(offset, 1.0f);
+    } else if (!parseMat(token, value)) {
+        error(tokens, chunk, "invalid mat4 or vec3 for transform: " + string(token));
+        return false;
+    }
+    if (glm::determinant(value) == 0.0f) {
+        error(tokens, chunk, "transform can not be inverted: " + string(token));
+        return false;
+    }
+    return true;
+}
+
+// Materials are referenced as mat#, where # indexes the materials defined so far
+bool Parser::expectMaterial(Tokenizer &tokens, ParseChunk &chunk, int &index) {
+    string_view token;
+    if (!tokens.next(token)) {
+        error(tokens, chunk, "expected material");
+        return false;
+    }
+
+    const char* first = token.data() + 3;
+    const char* last = token.data() + token.size();
+    if (token.compare(0, 3, "mat") != 0 || std::from_chars(first, last, index).ptr != last || first == last || index < 0) {
+        error(tokens, chunk, "invalid material reference: " + string(token));
+        return false;
+    }
+
+    // Materials from earlier chunks are only counted when the chunks are merged
+    if (index >= (int)chunk.materials.size()) {
+        MaterialRef ref = { index, (int)chunk.materials.size(), tokens.getLine(), tokens.getColumn() };
+        chunk.materialRefs.push_back(ref);
+    }
+    return true;
 }
 
-vec3 Parser::convertVec(string command) {
-    string parameters[3];
-    
-    int delims[2];
-    delims[0] = 4;
-    
-    for (int i = 0; i < 2; i++) {
-        delims[1] = command.find(",", delims[0]+1);
-        parameters[i] = command.substr(delims[0]+1, delims[1]-delims[0]-1);
-        delims[0] = delims[1];
-    }
-    
-    delims[1] = command.find(")", delims[0]+1);
-    parameters[2] = command.substr(delims[0]+1, delims[1]-delims[0]-1);
-    
-    return vec3( std::stof(parameters[0]), std::stof(parameters[1]), std::stof(parameters[2]) );
-}
-
-void Parser::load(string file) {
-    std::ifstream buffer;
-    buffer.open(file);
-
-    if (buffer.is_open()) {
-        string str;
-        int material_num = 0;
-        numObjects = 0;
-        numLights = 0;
-        
-        string command;
-        int num_params;
-        int delims[2];
-
-        while(std::getline(buffer, str)) {
-
-            delims[0] = str.find(" ");
-            command = str.substr(0, delims[0]);
-            
-//            std::cout << command;
-            
-            // Determine number of parameters for the object
-            if (command.compare("material") == 0) { num_params = 7; }
-            else if (command.compare("sphere") == 0) { num_params = 3; }
-            else if (command.compare("light") == 0) { num_params = 3; }
-            else if (command.compare("camera") == 0) { num_params = 3; }
-            else { num_params = 0; }
-            
-            // Parse the parameters
-            string parameters[num_params];
-            
-            for (int i = 0; i < num_params; i++) {
-                delims[1] = str.find(" ", delims[0]+1);
-                parameters[i] = str.substr(delims[0]+1, delims[1]-delims[0]-1);
-                delims[0] = delims[1];
-            }
-            
-            // Initialize the object
-            if (command.compare("material") == 0) {
-
-                // Vectorize necessary parameters
-                vec3 matvecs[3];
-                matvecs[0] = convertVec(parameters[3]);
-                matvecs[1] = convertVec(parameters[5]);
-                matvecs[2] = convertVec(parameters[6]);
-
-                // Add material to list
-                materials[material_num].set(parameters[0],parameters[1],parameters[2],matvecs[0],std::stof(parameters[4]),matvecs[1],matvecs[2]);
-                material_num++;
-
-            } else if (command.compare("sphere") == 0) {
-
-                // Vectorize necessary parameters
-                vec3 matvec = convertVec(parameters[0]);
-
-                // Add sphere to list
-                // sphere(position, radius, material)
-                objects[numObjects].set(matvec, std::stof(parameters[1]), &materials[std::stoi(parameters[2].substr(3))]);
-                numObjects++;
-
-            } else if (command.compare("light") == 0) {
-
-                // Vectorize necessary parameters
-                vec3 matvec = convertVec(parameters[0]);
-
-                lights[numLights].set(matvec, std::stof(parameters[1]), &materials[std::stoi(parameters[2].substr(3))]);
-                numLights++;
-                
-            } else if (command.compare("camera") == 0) {
-                
-                cam.position = convertVec(parameters[0]);
-                cam.direction = convertVec(parameters[1]);
-                cam.focalLength = std::stof(parameters[2]);
-//                { convertVec(parameters[0]), convertVec(parameters[1]), std::stof(parameters[2]) };
-
-            } else if (command.compare("//") == 0) {
-                // Just a comment, do nothing
+void Parser::parseLine(Tokenizer &tokens, ParseChunk &chunk) {
+    string_view command;
+    if (!tokens.next(command)) {
+        // Blank line
+        return;
+    }
+
+    if (command.compare(0, 2, "//") == 0) {
+        // Just a comment, do nothing
+
+    } else if (command == "material") {
+
+        // material method distribution type emissive roughness diffuseColor fresnel
+        string_view words[3];
+        vec3 emissive, diffuse, fresnel;
+        float roughness;
+        if (expectWord(tokens, chunk, words[0], "method") && expectWord(tokens, chunk, words[1], "distribution") &&
+            expectWord(tokens, chunk, words[2], "type") && expectVec(tokens, chunk, emissive, "emissive") &&
+            expectFloat(tokens, chunk, roughness, "roughness") && expectVec(tokens, chunk, diffuse, "diffuse color") &&
+            expectVec(tokens, chunk, fresnel, "fresnel")) {
+
+            // Add material to list
+            chunk.materials.push_back(Material(string(words[0]), string(words[1]), string(words[2]), emissive, roughness, diffuse, fresnel));
+        }
+
+    } else if (command == "sphere" || command == "light") {
+
+        // sphere(position, radius, material)
+        vec3 position;
+        float radius;
+        int material;
+        if (expectVec(tokens, chunk, position, "position") && expectFloat(tokens, chunk, radius, "radius") &&
+            expectMaterial(tokens, chunk, material)) {
+
+            if (command == "sphere") {
+                chunk.objects.push_back(Sphere(position, radius, NULL));
+                chunk.objectMaterials.push_back(material);
+            } else {
+                chunk.lights.push_back(Sphere(position, radius, NULL));
+                chunk.lightMaterials.push_back(material);
+            }
+        }
+
+    } else if (command == "vertex") {
+
+        vec3 position;
+        if (expectVec(tokens, chunk, position, "vertex position")) {
+            chunk.vertices.push_back(position);
+        }
+
+    } else if (command == "triangle") {
+
+        // triangle v0 v1 v2 material, vertices counterclockwise
+        TriangleRef ref;
+        if (expectInt(tokens, chunk, ref.vertex[0], "vertex")) {
+            ref.line = tokens.getLine();
+            ref.column = tokens.getColumn();
+            if (expectInt(tokens, chunk, ref.vertex[1], "vertex") && expectInt(tokens, chunk, ref.vertex[2], "vertex") &&
+                expectMaterial(tokens, chunk, ref.material)) {
+                chunk.triangles.push_back(ref);
+            }
+        }
+
+    } else if (command == "camera") {
+
+        Camera camera;
+        if (expectVec(tokens, chunk, camera.position, "camera position") && expectVec(tokens, chunk, camera.direction, "camera direction") &&
+            expectFloat(tokens, chunk, camera.focalLength, "focal length")) {
+            chunk.cameras.push_back(camera);
+        }
+
+    } else if (command == "particles") {
+
+        // particles file radius material, radius 0 to read radii from the file
+        ParticleRef ref;
+        string_view file;
+        if (expectWord(tokens, chunk, file, "particle file")) {
+            ref.file = string(file);
+            ref.line = tokens.getLine();
+            ref.column = tokens.getColumn();
+            if (expectFloat(tokens, chunk, ref.radius, "radius") && expectMaterial(tokens, chunk, ref.material)) {
+                chunk.particleRefs.push_back(ref);
+            }
+        }
+
+    } else if (command == "mesh" || command == "pagedmesh") {
+
+        // mesh file.ply material, or pagedmesh file material
+        MeshRef ref;
+        string_view file;
+        if (expectWord(tokens, chunk, file, "mesh file")) {
+            ref.file = string(file);
+            ref.paged = command == "pagedmesh";
+            ref.line = tokens.getLine();
+            ref.column = tokens.getColumn();
+            if (expectMaterial(tokens, chunk, ref.material)) {
+                chunk.meshRefs.push_back(ref);
+            }
+        }
+
+    } else if (command == "group" || command == "endgroup") {
+
+        // group name ... endgroup
+        GroupMark mark;
+        string_view name;
+        if (command == "group" && !expectWord(tokens, chunk, name, "group name")) {
+            return;
+        }
+        mark.name = string(name);
+        mark.object = chunk.objects.size();
+        mark.line = tokens.getLine();
+        mark.column = tokens.getColumn();
+        chunk.groupMarks.push_back(mark);
+
+    } else if (command == "instance") {
+
+        // instance name transform
+        InstanceRef ref;
+        string_view name;
+        if (expectWord(tokens, chunk, name, "group name")) {
+            ref.group = string(name);
+            ref.line = tokens.getLine();
+            ref.column = tokens.getColumn();
+            if (expectTransform(tokens, chunk, ref.transform)) {
+                chunk.instances.push_back(ref);
+            }
+        }
+
+    } else if (command == "frames") {
 
+        int frames;
+        if (expectInt(tokens, chunk, frames, "frame count")) {
+            chunk.frames = std::max(1, frames);
+        }
+
+    } else if (command == "keyframe") {
+
+        // keyframe frame cam# position direction focalLength
+        // keyframe frame obj# position radius (or light#)
+        Keyframe key;
+        if (expectInt(tokens, chunk, key.frame, "frame") && expectTarget(tokens, chunk, key.target, key.index)) {
+            std::pair<int, int> position(tokens.getLine(), tokens.getColumn());
+            bool valid;
+            if (key.target == KeyCamera) {
+                valid = expectVec(tokens, chunk, key.position, "camera position") &&
+                        expectVec(tokens, chunk, key.direction, "camera direction") &&
+                        expectFloat(tokens, chunk, key.value, "focal length");
             } else {
-                std::cout << "Unknown command";
+                key.direction = vec3(0.0f);
+                valid = expectVec(tokens, chunk, key.position, "position") && expectFloat(tokens, chunk, key.value, "radius");
+            }
+            if (valid) {
+                chunk.keys.push_back(key);
+                chunk.keyPositions.push_back(position);
             }
         }
 
+    } else {
+        error(tokens, chunk, "unknown command: " + string(command));
     }
 }
 
+void Parser::parseChunk(ParseChunk &chunk) {
+    Tokenizer tokens(chunk.data, chunk.size);
+    while (tokens.nextLine()) {
+        parseLine(tokens, chunk);
+    }
+    // Every chunk but the last ends just after a newline
+    chunk.lines = tokens.getLine() - 1;
+}
 
+// Spheres [first, last) of a chunk and the group they belong to, or -1 for
+// the scene itself
+struct SphereRun {
+    size_t first;
+    size_t last;
+    int group;
+};
 
+// Splitting only pays off once each thread has a good amount of text to parse
+static const size_t minChunkSize = 1 << 20;
 
-//vec3 convertVec(string command) {
-//    return vec3(command[5], command[7], command[9]);
-//}
-//
-//void parse(string file) {
-//    std::ifstream buffer;
-//    buffer.open(file);
-//
-//    if (buffer.is_open()) {
-//        string str;
-//        int material_num = 0;
-//        numObjects = 0;
-//        numLights = 0;
-//
-//        while(std::getline(buffer, str)) {
-//
-//            delim = str.find(" ");
-//            command = str.substr(0, delim);
-//
-//            if (command.equals("material")) {
-//                num_params = 7;
-//
-//                // Parse the parameters
-//                int delims[2];
-//                delims[0] = delim;
-//                string parameters[num_params];
-//                for (int i = 0, i < num_params, i++) {
-//                    delims[1] = str.find(" ", delims[0]);
-//                    parameters[i] = str.substr(delims[0], delims[1]);
-//                    delims[0] = delims[1];
-//                }
-//
-//                // Vectorize necessary parameters
-//                vec3 matvecs[3];
-//                matvecs[0] = convertVec(parameters[3]);
-//                matvecs[1] = convertVec(parameters[5]);
-//                matvecs[2] = convertVec(parameters[6]);
-//
-////                matvecs[0] = vec3(parameters[3][5], parameters[3][7], parameters[3][9]);
-////                matvecs[1] = vec3(parameters[5][5], parameters[5][7], parameters[5][9]);
-////                matvecs[2] = vec3(parameters[6][5], parameters[6][7], parameters[6][9]);
-//
-//                // Add material to list
-//                materials[material_num].set(parameters[0],parameters[1],parameters[2],matvecs[0],std::stoi(parameters[4]),matvecs[1],matvecs[2]);
-//                material_num++;
-//
-//            } else if (command.equals("sphere")) {
-//                num_params = 3;
-//
-//                // Parse the parameters
-//                int delims[2];
-//                delims[0] = delim;
-//                string parameters[num_params];
-//                for (int i = 0, i < num_params, i++) {
-//                    delims[1] = str.find(" ", delims[0]);
-//                    parameters[i] = str.substr(delims[0], delims[1]);
-//                    delims[0] = delims[1];
-//                }
-//
-//                // Vectorize necessary parameters
-//                vec3 matvec = convertVec(parameters[0]);
-//
-//                // Add sphere to list
-//                // sphere(position, radius, material)
-//                objects[numObjects].set(matvec, std::stof(parameters[1]), materials[std::stoi(parameters[2][3:])]);
-//                numObjects++;
-//
-//            } else if (command.equals("light")) {
-//                num_params = 3;
-//
-//                // Parse the parameters
-//                int delims[2];
-//                delims[0] = delim;
-//                string parameters[num_params];
-//                for (int i = 0, i < num_params, i++) {
-//                    delims[1] = str.find(" ", delims[0]);
-//                    parameters[i] = str.substr(delims[0], delims[1]);
-//                    delims[0] = delims[1];
-//                }
-//
-//                // Vectorize necessary parameters
-//                vec3 matvec = convertVec(parameters[0]);
-//
-//                lights[numLights].set(matvec, std::stof(parameters[1]), materials[std::stoi(parameters[2][3:])]);
-//                numLights++;
-//
-//            } else if (command.equals("//")) {
-//                // Just a comment, do nothing
-//
-//            } else {
-//                std::cout << "Unknown command";
-//            }
-//        }
-//
-//    }
-//}
+bool Parser::append(const char* data, size_t size, Scene &scene, int threads) {
+    if (threads <= 0) {
+        threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+    int numChunks = (int)std::max((size_t)1, std::min((size_t)threads, size / minChunkSize));
+
+    // Split the text into chunks that start at the beginning of a line
+    std::vector<ParseChunk> chunks(numChunks);
+    const char* start = data;
+    const char* end = data + size;
+    for (int c = 0; c < numChunks; c++) {
+        const char* stop = (c == numChunks - 1) ? end : data + size * (c + 1) / numChunks;
+        stop = std::max(stop, start);
+        while (stop < end && stop[-1] != '\n') {
+            stop++;
+        }
+        chunks[c].data = start;
+        chunks[c].size = stop - start;
+        chunks[c].frames = 0;
+        start = stop;
+    }
+
+    std::vector<std::thread> workers;
+    for (int c = 1; c < numChunks; c++) {
+        workers.push_back(std::thread(&Parser::parseChunk, this, std::ref(chunks[c])));
+    }
+    parseChunk(chunks[0]);
+    for (size_t t = 0; t < workers.size(); t++) {
+        workers[t].join();
+    }
+
+    // Merge the chunks in file order. Errors are reported with their line
+    // in the whole file, and deferred material references are checked now
+    // that the number of materials before each chunk is known.
+    errors = 0;
+
+    // Spheres between group and endgroup lines go into the group rather
+    // than the scene. Groups may span chunks, so every chunk is split into
+    // runs of spheres here, where the group open at its start is known.
+    std::map<string, int> groupIndex;
+    for (size_t g = 0; g < scene.groups.size(); g++) {
+        groupIndex[scene.groups[g].name] = g;
+    }
+    std::vector<string> newGroups;
+    std::vector< std::vector<SphereRun> > runs(numChunks);
+    int open = -1;
+    GroupMark* openMark = NULL;
+    ParseChunk* openChunk = NULL;
+    for (int c = 0; c < numChunks; c++) {
+        ParseChunk &chunk = chunks[c];
+        size_t start = 0;
+        for (size_t m = 0; m < chunk.groupMarks.size(); m++) {
+            GroupMark &mark = chunk.groupMarks[m];
+            SphereRun run = { start, mark.object, open };
+            runs[c].push_back(run);
+            start = mark.object;
+
+            string message;
+            if (mark.name.empty()) {
+                if (open < 0) {
+                    message = "endgroup without group";
+                }
+                open = -1;
+            } else if (open >= 0) {
+                message = "group " + mark.name + " inside group " + openMark->name;
+            } else {
+                // A group defined twice is still opened, so its endgroup
+                // is not reported as well
+                if (groupIndex.count(mark.name) > 0) {
+                    message = "group already defined: " + mark.name;
+                } else {
+                    groupIndex[mark.name] = scene.groups.size() + newGroups.size();
+                    newGroups.push_back(mark.name);
+                }
+                open = groupIndex[mark.name];
+                openMark = &mark;
+                openChunk = &chunk;
+            }
+            if (!message.empty()) {
+                ParseError e = { mark.line, mark.column, message };
+                chunk.errors.push_back(e);
+            }
+        }
+        SphereRun run = { start, chunk.objects.size(), open };
+        runs[c].push_back(run);
+    }
+    if (open >= 0) {
+        ParseError e = { openMark->line, openMark->column, "group is never closed: " + openMark->name };
+        openChunk->errors.push_back(e);
+    }
+
+    std::vector<size_t> firstMaterial(numChunks + 1, scene.materials.size());
+    std::vector<size_t> firstObject(numChunks + 1, scene.objects.size());
+    std::vector<size_t> firstLight(numChunks + 1, scene.lights.size());
+    std::vector<size_t> firstCamera(numChunks + 1, scene.cameras.size());
+    std::vector<size_t> firstVertex(numChunks + 1, 0);
+    for (int c = 0; c < numChunks; c++) {
+        firstMaterial[c+1] = firstMaterial[c] + chunks[c].materials.size();
+        firstObject[c+1] = firstObject[c];
+        for (size_t r = 0; r < runs[c].size(); r++) {
+            if (runs[c][r].group < 0) {
+                firstObject[c+1] += runs[c][r].last - runs[c][r].first;
+            }
+        }
+        firstLight[c+1] = firstLight[c] + chunks[c].lights.size();
+        firstCamera[c+1] = firstCamera[c] + chunks[c].cameras.size();
+        firstVertex[c+1] = firstVertex[c] + chunks[c].vertices.size();
+    }
+
+    // Materials used by the triangles of the text, which all go into one mesh
+    std::vector<bool> meshMaterial(firstMaterial[numChunks], false);
+    size_t meshMaterials = 0;
+
+    int firstLine = 0;
+    for (int c = 0; c < numChunks; c++) {
+        ParseChunk &chunk = chunks[c];
+
+        for (size_t r = 0; r < chunk.materialRefs.size(); r++) {
+            MaterialRef &ref = chunk.materialRefs[r];
+            if (ref.index >= (int)firstMaterial[c] + ref.definedBefore) {
+                ParseError e = { ref.line, ref.column, "undefined material: mat" + std::to_string(ref.index) };
+                chunk.errors.push_back(e);
+            }
+        }
+
+        // Keyframes may come before or after what they move
+        for (size_t k = 0; k < chunk.keys.size(); k++) {
+            Keyframe &key = chunk.keys[k];
+            static const char* names[] = { "cam", "obj", "light" };
+            size_t count = key.target == KeyCamera ? firstCamera[numChunks] :
+                           key.target == KeyObject ? firstObject[numChunks] : firstLight[numChunks];
+            if (key.index >= (int)count) {
+                ParseError e = { chunk.keyPositions[k].first, chunk.keyPositions[k].second,
+                                 "undefined keyframe target: " + string(names[key.target]) + std::to_string(key.index) };
+                chunk.errors.push_back(e);
+            }
+        }
+
+        // Triangles may use vertices defined after them
+        for (size_t t = 0; t < chunk.triangles.size(); t++) {
+            TriangleRef &ref = chunk.triangles[t];
+            for (int corner = 0; corner < 3; corner++) {
+                if (ref.vertex[corner] >= (int)firstVertex[numChunks]) {
+                    ParseError e = { ref.line, ref.column, "undefined vertex: " + std::to_string(ref.vertex[corner]) };
+                    chunk.errors.push_back(e);
+                    break;
+                }
+            }
+            if (ref.material < (int)meshMaterial.size() && !meshMaterial[ref.material]) {
+                meshMaterial[ref.material] = true;
+                if (++meshMaterials == Mesh::maxMaterials + 1) {
+                    ParseError e = { ref.line, ref.column, "triangles use more than " + std::to_string(Mesh::maxMaterials) + " materials" };
+                    chunk.errors.push_back(e);
+                }
+            }
+        }
+
+        for (size_t i = 0; i < chunk.instances.size(); i++) {
+            InstanceRef &ref = chunk.instances[i];
+            if (groupIndex.count(ref.group) == 0) {
+                ParseError e = { ref.line, ref.column, "undefined group: " + ref.group };
+                chunk.errors.push_back(e);
+            }
+        }
+
+        // Particle and mesh files are named relative to the layout file
+        for (size_t p = 0; p < chunk.particleRefs.size(); p++) {
+            ParticleRef &ref = chunk.particleRefs[p];
+            chunk.particles.push_back(ParticleSet());
+            if (!chunk.particles.back().load(relativePath(ref.file), ref.radius, NULL)) {
+                ParseError e = { ref.line, ref.column, "could not load particles from " + ref.file };
+                chunk.errors.push_back(e);
+            }
+        }
+        for (size_t m = 0; m < chunk.meshRefs.size(); m++) {
+            MeshRef &ref = chunk.meshRefs[m];
+            bool loaded;
+            if (ref.paged) {
+                chunk.pagedMeshes.push_back(PagedMesh());
+                loaded = chunk.pagedMeshes.back().load(relativePath(ref.file), NULL, scene.chunkCache);
+            } else {
+                chunk.meshes.push_back(Mesh());
+                loaded = PLYFile().load(relativePath(ref.file), chunk.meshes.back());
+            }
+            if (!loaded) {
+                ParseError e = { ref.line, ref.column, "could not load mesh from " + ref.file };
+                chunk.errors.push_back(e);
+            }
+        }
+
+        std::stable_sort(chunk.errors.begin(), chunk.errors.end(), [](const ParseError &a, const ParseError &b) {
+            return a.line < b.line || (a.line == b.line && a.column < b.column);
+        });
+        for (size_t e = 0; e < chunk.errors.size(); e++) {
+            std::cerr << filename << ":" << firstLine + chunk.errors[e].line << ":" << chunk.errors[e].column
+                      << ": " << chunk.errors[e].message << std::endl;
+        }
+        errors += chunk.errors.size();
+        firstLine += chunk.lines;
+    }
+
+    // The scene is left untouched if anything failed to parse
+    if (errors > 0) {
+        return false;
+    }
+
+    // Adding materials may move the list, so existing spheres are pointed
+    // at the new copies of their materials
+    Material* oldMaterials = scene.materials.data();
+    for (int c = 0; c < numChunks; c++) {
+        scene.materials.insert(scene.materials.end(), chunks[c].materials.begin(), chunks[c].materials.end());
+
+        // The last camera line is the one rendered when there is no animation
+        if (!chunks[c].cameras.empty()) {
+            scene.cam = chunks[c].cameras.back();
+        }
+        scene.cameras.insert(scene.cameras.end(), chunks[c].cameras.begin(), chunks[c].cameras.end());
+        scene.keys.insert(scene.keys.end(), chunks[c].keys.begin(), chunks[c].keys.end());
+        if (chunks[c].frames > 0) {
+            scene.frames = chunks[c].frames;
+        }
+    }
+    if (scene.materials.data() != oldMaterials) {
+        for (size_t i = 0; i < firstObject[0]; i++) {
+            Sphere &s = scene.objects[i];
+            s.set(s.getPosition(), s.getRadius(), &scene.materials[s.getMaterial() - oldMaterials]);
+        }
+        for (size_t p = 0; p < scene.particles.size(); p++) {
+            scene.particles[p].setMaterial(&scene.materials[scene.particles[p].getMaterial() - oldMaterials]);
+        }
+        for (size_t g = 0; g < scene.groups.size(); g++) {
+            for (size_t i = 0; i < scene.groups[g].objects.size(); i++) {
+                Sphere &s = scene.groups[g].objects[i];
+                s.set(s.getPosition(), s.getRadius(), &scene.materials[s.getMaterial() - oldMaterials]);
+            }
+        }
+        for (size_t m = 0; m < scene.meshes.size(); m++) {
+            std::vector<Material*> &used = scene.meshes[m].getMaterials();
+            for (size_t i = 0; i < used.size(); i++) {
+                used[i] = &scene.materials[used[i] - oldMaterials];
+            }
+        }
+        for (size_t m = 0; m < scene.pagedMeshes.size(); m++) {
+            scene.pagedMeshes[m].setMaterial(&scene.materials[scene.pagedMeshes[m].getMaterial() - oldMaterials]);
+        }
+    }
+
+    // Copy every chunk into its place in the scene and resolve material
+    // pointers, which are stable now that the material list is complete.
+    // Lights are spheres like any other, placed after the new objects.
+    size_t lightBase = firstObject[numChunks] - firstLight[0];
+    scene.objects.resize(firstObject[numChunks] + firstLight[numChunks] - firstLight[0]);
+    scene.lights.resize(firstLight[numChunks]);
+    auto place = [&](int c) {
+        ParseChunk &chunk = chunks[c];
+        size_t next = firstObject[c];
+        for (size_t r = 0; r < runs[c].size(); r++) {
+            if (runs[c][r].group >= 0) {
+                continue;
+            }
+            for (size_t i = runs[c][r].first; i < runs[c][r].last; i++) {
+                Sphere &s = chunk.objects[i];
+                scene.objects[next++].set(s.getPosition(), s.getRadius(), &scene.materials[chunk.objectMaterials[i]]);
+            }
+        }
+        for (size_t i = 0; i < chunk.lights.size(); i++) {
+            Sphere &s = chunk.lights[i];
+            size_t light = firstLight[c] + i;
+            scene.objects[lightBase + light].set(s.getPosition(), s.getRadius(), &scene.materials[chunk.lightMaterials[i]]);
+            scene.lights[light] = lightBase + light;
+        }
+    };
+    workers.clear();
+    for (int c = 1; c < numChunks; c++) {
+        workers.push_back(std::thread(place, c));
+    }
+    place(0);
+    for (size_t t = 0; t < workers.size(); t++) {
+        workers[t].join();
+    }
+
+    // All triangles of the text make up one mesh
+    size_t triangleCount = 0;
+    for (int c = 0; c < numChunks; c++) {
+        triangleCount += chunks[c].triangles.size();
+    }
+    if (triangleCount > 0) {
+        scene.meshes.push_back(Mesh());
+        Mesh &mesh = scene.meshes.back();
+        mesh.reserve(firstVertex[numChunks], triangleCount);
+        for (int c = 0; c < numChunks; c++) {
+            for (size_t v = 0; v < chunks[c].vertices.size(); v++) {
+                mesh.addVertex(chunks[c].vertices[v]);
+            }
+        }
+        for (int c = 0; c < numChunks; c++) {
+            for (size_t t = 0; t < chunks[c].triangles.size(); t++) {
+                TriangleRef &ref = chunks[c].triangles[t];
+                // Cannot fail, the materials were counted above
+                mesh.addTriangle(ref.vertex[0], ref.vertex[1], ref.vertex[2], &scene.materials[ref.material]);
+            }
+        }
+    }
+
+    // Groups and instances are few next to spheres, so they are added on
+    // this thread
+    for (size_t g = 0; g < newGroups.size(); g++) {
+        scene.groups.push_back(Group());
+        scene.groups.back().name = newGroups[g];
+    }
+    for (int c = 0; c < numChunks; c++) {
+        ParseChunk &chunk = chunks[c];
+        for (size_t p = 0; p < chunk.particles.size(); p++) {
+            scene.particles.push_back(std::move(chunk.particles[p]));
+            scene.particles.back().setMaterial(&scene.materials[chunk.particleRefs[p].material]);
+        }
+        size_t mesh = 0;
+        size_t paged = 0;
+        for (size_t m = 0; m < chunk.meshRefs.size(); m++) {
+            Material* material = &scene.materials[chunk.meshRefs[m].material];
+            if (chunk.meshRefs[m].paged) {
+                scene.pagedMeshes.push_back(chunk.pagedMeshes[paged++]);
+                scene.pagedMeshes.back().setMaterial(material);
+            } else {
+                scene.meshes.push_back(std::move(chunk.meshes[mesh++]));
+                scene.meshes.back().setMaterial(material);
+            }
+        }
+        for (size_t r = 0; r < runs[c].size(); r++) {
+            if (runs[c][r].group < 0) {
+                continue;
+            }
+            std::vector<Sphere> &objects = scene.groups[runs[c][r].group].objects;
+            for (size_t i = runs[c][r].first; i < runs[c][r].last; i++) {
+                Sphere &s = chunk.objects[i];
+                objects.push_back(Sphere(s.getPosition(), s.getRadius(), &scene.materials[chunk.objectMaterials[i]]));
+            }
+        }
+        for (size_t i = 0; i < chunk.instances.size(); i++) {
+            Instance instance = { groupIndex[chunk.instances[i].group], chunk.instances[i].transform,
+                                  glm::inverse(chunk.instances[i].transform) };
+            scene.instances.push_back(instance);
+        }
+    }
+
+    return true;
+}
+
+bool Parser::parse(const char* data, size_t size, Scene &scene, int threads) {
+    scene.clear();
+    return append(data, size, scene, threads);
+}
+
+bool Parser::load(string file, Scene &scene) {
+    filename = file;
+
+    MappedFile buffer;
+    if (!buffer.open(file, AccessSequential)) {
+        std::cerr << file << ": could not open file" << std::endl;
+        return false;
+    }
+
+    return parse(buffer.getData(), buffer.getSize(), scene);
+}
+
+string Parser::relativePath(string file) {
+    size_t slash = filename.rfind('/');
+    if (file[0] != '/' && slash != string::npos) {
+        return filename.substr(0, slash + 1) + file;
+    }
+    return file;
+}
+
+void Parser::setFilename(string name) {
+    filename = name;
+}
@@ -11,39 +11,177 @@
 #include <stdio.h>
 #include <glm/glm.hpp>
 #include <string>
-#include <fstream>
+#include <string_view>
+#include <vector>
 #include <iostream>
 #include "geometry.hpp"
 #include "material.hpp"
+#include "scene.hpp"
+#include "particles.hpp"
+#include "mesh.hpp"
 //#include "variables.hpp"
 
 typedef glm::vec3 vec3;
+typedef glm::mat4 mat4;
 typedef std::string string;
+typedef std::string_view string_view;
 
-// screenHeight and screenWidth are expressed in pixels
-extern float screenHeight;
-extern float screenWidth;
+// Splits a block of text into whitespace separated tokens, one line at a
+// time. Tokens are views into the original text, so nothing is copied.
+class Tokenizer {
+    const char* cur;
+    const char* end;
+    const char* lineStart;
+    const char* tokenStart;
+    int line;
+    bool started;
 
-extern Sphere lights[10];
-extern int numLights;
+public:
+    Tokenizer(const char* data, size_t size, int firstLine = 1);
+
+    // Moves to the start of the next line, returns false at the end of the text
+    bool nextLine();
+    // Reads the next token of the current line, returns false at the end of the line
+    bool next(string_view &token);
 
-extern Camera cam;
+    // Position of the most recently read token, counted from 1
+    int getLine();
+    int getColumn();
+};
 
-extern Sphere objects[10];
-//Mesh objects[10];
-extern int numObjects;
-extern Material materials[10];
+struct ParseError {
+    int line;
+    int column;
+    string message;
+};
+
+// A material reference that can only be checked once the number of
+// materials defined in earlier chunks is known
+struct MaterialRef {
+    int index;
+    int definedBefore;
+    int line;
+    int column;
+};
+
+// A particle set named by the layout. Sets are loaded once the chunks are
+// merged, and errors loading them are reported at the line naming them.
+struct ParticleRef {
+    string file;
+    float radius;
+    int material;
+    int line;
+    int column;
+};
+
+// A mesh file named by the layout, loaded like particle sets once the
+// chunks are merged. Paged meshes are only opened, and their chunks read
+// as rays reach them.
+struct MeshRef {
+    string file;
+    int material;
+    bool paged;
+    int line;
+    int column;
+};
+
+// Vertices are counted from the start of the text being parsed, so they
+// are checked once the chunks are merged
+struct TriangleRef {
+    int vertex[3];
+    int material;
+    int line;
+    int column;
+};
+
+// A "group" or "endgroup" line. A group may be opened in one chunk and
+// closed in another, so which spheres it holds is only known once the
+// chunks are merged.
+struct GroupMark {
+    // Empty for endgroup
+    string name;
+    // Number of spheres the chunk had before the line
+    size_t object;
+    int line;
+    int column;
+};
+
+// Instances name their group, which may be defined anywhere in the file
+struct InstanceRef {
+    string group;
+    mat4 transform;
+    int line;
+    int column;
+};
+
+// Everything parsed from one range of lines of a layout file. Chunks are
+// parsed independently and then merged in file order.
+struct ParseChunk {
+    const char* data;
+    size_t size;
+    int lines;
+
+    std::vector<Material> materials;
+    std::vector<Sphere> objects;
+    std::vector<int> objectMaterials;
+    std::vector<Sphere> lights;
+    std::vector<int> lightMaterials;
+    std::vector<Camera> cameras;
+    std::vector<ParticleRef> particleRefs;
+    std::vector<ParticleSet> particles;
+    std::vector<GroupMark> groupMarks;
+    std::vector<vec3> vertices;
+    std::vector<TriangleRef> triangles;
+    std::vector<MeshRef> meshRefs;
+    std::vector<Mesh> meshes;
+    std::vector<PagedMesh> pagedMeshes;
+    std::vector<InstanceRef> instances;
+    // 0 unless the chunk sets the number of frames
+    int frames;
+
+    // Keyframe targets are checked once the whole file is parsed, so each
+    // key keeps its line and column
+    std::vector<Keyframe> keys;
+    std::vector< std::pair<int, int> > keyPositions;
+
+    // Line numbers are relative to the start of the chunk until merged
+    std::vector<ParseError> errors;
+    std::vector<MaterialRef> materialRefs;
+};
 
 class Parser {
+    string filename;
+    int errors;
+
+    void error(Tokenizer &tokens, ParseChunk &chunk, string message);
+    bool expectFloat(Tokenizer &tokens, ParseChunk &chunk, float &value, const char* name);
+    bool expectVec(Tokenizer &tokens, ParseChunk &chunk, vec3 &value, const char* name);
+    bool expectWord(Tokenizer &tokens, ParseChunk &chunk, string_view &value, const char* name);
+    bool expectMaterial(Tokenizer &tokens, ParseChunk &chunk, int &index);
+    bool expectInt(Tokenizer &tokens, ParseChunk &chunk, int &value, const char* name);
+    bool expectTarget(Tokenizer &tokens, ParseChunk &chunk, KeyTarget &target, int &index);
+    bool expectTransform(Tokenizer &tokens, ParseChunk &chunk, mat4 &value);
+
+    // Names files the layout refers to relative to the layout file
+    string relativePath(string file);
+
+    void parseLine(Tokenizer &tokens, ParseChunk &chunk);
+    void parseChunk(ParseChunk &chunk);
 
 public:
     Parser();
-    vec3 convertVec(string command);
-    void load(string file);
+    bool load(string file, Scene &scene);
+    // Large inputs are split at line boundaries and parsed on several threads
+    bool parse(const char* data, size_t size, Scene &scene, int threads = 0);
+    // Adds the parsed contents to a scene that is already loaded; material
+    // references count the scene's existing materials first
+    bool append(const char* data, size_t size, Scene &scene, int threads = 0);
+    // Name used in error messages when parsing text that is not a file
+    void setFilename(string name);
 
+    static bool parseFloat(string_view token, float &value);
+    static bool parseVec(string_view token, vec3 &value);
+    static bool parseMat(string_view token, mat4 &value);
 };
 
-//vec3 convertVec(string command);
-//void parse(string file);
-
 #endif /* parser_hpp */
@@ -0,0 +1,280 @@
+//
+//  partialfile.cpp
+//  
+//
+//  Created by Brendan Martin on 10/19/26.
+//
+
+#include "partialfile.hpp"
+#include "mappedfile.hpp"
+#include <iostream>
+#include <fstream>
+#include <cstring>
+#include <zlib.h>
+
+static const char partialMagic[8] = { 'P', 'T', 'P', 'A', 'R', 'T', 0, 0 };
+
+// TileGrid
+
+TileGrid::TileGrid() {
+    width = 0;
+    height = 0;
+    tileSize = 1;
+}
+
+TileGrid::TileGrid(int w, int h, int size) {
+    width = w;
+    height = h;
+    tileSize = std::max(1, size);
+}
+
+int TileGrid::getColumns() {
+    return (width + tileSize - 1) / tileSize;
+}
+
+int TileGrid::getRows() {
+    return (height + tileSize - 1) / tileSize;
+}
+
+int TileGrid::getCount() {
+    return getColumns() * getRows();
+}
+
+void TileGrid::getTile(int index, int &x0, int &y0, int &x1, int &y1) {
+    x0 = (index % getColumns()) * tileSize;
+    y0 = (index / getColumns()) * tileSize;
+    x1 = std::min(x0 + tileSize, width);
+    y1 = std::min(y0 + tileSize, height);
+}
+
+
+// PartialFile
+
+PartialFile::PartialFile() {
+
+}
+
+void PartialFile::error(string message) {
+    std::cerr << filename << ": " << message << std::endl;
+}
+
+void PartialFile::addTile(int index, int firstSample, int samples, Framebuffer &film) {
+    int x0, y0, x1, y1;
+    grid.getTile(index, x0, y0, x1, y1);
+
+    PartialTile tile;
+    tile.index = index;
+    tile.firstSample = firstSample;
+    tile.samples = samples;
+    for (int y = 0; y < y1 - y0; y++) {
+        vec3* row = film.getRow(y);
+        tile.radiance.insert(tile.radiance.end(), row, row + (x1 - x0));
+    }
+    tiles.push_back(tile);
+}
+
+bool PartialFile::save(string file) {
+    filename = file;
+
+    PartialHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, partialMagic, 8);
+    header.version = version;
+    header.width = grid.width;
+    header.height = grid.height;
+    header.tileSize = grid.tileSize;
+    header.tileCount = tiles.size();
+
+    // Built in memory first so the CRC can be appended
+    std::vector<char> data((const char*)&header, (const char*)&header + sizeof(header));
+    for (size_t t = 0; t < tiles.size(); t++) {
+        PartialTileHeader tileHeader = { tiles[t].index, tiles[t].firstSample, tiles[t].samples };
+        data.insert(data.end(), (const char*)&tileHeader, (const char*)&tileHeader + sizeof(tileHeader));
+        const char* radiance = (const char*)tiles[t].radiance.data();
+        data.insert(data.end(), radiance, radiance + tiles[t].radiance.size() * sizeof(vec3));
+    }
+    uint32_t crc = crc32(0, (const Bytef*)data.data(), data.size());
+
+    std::ofstream out(file, std::ios::binary);
+    if (!out.is_open()) {
+        error("could not write file");
+        return false;
+    }
+    out.write(data.data(), data.size());
+    out.write((const char*)&crc, sizeof(crc));
+    return out.good();
+}
+
+bool PartialFile::load(string file) {
+    filename = file;
+    tiles.clear();
+
+    MappedFile buffer;
+    if (!buffer.open(file, AccessSequential)) {
+        error("could not open file");
+        return false;
+    }
+
+    const char* data = buffer.getData();
+    size_t size = buffer.getSize();
+    if (size < sizeof(PartialHeader) + sizeof(uint32_t) || memcmp(data, partialMagic, 8) != 0) {
+        error("not a partial render");
+        return false;
+    }
+
+    PartialHeader header;
+    memcpy(&header, data, sizeof(header));
+    if (header.version != version) {
+        error("partial format version " + std::to_string(header.version) + ", expected version " + std::to_string(version));
+        return false;
+    }
+
+    uint32_t crc;
+    size -= sizeof(crc);
+    memcpy(&crc, data + size, sizeof(crc));
+    if (crc != crc32(0, (const Bytef*)data, size)) {
+        error("file is truncated or damaged");
+        return false;
+    }
+
+    if (header.width <= 0 || header.height <= 0 || header.tileSize <= 0) {
+        error("invalid image size");
+        return false;
+    }
+    grid = TileGrid(header.width, header.height, header.tileSize);
+
+    size_t offset = sizeof(header);
+    for (uint32_t t = 0; t < header.tileCount; t++) {
+        PartialTileHeader tileHeader;
+        if (offset + sizeof(tileHeader) > size) {
+            error("file is truncated or damaged");
+            return false;
+        }
+        memcpy(&tileHeader, data + offset, sizeof(tileHeader));
+        offset += sizeof(tileHeader);
+
+        if (tileHeader.index < 0 || tileHeader.index >= grid.getCount() || tileHeader.samples <= 0 || tileHeader.firstSample < 0) {
+            error("invalid tile " + std::to_string(tileHeader.index));
+            return false;
+        }
+
+        int x0, y0, x1, y1;
+        grid.getTile(tileHeader.index, x0, y0, x1, y1);
+        size_t pixels = (size_t)(x1 - x0) * (y1 - y0);
+        if (offset + pixels * sizeof(vec3) > size) {
+            error("file is truncated or damaged");
+            return false;
+        }
+
+        PartialTile tile;
+        tile.index = tileHeader.index;
+        tile.firstSample = tileHeader.firstSample;
+        tile.samples = tileHeader.samples;
+        tile.radiance.resize(pixels);
+        memcpy(tile.radiance.data(), data + offset, pixels * sizeof(vec3));
+        offset += pixels * sizeof(vec3);
+        tiles.push_back(tile);
+    }
+
+    if (offset != size) {
+        error("file is truncated or damaged");
+        return false;
+    }
+    return true;
+}
+
+
+// PartialMerger
+
+PartialMerger::PartialMerger() {
+    started = false;
+}
+
+TileGrid PartialMerger::getGrid() {
+    return grid;
+}
+
+bool PartialMerger::add(string file) {
+    PartialFile partial;
+    if (!partial.load(file)) {
+        return false;
+    }
+
+    if (!started) {
+        grid = partial.grid;
+        sums.set(grid.width, grid.height);
+        ranges.assign(grid.getCount(), std::vector< std::pair<int, int> >());
+        started = true;
+    } else if (partial.grid.width != grid.width || partial.grid.height != grid.height || partial.grid.tileSize != grid.tileSize) {
+        std::cerr << file << ": image size or tile size differs from the other partials" << std::endl;
+        return false;
+    }
+
+    int skipped = 0;
+    for (size_t t = 0; t < partial.tiles.size(); t++) {
+        PartialTile &tile = partial.tiles[t];
+        int first = tile.firstSample;
+        int last = tile.firstSample + tile.samples;
+
+        // The same samples merged twice would be counted twice
+        bool overlaps = false;
+        std::vector< std::pair<int, int> > &merged = ranges[tile.index];
+        for (size_t r = 0; r < merged.size(); r++) {
+            overlaps = overlaps || (first < merged[r].second && merged[r].first < last);
+        }
+        if (overlaps) {
+            skipped++;
+            continue;
+        }
+        merged.push_back(std::make_pair(first, last));
+
+        int x0, y0, x1, y1;
+        grid.getTile(tile.index, x0, y0, x1, y1);
+        const vec3* src = tile.radiance.data();
+        for (int y = y0; y < y1; y++) {
+            for (int x = x0; x < x1; x++) {
+                sums.add(x, y, *src++);
+            }
+        }
+    }
+
+    if (skipped > 0) {
+        std::cerr << file << ": skipped " << skipped << " tiles whose samples were already merged" << std::endl;
+    }
+    return true;
+}
+
+std::vector<int> PartialMerger::missingTiles(int minSamples) {
+    std::vector<int> missing;
+    for (int t = 0; t < grid.getCount(); t++) {
+        int samples = 0;
+        for (size_t r = 0; r < ranges[t].size(); r++) {
+            samples += ranges[t][r].second - ranges[t][r].first;
+        }
+        if (samples < std::max(1, minSamples)) {
+            missing.push_back(t);
+        }
+    }
+    return missing;
+}
+
+void PartialMerger::resolve(Framebuffer &film) {
+    film.set(grid.width, grid.height);
+    for (int t = 0; t < grid.getCount(); t++) {
+        int samples = 0;
+        for (size_t r = 0; r < ranges[t].size(); r++) {
+            samples += ranges[t][r].second - ranges[t][r].first;
+        }
+        if (samples == 0) {
+            continue;
+        }
+
+        int x0, y0, x1, y1;
+        grid.getTile(t, x0, y0, x1, y1);
+        for (int y = y0; y < y1; y++) {
+            for (int x = x0; x < x1; x++) {
+                film.add(x, y, sums.get(x, y) / (float)samples);
+            }
+        }
+    }
+}
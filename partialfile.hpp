@@ -0,0 +1,112 @@
+//
+//  partialfile.hpp
+//  
+//
+//  Created by Brendan Martin on 10/19/26.
+//
+
+#ifndef partialfile_hpp
+#define partialfile_hpp
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <glm/glm.hpp>
+#include "framebuffer.hpp"
+
+typedef glm::vec3 vec3;
+typedef std::string string;
+
+// Divides an image into square tiles, numbered row by row from the bottom
+// left. Tiles on the right and top edges may be smaller.
+struct TileGrid {
+    int width;
+    int height;
+    int tileSize;
+
+    TileGrid();
+    TileGrid(int w, int h, int size);
+
+    int getColumns();
+    int getRows();
+    int getCount();
+    // Pixels [x0,x1) x [y0,y1) of a tile
+    void getTile(int index, int &x0, int &y0, int &x1, int &y1);
+};
+
+// Summed radiance of one tile over samples [firstSample, firstSample+samples)
+struct PartialTile {
+    int index;
+    int firstSample;
+    int samples;
+    // Row by row from the bottom of the tile
+    std::vector<vec3> radiance;
+};
+
+// Part of a frame rendered by one worker: some tiles of the image, each with
+// the sum of its samples rather than their mean, so partials of the same
+// tile over different sample ranges can be added. The file ends with a CRC
+// of everything before it, so truncated or damaged files are detected.
+struct PartialHeader {
+    char magic[8];
+    uint32_t version;
+    int32_t width;
+    int32_t height;
+    int32_t tileSize;
+    uint32_t tileCount;
+};
+
+struct PartialTileHeader {
+    int32_t index;
+    int32_t firstSample;
+    int32_t samples;
+};
+
+class PartialFile {
+    string filename;
+
+    void error(string message);
+
+public:
+    static const uint32_t version = 1;
+
+    TileGrid grid;
+    std::vector<PartialTile> tiles;
+
+    PartialFile();
+
+    // Adds the tile of the grid whose pixels are held by film, whose bottom
+    // left pixel is the tile's bottom left pixel
+    void addTile(int index, int firstSample, int samples, Framebuffer &film);
+
+    bool save(string file);
+    // Reads and checks a partial file, printing what is wrong with it
+    bool load(string file);
+};
+
+// Adds partial files together into the final image
+class PartialMerger {
+    TileGrid grid;
+    bool started;
+    Framebuffer sums;
+    // Sample ranges merged into each tile
+    std::vector< std::vector< std::pair<int, int> > > ranges;
+
+public:
+    PartialMerger();
+
+    // Returns false if the file can not be read or belongs to another image.
+    // Sample ranges that were already merged for a tile are skipped.
+    bool add(string file);
+
+    // Tiles with fewer than minSamples samples (at least one)
+    std::vector<int> missingTiles(int minSamples = 1);
+
+    // Fills film with the mean radiance of every pixel
+    void resolve(Framebuffer &film);
+
+    TileGrid getGrid();
+};
+
+#endif /* partialfile_hpp */
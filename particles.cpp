@@ -0,0 +1,390 @@
+//
+//  particles.cpp
+//  
+//
+//  Created by Brendan Martin on 10/19/26.
+//
+
+#include "particles.hpp"
+#include "mappedfile.hpp"
+#include <algorithm>
+#include <iostream>
+#include <limits>
+#include <thread>
+#include <cmath>
+#include <cstring>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+static const char particleMagic[8] = { 'P', 'T', 'C', 'L', 'O', 'U', 'D', 0 };
+static const uint32_t particleVersion = 1;
+
+// Sort keys hold a 30-bit Morton code above the particle's index
+static const int indexBits = 34;
+static const uint64_t indexMask = ((uint64_t)1 << indexBits) - 1;
+
+// Hits name the particle by an int index, which also keeps cluster indices
+// within the BVH's int indices
+static const uint64_t maxParticles = std::numeric_limits<int>::max();
+
+// Fewer particles than this per thread are not worth a thread
+static const size_t minParallelParticles = 1 << 16;
+
+// Calls work(slice, begin, end) for threads slices of [0, count) at once
+template <class Work>
+static void parallelSlices(size_t count, int threads, Work work) {
+    std::vector<std::thread> workers;
+    for (int t = 1; t < threads; t++) {
+        workers.push_back(std::thread(work, t, count * t / threads, count * (t + 1) / threads));
+    }
+    work(0, (size_t)0, count / threads);
+    for (size_t t = 0; t < workers.size(); t++) {
+        workers[t].join();
+    }
+}
+
+// Sorts every slice on its own thread, then merges neighbouring slices in
+// pairs until one is left
+static void parallelSort(std::vector<uint64_t> &keys, int threads) {
+    parallelSlices(keys.size(), threads, [&](int, size_t begin, size_t end) {
+        std::sort(keys.begin() + begin, keys.begin() + end);
+    });
+    for (int width = 1; width < threads; width *= 2) {
+        std::vector<std::thread> workers;
+        for (int t = 0; t + width < threads; t += 2 * width) {
+            size_t first = keys.size() * t / threads;
+            size_t mid = keys.size() * (t + width) / threads;
+            size_t last = keys.size() * std::min(t + 2 * width, threads) / threads;
+            workers.push_back(std::thread([&keys, first, mid, last]() {
+                std::inplace_merge(keys.begin() + first, keys.begin() + mid, keys.begin() + last);
+            }));
+        }
+        for (size_t t = 0; t < workers.size(); t++) {
+            workers[t].join();
+        }
+    }
+}
+
+// Spreads the low 10 bits of v out to every third bit
+static uint32_t spreadBits(uint32_t v) {
+    v = (v | (v << 16)) & 0x030000ff;
+    v = (v | (v << 8)) & 0x0300f00f;
+    v = (v | (v << 4)) & 0x030c30c3;
+    v = (v | (v << 2)) & 0x09249249;
+    return v;
+}
+
+// Records are read with memcpy, as the file gives no alignment guarantees
+static vec3 readPosition(const char* records, size_t stride, uint64_t i) {
+    float value[3];
+    memcpy(value, records + i * stride, sizeof(value));
+    return vec3(value[0], value[1], value[2]);
+}
+
+static float readRadius(const char* records, size_t stride, uint64_t i) {
+    float value;
+    memcpy(&value, records + i * stride + 3 * sizeof(float), sizeof(value));
+    return value;
+}
+
+static void error(string file, string message) {
+    std::cerr << file << ": " << message << std::endl;
+}
+
+ParticleSet::ParticleSet() {
+    material = NULL;
+    radius = 0.0f;
+    count = 0;
+}
+
+void ParticleSet::clear() {
+    clusters.clear();
+    radii.clear();
+    bvh.clear();
+    radius = 0.0f;
+    count = 0;
+}
+
+bool ParticleSet::load(string file, float shared, Material* mat, int threads) {
+    clear();
+    material = mat;
+
+    MappedFile mapped;
+    if (!mapped.open(file, AccessSequential)) {
+        error(file, "could not open file");
+        return false;
+    }
+    ParticleHeader header;
+    if (mapped.getSize() < sizeof(header)) {
+        error(file, "not a particle file");
+        return false;
+    }
+    memcpy(&header, mapped.getData(), sizeof(header));
+    if (memcmp(header.magic, particleMagic, 8) != 0) {
+        error(file, "not a particle file");
+        return false;
+    }
+    if (header.version != particleVersion) {
+        error(file, "written with particle format version " + std::to_string(header.version) +
+                    ", expected " + std::to_string(particleVersion));
+        return false;
+    }
+    bool fileRadii = (header.flags & particleRadii) != 0;
+    size_t stride = (fileRadii ? 4 : 3) * sizeof(float);
+    if (header.count == 0 || header.count > maxParticles) {
+        error(file, "holds " + std::to_string(header.count) + " particles, expected 1 to " + std::to_string(maxParticles));
+        return false;
+    }
+    if ((mapped.getSize() - sizeof(header)) / stride < header.count) {
+        error(file, "file is truncated");
+        return false;
+    }
+    if (shared <= 0.0f && !fileRadii) {
+        error(file, "particles have no radius, give one in the layout");
+        return false;
+    }
+
+    const char* records = mapped.getData() + sizeof(header);
+    count = header.count;
+    bool perParticle = shared <= 0.0f;
+    if (threads <= 0) {
+        threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+    threads = (int)std::max((uint64_t)1, std::min((uint64_t)threads, count / minParallelParticles));
+
+    // Box around the centers and the largest radius
+    std::vector<vec3> sliceMin(threads, vec3(std::numeric_limits<float>::infinity()));
+    std::vector<vec3> sliceMax(threads, vec3(-std::numeric_limits<float>::infinity()));
+    std::vector<float> sliceRadius(threads, 0.0f);
+    parallelSlices(count, threads, [&](int slice, size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++) {
+            vec3 center = readPosition(records, stride, i);
+            sliceMin[slice] = glm::min(sliceMin[slice], center);
+            sliceMax[slice] = glm::max(sliceMax[slice], center);
+            if (perParticle) {
+                sliceRadius[slice] = std::max(sliceRadius[slice], readRadius(records, stride, i));
+            }
+        }
+    });
+    vec3 boundsMin = sliceMin[0];
+    vec3 boundsMax = sliceMax[0];
+    radius = perParticle ? sliceRadius[0] : shared;
+    for (int t = 1; t < threads; t++) {
+        boundsMin = glm::min(boundsMin, sliceMin[t]);
+        boundsMax = glm::max(boundsMax, sliceMax[t]);
+        radius = std::max(radius, sliceRadius[t]);
+    }
+    if (!(radius > 0.0f)) {
+        error(file, "particle radii must be positive");
+        clear();
+        return false;
+    }
+
+    // Particles are ordered along a Morton curve, 10 bits per axis, so every
+    // run of eight is a tight cluster
+    std::vector<uint64_t> keys(count);
+    vec3 scale = 1023.0f / glm::max(boundsMax - boundsMin, vec3(1e-20f));
+    parallelSlices(count, threads, [&](int, size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++) {
+            glm::uvec3 cell = glm::uvec3(glm::clamp((readPosition(records, stride, i) - boundsMin) * scale, vec3(0.0f), vec3(1023.0f)));
+            uint64_t code = (spreadBits(cell.x) << 2) | (spreadBits(cell.y) << 1) | spreadBits(cell.z);
+            keys[i] = code << indexBits | i;
+        }
+    });
+    parallelSort(keys, threads);
+
+    size_t clusterCount = (count + 7) / 8;
+    clusters.resize(clusterCount);
+    if (perParticle) {
+        radii.resize(clusterCount * 8);
+    }
+    std::vector<BoundingBox> boxes(clusterCount);
+    parallelSlices(clusterCount, threads, [&](int, size_t begin, size_t end) {
+        for (size_t c = begin; c < end; c++) {
+            int size = (int)std::min((uint64_t)8, count - c * 8);
+            vec3 centers[8];
+            float sizes[8];
+            for (int s = 0; s < 8; s++) {
+                uint64_t i = keys[c * 8 + (s < size ? s : 0)] & indexMask;
+                centers[s] = readPosition(records, stride, i);
+                sizes[s] = perParticle ? readRadius(records, stride, i) : radius;
+            }
+
+            ParticleCluster &cluster = clusters[c];
+            vec3 low = centers[0];
+            vec3 high = centers[0];
+            for (int s = 1; s < 8; s++) {
+                low = glm::min(low, centers[s]);
+                high = glm::max(high, centers[s]);
+            }
+            for (int axis = 0; axis < 3; axis++) {
+                cluster.origin[axis] = low[axis];
+                cluster.step[axis] = (high[axis] - low[axis]) / 65535.0f;
+                for (int s = 0; s < 8; s++) {
+                    float steps = cluster.step[axis] > 0.0f ? (centers[s][axis] - low[axis]) / cluster.step[axis] : 0.0f;
+                    cluster.position[axis][s] = (uint16_t)std::min(65535.0f, std::max(0.0f, std::round(steps)));
+                }
+            }
+            if (perParticle) {
+                for (int s = 0; s < 8; s++) {
+                    float steps = std::ceil(sizes[s] / radius * 255.0f);
+                    radii[c * 8 + s] = (uint8_t)std::min(255.0f, std::max(0.0f, steps));
+                }
+            }
+
+            // The box is fitted around the particles as they are traced,
+            // after quantization
+            BoundingBox &box = boxes[c];
+            box.boundsMin = vec3(std::numeric_limits<float>::infinity());
+            box.boundsMax = vec3(-std::numeric_limits<float>::infinity());
+            for (int s = 0; s < 8; s++) {
+                vec3 center = getCenter(c, s);
+                float r = perParticle ? radii[c * 8 + s] * (radius / 255.0f) : radius;
+                box.boundsMin = glm::min(box.boundsMin, center - vec3(r));
+                box.boundsMax = glm::max(box.boundsMax, center + vec3(r));
+            }
+        }
+    });
+    std::vector<uint64_t>().swap(keys);
+
+    bvh.build(boxes, threads);
+    return true;
+}
+
+vec3 ParticleSet::getCenter(int cluster, int slot) {
+    const ParticleCluster &c = clusters[cluster];
+    return vec3(c.origin[0] + (float)c.position[0][slot] * c.step[0],
+                c.origin[1] + (float)c.position[1][slot] * c.step[1],
+                c.origin[2] + (float)c.position[2][slot] * c.step[2]);
+}
+
+#if defined(__SSE2__)
+
+// Four 16-bit values as four floats
+static inline __m128 loadWords(const uint16_t* words) {
+    __m128i packed = _mm_loadl_epi64((const __m128i*)words);
+    return _mm_cvtepi32_ps(_mm_unpacklo_epi16(packed, _mm_setzero_si128()));
+}
+
+// Four bytes as four floats
+static inline __m128 loadBytes(const uint8_t* bytes) {
+    int32_t packed;
+    memcpy(&packed, bytes, sizeof(packed));
+    __m128i zero = _mm_setzero_si128();
+    __m128i words = _mm_unpacklo_epi8(_mm_cvtsi32_si128(packed), zero);
+    return _mm_cvtepi32_ps(_mm_unpacklo_epi16(words, zero));
+}
+
+// The same test as Sphere::intersects, for four particles per SSE register
+int ParticleSet::intersectCluster(int cluster, const Ray &ray, float pathSquared, float minTime, float maxTime, float times[8]) {
+    const ParticleCluster &c = clusters[cluster];
+    __m128 a = _mm_set1_ps(pathSquared);
+    __m128 sign = _mm_set1_ps(-0.0f);
+    int hits = 0;
+    for (int half = 0; half < 8; half += 4) {
+        // Origin minus position (OMP)
+        __m128 omp[3];
+        for (int axis = 0; axis < 3; axis++) {
+            __m128 center = _mm_add_ps(_mm_set1_ps(c.origin[axis]), _mm_mul_ps(loadWords(c.position[axis] + half), _mm_set1_ps(c.step[axis])));
+            omp[axis] = _mm_sub_ps(_mm_set1_ps(ray.origin[axis]), center);
+        }
+        __m128 rSquared;
+        if (radii.empty()) {
+            rSquared = _mm_set1_ps(radius * radius);
+        } else {
+            __m128 r = _mm_mul_ps(loadBytes(&radii[cluster * 8 + half]), _mm_set1_ps(radius / 255.0f));
+            rSquared = _mm_mul_ps(r, r);
+        }
+
+        __m128 b = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(ray.path.x), omp[0]), _mm_mul_ps(_mm_set1_ps(ray.path.y), omp[1])),
+                              _mm_mul_ps(_mm_set1_ps(ray.path.z), omp[2]));
+        __m128 ompSquared = _mm_add_ps(_mm_add_ps(_mm_mul_ps(omp[0], omp[0]), _mm_mul_ps(omp[1], omp[1])), _mm_mul_ps(omp[2], omp[2]));
+        __m128 discriminant = _mm_sub_ps(_mm_mul_ps(b, b), _mm_mul_ps(a, _mm_sub_ps(ompSquared, rSquared)));
+
+        // The nearer of the two intersections
+        __m128 t = _mm_sub_ps(_mm_div_ps(_mm_xor_ps(b, sign), a),
+                              _mm_div_ps(_mm_sqrt_ps(_mm_max_ps(discriminant, _mm_setzero_ps())), a));
+        __m128 hit = _mm_and_ps(_mm_cmpge_ps(discriminant, _mm_setzero_ps()),
+                                _mm_and_ps(_mm_cmpgt_ps(t, _mm_set1_ps(minTime)), _mm_cmplt_ps(t, _mm_set1_ps(maxTime))));
+        _mm_storeu_ps(times + half, t);
+        hits |= _mm_movemask_ps(hit) << half;
+    }
+    return hits;
+}
+
+#else
+
+int ParticleSet::intersectCluster(int cluster, const Ray &ray, float pathSquared, float minTime, float maxTime, float times[8]) {
+    int hits = 0;
+    for (int s = 0; s < 8; s++) {
+        float r = radii.empty() ? radius : radii[cluster * 8 + s] * (radius / 255.0f);
+        vec3 OMP = ray.origin - getCenter(cluster, s);
+        float b = glm::dot(ray.path, OMP);
+        float discriminant = b * b - pathSquared * (glm::dot(OMP, OMP) - r * r);
+        if (discriminant < 0.0f) {
+            continue;
+        }
+        times[s] = -b / pathSquared - std::sqrt(discriminant) / pathSquared;
+        if (times[s] > minTime && times[s] < maxTime) {
+            hits |= 1 << s;
+        }
+    }
+    return hits;
+}
+
+#endif
+
+bool ParticleSet::intersects(Ray ray, Hit &hit, float minTime) {
+    float pathSquared = glm::dot(ray.path, ray.path);
+    bool found = false;
+    bvh.traverse(ray, minTime, hit.time, [&](int cluster, float &maxTime) {
+        float times[8];
+        int hits = intersectCluster(cluster, ray, pathSquared, minTime, maxTime, times);
+        for (int s = 0; s < 8; s++) {
+            if ((hits >> s & 1) && times[s] < maxTime) {
+                maxTime = times[s];
+                hit.time = times[s];
+                hit.primitive = cluster * 8 + s;
+                found = true;
+            }
+        }
+        return false;
+    });
+    return found;
+}
+
+vec3 ParticleSet::getNormal(int particle, vec3 location) {
+    return glm::normalize(location - getCenter(particle / 8, particle % 8));
+}
+
+bool ParticleSet::occluded(Ray ray, float minTime, float maxTime) {
+    float pathSquared = glm::dot(ray.path, ray.path);
+    bool hit = false;
+    bvh.traverse(ray, minTime, maxTime, [&](int cluster, float &maxTime) {
+        float times[8];
+        hit = intersectCluster(cluster, ray, pathSquared, minTime, maxTime, times) != 0;
+        return hit;
+    });
+    return hit;
+}
+
+Material* ParticleSet::getMaterial() {
+    return material;
+}
+
+void ParticleSet::setMaterial(Material* mat) {
+    material = mat;
+}
+
+uint64_t ParticleSet::getCount() {
+    return count;
+}
+
+size_t ParticleSet::getBytes() {
+    return clusters.size() * sizeof(ParticleCluster) + radii.size() + bvh.getStats().bytes;
+}
+
+BVH &ParticleSet::getBVH() {
+    return bvh;
+}
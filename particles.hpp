@@ -0,0 +1,92 @@
+//
+//  particles.hpp
+//  
+//
+//  Created by Brendan Martin on 10/19/26.
+//
+
+#ifndef particles_hpp
+#define particles_hpp
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <glm/glm.hpp>
+#include "geometry.hpp"
+#include "material.hpp"
+#include "bvh.hpp"
+
+typedef glm::vec3 vec3;
+typedef std::string string;
+
+// Particle files start with this header, followed by count records of
+// three floats x, y and z, plus a fourth float for the radius when the
+// radius flag is set. Values are in the byte order of the machine that
+// wrote the file.
+struct ParticleHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t flags;
+    uint64_t count;
+};
+
+// Flag for files that store a radius with every particle
+static const uint32_t particleRadii = 1;
+
+// Eight particles that are close together along a space filling curve.
+// Positions are 16-bit steps from the cluster's origin, a third of the
+// size of floats, and are stored axis by axis so four particles load at
+// once. Clusters of fewer than eight particles repeat their first one.
+struct ParticleCluster {
+    float origin[3];
+    float step[3];
+    uint16_t position[3][8];
+};
+
+// Many small spheres that share a material, traced through a BVH whose
+// leaves are clusters rather than single spheres
+class ParticleSet {
+    Material* material;
+    // Radius of every particle, or the largest one when radii differ
+    float radius;
+    std::vector<ParticleCluster> clusters;
+    // Radius of every slot of every cluster in 1/255ths of radius, rounded
+    // up. Empty when all particles share one radius.
+    std::vector<uint8_t> radii;
+    BVH bvh;
+    uint64_t count;
+
+    // Returns a bit for every particle of the cluster the ray hits within
+    // (minTime, maxTime) and the times it hits them at
+    int intersectCluster(int cluster, const Ray &ray, float pathSquared, float minTime, float maxTime, float times[8]);
+    vec3 getCenter(int cluster, int slot);
+
+public:
+    ParticleSet();
+
+    // Reads a particle file and clusters its particles on up to threads
+    // threads, threads <= 0 using one per hardware thread. A positive
+    // radius is given to every particle, otherwise radii come from the
+    // file. Errors are printed and leave the set empty.
+    bool load(string file, float radius, Material* material, int threads = 0);
+    void clear();
+
+    // Lowers the hit to the closest particle within (minTime, hit.time), and
+    // returns whether there was one. Particles are numbered eight per
+    // cluster.
+    bool intersects(Ray ray, Hit &hit, float minTime);
+    // Returns true if any particle is hit within (minTime, maxTime)
+    bool occluded(Ray ray, float minTime, float maxTime);
+    // Normal of a point on the surface of a particle that was hit
+    vec3 getNormal(int particle, vec3 location);
+
+    Material* getMaterial();
+    void setMaterial(Material* mat);
+    uint64_t getCount();
+    // Memory taken by the clusters, radii and BVH
+    size_t getBytes();
+    BVH &getBVH();
+};
+
+#endif /* particles_hpp */
@@ -0,0 +1,401 @@
+//
+//  partition.cpp
+//  
+//
+//  Created by Brendan Martin on 10/19/26.
+//
+
+#include "partition.hpp"
+#include "scene.hpp"
+#include <algorithm>
+#include <iostream>
+#include <limits>
+#include <cerrno>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <signal.h>
+#include <unistd.h>
+
+PartitionSet::PartitionSet() : nextRequester(0) {
+    count = 0;
+    axis = 0;
+    coordinator = 0;
+    shared = NULL;
+    sharedSize = 0;
+}
+
+PartitionSet::~PartitionSet() {
+    stop();
+}
+
+// Replies come first in the shared memory, then one queue per partition
+RayQueue* PartitionSet::getQueue(int partition) {
+    return (RayQueue*)((char*)shared + maxRequesters * sizeof(RayReply)) + partition;
+}
+
+RayReply* PartitionSet::getReply(int requester) {
+    return (RayReply*)shared + requester;
+}
+
+int PartitionSet::partitionAt(float coordinate) {
+    return std::upper_bound(splits.begin(), splits.end(), coordinate) - splits.begin();
+}
+
+void PartitionSet::clip(int partition, const RayMessage &message, float &enter, float &exit) {
+    float low = partition == 0 ? -std::numeric_limits<float>::infinity() : splits[partition - 1];
+    float high = partition == count - 1 ? std::numeric_limits<float>::infinity() : splits[partition];
+    float path = message.path[axis];
+    if (path == 0.0f) {
+        // Rays along the slab never leave the one they start in
+        enter = -std::numeric_limits<float>::infinity();
+        exit = std::numeric_limits<float>::infinity();
+        return;
+    }
+    float first = (low - message.origin[axis]) / path;
+    float second = (high - message.origin[axis]) / path;
+    enter = std::min(first, second);
+    exit = std::max(first, second);
+}
+
+static void initShared(pthread_mutex_t* lock, pthread_cond_t* ready) {
+    pthread_mutexattr_t lockAttributes;
+    pthread_mutexattr_init(&lockAttributes);
+    pthread_mutexattr_setpshared(&lockAttributes, PTHREAD_PROCESS_SHARED);
+    pthread_mutex_init(lock, &lockAttributes);
+    pthread_mutexattr_destroy(&lockAttributes);
+
+    pthread_condattr_t readyAttributes;
+    pthread_condattr_init(&readyAttributes);
+    pthread_condattr_setpshared(&readyAttributes, PTHREAD_PROCESS_SHARED);
+    pthread_cond_init(ready, &readyAttributes);
+    pthread_condattr_destroy(&readyAttributes);
+}
+
+// A second from now, for waits that check every so often whether the
+// other side is still there
+static timespec inOneSecond() {
+    timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += 1;
+    return deadline;
+}
+
+void PartitionSet::push(int partition, const RayMessage &message) {
+    RayQueue* queue = getQueue(partition);
+    pthread_mutex_lock(&queue->lock);
+    queue->messages[queue->tail % (maxRequesters + 1)] = message;
+    queue->tail++;
+    pthread_cond_signal(&queue->ready);
+    pthread_mutex_unlock(&queue->lock);
+}
+
+bool PartitionSet::pop(int partition, RayMessage &message) {
+    RayQueue* queue = getQueue(partition);
+    pthread_mutex_lock(&queue->lock);
+    while (queue->head == queue->tail) {
+        timespec deadline = inOneSecond();
+        if (pthread_cond_timedwait(&queue->ready, &queue->lock, &deadline) == ETIMEDOUT && getppid() != coordinator) {
+            pthread_mutex_unlock(&queue->lock);
+            return false;
+        }
+    }
+    message = queue->messages[queue->head % (maxRequesters + 1)];
+    queue->head++;
+    pthread_mutex_unlock(&queue->lock);
+    return true;
+}
+
+void PartitionSet::answer(const RayMessage &message) {
+    RayReply* reply = getReply(message.requester);
+    pthread_mutex_lock(&reply->lock);
+    reply->message = message;
+    reply->answered = 1;
+    pthread_cond_signal(&reply->ready);
+    pthread_mutex_unlock(&reply->lock);
+}
+
+bool PartitionSet::start(Scene &scene, int partitions) {
+    stop();
+    if (scene.objects.size() == scene.lights.size()) {
+        std::cerr << "A scene without spheres can not be partitioned" << std::endl;
+        return false;
+    }
+    if (!scene.keys.empty()) {
+        std::cerr << "Animated scenes can not be partitioned" << std::endl;
+        return false;
+    }
+    // Lights stay in this process, where they are sampled
+    std::vector<Sphere> objects;
+    std::vector<bool> isLight(scene.objects.size(), false);
+    for (size_t l = 0; l < scene.lights.size(); l++) {
+        isLight[scene.lights[l]] = true;
+    }
+    for (size_t i = 0; i < scene.objects.size(); i++) {
+        if (!isLight[i]) {
+            objects.push_back(scene.objects[i]);
+        }
+    }
+    count = std::max(1, std::min(partitions, (int)objects.size()));
+
+    // Slabs are cut across the axis the spheres spread furthest along, at
+    // the centers that split them into equal numbers
+    vec3 low = objects[0].getPosition();
+    vec3 high = low;
+    for (size_t i = 1; i < objects.size(); i++) {
+        low = glm::min(low, objects[i].getPosition());
+        high = glm::max(high, objects[i].getPosition());
+    }
+    vec3 extent = high - low;
+    axis = extent.x >= extent.y && extent.x >= extent.z ? 0 : (extent.y >= extent.z ? 1 : 2);
+    std::vector<float> centers(objects.size());
+    for (size_t i = 0; i < objects.size(); i++) {
+        centers[i] = objects[i].getPosition()[axis];
+    }
+    std::sort(centers.begin(), centers.end());
+    splits.resize(count - 1);
+    for (int p = 1; p < count; p++) {
+        splits[p - 1] = centers[centers.size() * p / count];
+    }
+
+    // Spheres belong to every slab they overlap
+    std::vector< std::vector<int> > owned(count);
+    for (size_t i = 0; i < objects.size(); i++) {
+        float center = objects[i].getPosition()[axis];
+        float radius = objects[i].getRadius();
+        int first = std::lower_bound(splits.begin(), splits.end(), center - radius) - splits.begin();
+        int last = partitionAt(center + radius);
+        for (int p = first; p <= last; p++) {
+            owned[p].push_back(i);
+        }
+    }
+    sphereCounts.resize(count);
+    for (int p = 0; p < count; p++) {
+        sphereCounts[p] = owned[p].size();
+    }
+
+    sharedSize = maxRequesters * sizeof(RayReply) + count * sizeof(RayQueue);
+    shared = mmap(NULL, sharedSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (shared == MAP_FAILED) {
+        shared = NULL;
+        std::cerr << "Could not map memory for partition queues" << std::endl;
+        return false;
+    }
+    for (int r = 0; r < maxRequesters; r++) {
+        initShared(&getReply(r)->lock, &getReply(r)->ready);
+        getReply(r)->answered = 0;
+    }
+    for (int p = 0; p < count; p++) {
+        RayQueue* queue = getQueue(p);
+        initShared(&queue->lock, &queue->ready);
+        queue->head = 0;
+        queue->tail = 0;
+    }
+    coordinator = getpid();
+
+    // Buffered output would otherwise be written once by every process
+    std::cout.flush();
+    std::cerr.flush();
+    fflush(NULL);
+    for (int p = 0; p < count; p++) {
+        pid_t pid = fork();
+        if (pid == 0) {
+            std::vector<Sphere> spheres;
+            std::vector<int> materials;
+            for (size_t i = 0; i < owned[p].size(); i++) {
+                Sphere &s = objects[owned[p][i]];
+                spheres.push_back(s);
+                materials.push_back(s.getMaterial() - scene.materials.data());
+            }
+            // The worker only needs its own spheres
+            std::vector< std::vector<int> >().swap(owned);
+            std::vector<Sphere>().swap(objects);
+            std::vector<Sphere>().swap(scene.objects);
+            scene.bvh = BVH();
+            scene.particles.clear();
+            scene.meshes.clear();
+            scene.groups.clear();
+            serve(p, spheres, materials);
+            _exit(0);
+        }
+        if (pid < 0) {
+            std::cerr << "Could not start partition worker " << p << std::endl;
+            count = workers.size();
+            stop();
+            return false;
+        }
+        workers.push_back(pid);
+    }
+
+    // This process keeps only the lights
+    std::vector<Sphere>().swap(objects);
+    std::vector<Sphere> lights;
+    for (size_t l = 0; l < scene.lights.size(); l++) {
+        lights.push_back(scene.objects[scene.lights[l]]);
+        scene.lights[l] = l;
+    }
+    scene.objects.swap(lights);
+    scene.bvh = BVH();
+    scene.bvh.build(scene.objects);
+    return true;
+}
+
+void PartitionSet::serve(int partition, std::vector<Sphere> &spheres, std::vector<int> &materials) {
+    BVH bvh;
+    bvh.build(spheres);
+
+    RayMessage message;
+    while (pop(partition, message) && message.requester >= 0) {
+        Ray ray;
+        ray.origin = vec3(message.origin[0], message.origin[1], message.origin[2]);
+        ray.path = vec3(message.path[0], message.path[1], message.path[2]);
+
+        // Hits exactly on the far boundary count for this slab
+        float enter, exit;
+        clip(partition, message, enter, exit);
+        float minTime = std::max(message.minTime, enter);
+        float maxTime = std::min(message.maxTime, std::nextafter(exit, std::numeric_limits<float>::infinity()));
+        if (minTime < maxTime) {
+            if (message.occlusion) {
+                message.hit = bvh.occluded(ray, spheres.data(), minTime, maxTime);
+            } else {
+                Hit hit = { maxTime, -1, 0.0f, 0.0f };
+                if (bvh.intersects(ray, spheres.data(), hit, minTime)) {
+                    vec3 location = ray.origin + (hit.time * ray.path);
+                    vec3 normal = spheres[hit.primitive].getNormal(location);
+                    message.hit = 1;
+                    message.material = materials[hit.primitive];
+                    message.time = hit.time;
+                    for (int a = 0; a < 3; a++) {
+                        message.location[a] = location[a];
+                        message.normal[a] = normal[a];
+                    }
+                }
+            }
+        }
+
+        // Rays that leave the slab before their end go on to the next one
+        if (!message.hit && exit < message.maxTime) {
+            int next = message.path[axis] > 0.0f ? partition + 1 : partition - 1;
+            if (next >= 0 && next < count) {
+                push(next, message);
+                continue;
+            }
+        }
+        answer(message);
+    }
+}
+
+void PartitionSet::trace(RayMessage &message) {
+    // Every thread has its own reply slot
+    static thread_local int requester = -1;
+    if (requester < 0) {
+        requester = nextRequester++ % maxRequesters;
+    }
+    std::lock_guard<std::mutex> guard(requesterLocks[requester]);
+    message.requester = requester;
+    message.hit = 0;
+    push(partitionAt(message.origin[axis]), message);
+
+    // A worker that died would leave the ray unanswered forever, so long
+    // waits check on them. The render can not go on without one, so the
+    // others are stopped and the program ends.
+    RayReply* reply = getReply(requester);
+    pthread_mutex_lock(&reply->lock);
+    while (!reply->answered) {
+        timespec deadline = inOneSecond();
+        if (pthread_cond_timedwait(&reply->ready, &reply->lock, &deadline) != ETIMEDOUT) {
+            continue;
+        }
+        std::lock_guard<std::mutex> workerGuard(workerLock);
+        for (size_t w = 0; w < workers.size(); w++) {
+            int status;
+            if (waitpid(workers[w], &status, WNOHANG) != 0) {
+                std::cerr << "Partition worker " << w << " stopped" << std::endl;
+                for (size_t other = 0; other < workers.size(); other++) {
+                    kill(workers[other], SIGTERM);
+                }
+                std::exit(1);
+            }
+        }
+    }
+    reply->answered = 0;
+    message = reply->message;
+    pthread_mutex_unlock(&reply->lock);
+}
+
+void PartitionSet::stop() {
+    if (shared == NULL) {
+        return;
+    }
+    RayMessage message;
+    memset(&message, 0, sizeof(message));
+    message.requester = -1;
+    for (size_t w = 0; w < workers.size(); w++) {
+        push(w, message);
+    }
+    for (size_t w = 0; w < workers.size(); w++) {
+        int status;
+        waitpid(workers[w], &status, 0);
+    }
+    workers.clear();
+
+    for (int r = 0; r < maxRequesters; r++) {
+        pthread_mutex_destroy(&getReply(r)->lock);
+        pthread_cond_destroy(&getReply(r)->ready);
+    }
+    for (int p = 0; p < count; p++) {
+        pthread_mutex_destroy(&getQueue(p)->lock);
+        pthread_cond_destroy(&getQueue(p)->ready);
+    }
+    munmap(shared, sharedSize);
+    shared = NULL;
+}
+
+int PartitionSet::intersects(Ray ray, vec3 &location, vec3 &normal, float &time, float minTime, float maxTime) {
+    RayMessage message;
+    memset(&message, 0, sizeof(message));
+    for (int a = 0; a < 3; a++) {
+        message.origin[a] = ray.origin[a];
+        message.path[a] = ray.path[a];
+    }
+    message.minTime = minTime;
+    message.maxTime = maxTime;
+    trace(message);
+    if (!message.hit) {
+        return -1;
+    }
+    location = vec3(message.location[0], message.location[1], message.location[2]);
+    normal = vec3(message.normal[0], message.normal[1], message.normal[2]);
+    time = message.time;
+    return message.material;
+}
+
+bool PartitionSet::occluded(Ray ray, float minTime, float maxTime) {
+    RayMessage message;
+    memset(&message, 0, sizeof(message));
+    for (int a = 0; a < 3; a++) {
+        message.origin[a] = ray.origin[a];
+        message.path[a] = ray.path[a];
+    }
+    message.minTime = minTime;
+    message.maxTime = maxTime;
+    message.occlusion = 1;
+    trace(message);
+    return message.hit != 0;
+}
+
+int PartitionSet::getCount() {
+    return count;
+}
+
+int PartitionSet::getAxis() {
+    return axis;
+}
+
+std::vector<size_t> PartitionSet::getSphereCounts() {
+    return sphereCounts;
+}
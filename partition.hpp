@@ -0,0 +1,129 @@
+//
+//  partition.hpp
+//  
+//
+//  Created by Brendan Martin on 10/19/26.
+//
+
+#ifndef partition_hpp
+#define partition_hpp
+
+#include <stdio.h>
+#include <stdint.h>
+#include <vector>
+#include <atomic>
+#include <mutex>
+#include <pthread.h>
+#include <sys/types.h>
+#include <glm/glm.hpp>
+#include "geometry.hpp"
+#include "bvh.hpp"
+
+typedef glm::vec3 vec3;
+
+struct Scene;
+
+// A ray on its way through the partitions, and once a partition has
+// answered it, the answer
+struct RayMessage {
+    float origin[3];
+    float path[3];
+    float minTime;
+    float maxTime;
+    // Reply slot of the thread waiting for the ray, or -1 to stop a worker
+    int32_t requester;
+    // Shadow rays only need to know whether anything is hit
+    int32_t occlusion;
+
+    int32_t hit;
+    // Index into the scene's materials of the sphere hit
+    int32_t material;
+    float time;
+    float location[3];
+    float normal[3];
+};
+
+// Threads that may wait for rays at once. Every waiting thread has one ray
+// in some queue, so queues this long never fill up.
+static const int maxRequesters = 256;
+
+// Rays waiting for one partition, in memory shared by every process. The
+// mutex and condition are shared between processes.
+struct RayQueue {
+    pthread_mutex_t lock;
+    pthread_cond_t ready;
+    uint32_t head;
+    uint32_t tail;
+    RayMessage messages[maxRequesters + 1];
+};
+
+struct RayReply {
+    pthread_mutex_t lock;
+    pthread_cond_t ready;
+    int32_t answered;
+    RayMessage message;
+};
+
+// The scene's spheres split along one axis into slabs with equal numbers
+// of spheres, each owned by a worker process that keeps only the spheres
+// overlapping its slab and its own BVH over them. A ray is sent to the
+// slab its origin is in; a worker traces it over the part of the ray inside
+// its slab and either answers or forwards it to the next slab along the
+// ray, through queues in shared memory. The first slab that finds a hit
+// has the closest one, as spheres crossing a slab boundary belong to both.
+class PartitionSet {
+    int count;
+    int axis;
+    // count - 1 boundaries between slabs, in increasing order
+    std::vector<float> splits;
+    std::vector<size_t> sphereCounts;
+    std::vector<pid_t> workers;
+    // The process that started the workers; they stop once it is gone
+    pid_t coordinator;
+
+    void* shared;
+    size_t sharedSize;
+
+    std::atomic<int> nextRequester;
+    std::mutex requesterLocks[maxRequesters];
+    std::mutex workerLock;
+
+    RayQueue* getQueue(int partition);
+    RayReply* getReply(int requester);
+    int partitionAt(float coordinate);
+    // Part of the ray inside a slab
+    void clip(int partition, const RayMessage &message, float &enter, float &exit);
+    void push(int partition, const RayMessage &message);
+    // Waits for the next ray of a partition. Returns false once the
+    // coordinator has gone.
+    bool pop(int partition, RayMessage &message);
+    void answer(const RayMessage &message);
+    void serve(int partition, std::vector<Sphere> &spheres, std::vector<int> &materials);
+    // Sends a ray from this process and waits for the answer
+    void trace(RayMessage &message);
+
+public:
+    PartitionSet();
+    ~PartitionSet();
+    PartitionSet(const PartitionSet&) = delete;
+    PartitionSet& operator=(const PartitionSet&) = delete;
+
+    // Splits the scene's spheres into count slabs and forks a worker for
+    // each, then drops the spheres from this process. Must be called before
+    // any other threads are started. Errors are printed.
+    bool start(Scene &scene, int count);
+    // Stops the workers and waits for them
+    void stop();
+
+    // Returns the material index of the closest sphere hit, or -1
+    int intersects(Ray ray, vec3 &location, vec3 &normal, float &time, float minTime, float maxTime);
+    bool occluded(Ray ray, float minTime, float maxTime);
+
+    int getCount();
+    int getAxis();
+    // Spheres kept by every partition, counting spheres on a boundary once
+    // for every slab they cross
+    std::vector<size_t> getSphereCounts();
+};
+
+#endif /* partition_hpp */
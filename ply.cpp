@@ -0,0 +1,447 @@
+//
+//  ply.cpp
+//  
+//
+//  Created by Brendan Martin on 10/19/26.
+//
+
+#include "ply.hpp"
+#include "mappedfile.hpp"
+#include <algorithm>
+#include <iostream>
+#include <limits>
+#include <memory>
+#include <thread>
+#include <vector>
+#include <cstdlib>
+#include <cstring>
+
+// Scalar types of PLY properties, named after their sizes
+enum PLYType { plyNone, plyInt8, plyUint8, plyInt16, plyUint16, plyInt32, plyUint32, plyFloat32, plyFloat64 };
+
+struct PLYProperty {
+    string name;
+    PLYType type;
+    // Type of the count before a list's values, plyNone for scalars
+    PLYType countType;
+    // Offset into the record, only meaningful while the element has no lists
+    size_t offset;
+};
+
+struct PLYElement {
+    string name;
+    uint64_t count;
+    std::vector<PLYProperty> properties;
+    // Size of every record, or 0 when lists make records differ in size
+    size_t stride;
+};
+
+// Triangle indices must fit the BVH's int indices
+static const uint64_t maxTriangles = std::numeric_limits<int>::max();
+
+// Fewer records than this per thread are not worth a thread
+static const size_t minParallelRecords = 1 << 16;
+
+static PLYType parseType(const string &name) {
+    if (name == "char" || name == "int8") {
+        return plyInt8;
+    } else if (name == "uchar" || name == "uint8") {
+        return plyUint8;
+    } else if (name == "short" || name == "int16") {
+        return plyInt16;
+    } else if (name == "ushort" || name == "uint16") {
+        return plyUint16;
+    } else if (name == "int" || name == "int32") {
+        return plyInt32;
+    } else if (name == "uint" || name == "uint32") {
+        return plyUint32;
+    } else if (name == "float" || name == "float32") {
+        return plyFloat32;
+    } else if (name == "double" || name == "float64") {
+        return plyFloat64;
+    }
+    return plyNone;
+}
+
+static size_t typeSize(PLYType type) {
+    switch (type) {
+        case plyInt8: case plyUint8: return 1;
+        case plyInt16: case plyUint16: return 2;
+        case plyInt32: case plyUint32: case plyFloat32: return 4;
+        case plyFloat64: return 8;
+        default: return 0;
+    }
+}
+
+// Values are read with memcpy, as records give no alignment guarantees.
+// Like the renderer's other files, PLY data is used in the machine's byte
+// order, which has to be little-endian.
+static double readScalar(const char* p, PLYType type) {
+    switch (type) {
+        case plyInt8: { int8_t v; memcpy(&v, p, 1); return v; }
+        case plyUint8: { uint8_t v; memcpy(&v, p, 1); return v; }
+        case plyInt16: { int16_t v; memcpy(&v, p, 2); return v; }
+        case plyUint16: { uint16_t v; memcpy(&v, p, 2); return v; }
+        case plyInt32: { int32_t v; memcpy(&v, p, 4); return v; }
+        case plyUint32: { uint32_t v; memcpy(&v, p, 4); return v; }
+        case plyFloat32: { float v; memcpy(&v, p, 4); return v; }
+        case plyFloat64: { double v; memcpy(&v, p, 8); return v; }
+        default: return 0.0;
+    }
+}
+
+// Splits a header line at spaces
+static std::vector<string> splitWords(const char* line, size_t length) {
+    std::vector<string> words;
+    size_t i = 0;
+    while (i < length) {
+        while (i < length && (line[i] == ' ' || line[i] == '\t' || line[i] == '\r')) {
+            i++;
+        }
+        size_t start = i;
+        while (i < length && line[i] != ' ' && line[i] != '\t' && line[i] != '\r') {
+            i++;
+        }
+        if (i > start) {
+            words.push_back(string(line + start, i - start));
+        }
+    }
+    return words;
+}
+
+// Moves offset past the records of an element whose records differ in
+// size. Returns false if the file ends first.
+static bool skipElement(const PLYElement &element, const char* data, size_t size, size_t &offset) {
+    for (uint64_t r = 0; r < element.count; r++) {
+        for (size_t p = 0; p < element.properties.size(); p++) {
+            const PLYProperty &property = element.properties[p];
+            size_t length = typeSize(property.type);
+            if (property.countType != plyNone) {
+                if (size - offset < typeSize(property.countType)) {
+                    return false;
+                }
+                double n = readScalar(data + offset, property.countType);
+                offset += typeSize(property.countType);
+                if (n < 0) {
+                    return false;
+                }
+                length *= (size_t)n;
+            }
+            if (size - offset < length) {
+                return false;
+            }
+            offset += length;
+        }
+    }
+    return true;
+}
+
+// Calls work(slice, begin, end) for threads slices of [0, count) at once
+template <class Work>
+static void parallelSlices(size_t count, int threads, Work work) {
+    std::vector<std::thread> workers;
+    for (int t = 1; t < threads; t++) {
+        workers.push_back(std::thread(work, t, count * t / threads, count * (t + 1) / threads));
+    }
+    work(0, (size_t)0, count / threads);
+    for (size_t t = 0; t < workers.size(); t++) {
+        workers[t].join();
+    }
+}
+
+PLYFile::PLYFile() {
+
+}
+
+void PLYFile::error(string message) {
+    std::cerr << filename << ": " << message << std::endl;
+}
+
+bool PLYFile::load(string file, Mesh &mesh, int threads) {
+    filename = file;
+    mesh = Mesh();
+
+    // The mapping is shared with the mesh when it keeps the vertices
+    std::shared_ptr<MappedFile> mapped = std::make_shared<MappedFile>();
+    if (!mapped->open(file, AccessNormal)) {
+        error("could not open file");
+        return false;
+    }
+    const char* data = mapped->getData();
+    size_t size = mapped->getSize();
+
+    // The header is text, one statement per line, up to "end_header"
+    std::vector<PLYElement> elements;
+    size_t offset = 0;
+    bool ended = false;
+    bool formatted = false;
+    for (int line = 0; !ended; line++) {
+        const char* end = (const char*)memchr(data + offset, '\n', size - offset);
+        if (end == NULL) {
+            error(line == 0 ? "not a PLY file" : "header has no end_header line");
+            return false;
+        }
+        std::vector<string> words = splitWords(data + offset, end - (data + offset));
+        offset = end - data + 1;
+
+        if (line == 0) {
+            if (words.size() != 1 || words[0] != "ply") {
+                error("not a PLY file");
+                return false;
+            }
+        } else if (words.empty() || words[0] == "comment" || words[0] == "obj_info") {
+            continue;
+        } else if (words[0] == "format") {
+            if (words.size() < 2 || words[1] != "binary_little_endian") {
+                error("only binary little-endian PLY files are supported");
+                return false;
+            }
+            formatted = true;
+        } else if (words[0] == "element" && words.size() == 3) {
+            PLYElement element;
+            element.name = words[1];
+            element.count = strtoull(words[2].c_str(), NULL, 10);
+            element.stride = 0;
+            elements.push_back(element);
+        } else if (words[0] == "property" && !elements.empty()) {
+            PLYProperty property;
+            property.countType = plyNone;
+            property.offset = elements.back().stride;
+            if (words.size() == 5 && words[1] == "list") {
+                property.countType = parseType(words[2]);
+                property.type = parseType(words[3]);
+                property.name = words[4];
+            } else if (words.size() == 3) {
+                property.type = parseType(words[1]);
+                property.name = words[2];
+            } else {
+                error("could not read header line " + std::to_string(line + 1));
+                return false;
+            }
+            if (property.type == plyNone || (words[1] == "list" && property.countType == plyNone)) {
+                error("unknown property type on header line " + std::to_string(line + 1));
+                return false;
+            }
+            elements.back().properties.push_back(property);
+            elements.back().stride += property.countType == plyNone ? typeSize(property.type) : 0;
+        } else if (words[0] == "end_header") {
+            ended = true;
+        } else {
+            error("could not read header line " + std::to_string(line + 1));
+            return false;
+        }
+    }
+    if (!formatted) {
+        error("only binary little-endian PLY files are supported");
+        return false;
+    }
+
+    // Strides are only kept for elements whose records all have one size
+    for (size_t e = 0; e < elements.size(); e++) {
+        size_t stride = 0;
+        for (size_t p = 0; p < elements[e].properties.size() && stride != (size_t)-1; p++) {
+            const PLYProperty &property = elements[e].properties[p];
+            stride = property.countType == plyNone ? stride + typeSize(property.type) : (size_t)-1;
+        }
+        elements[e].stride = stride == (size_t)-1 ? 0 : stride;
+    }
+
+    // Find where the vertices and faces start. Elements before them are
+    // skipped, whole when their records have one size and record by record
+    // otherwise; elements after them are never looked at.
+    int vertexElement = -1;
+    int faceElement = -1;
+    size_t vertexStart = 0;
+    size_t faceStart = 0;
+    for (size_t e = 0; e < elements.size(); e++) {
+        const PLYElement &element = elements[e];
+        if (element.name == "vertex") {
+            vertexElement = e;
+            vertexStart = offset;
+        } else if (element.name == "face") {
+            faceElement = e;
+            faceStart = offset;
+        }
+        if (vertexElement >= 0 && faceElement >= 0) {
+            break;
+        }
+        if (element.stride > 0) {
+            if ((size - offset) / element.stride < element.count) {
+                error("file is truncated");
+                return false;
+            }
+            offset += element.stride * element.count;
+        } else if (!skipElement(element, data, size, offset)) {
+            error("file is truncated");
+            return false;
+        }
+    }
+    if (vertexElement < 0 || faceElement < 0) {
+        error("has no vertex or no face element");
+        return false;
+    }
+
+    const PLYElement &vertex = elements[vertexElement];
+    const PLYProperty* axes[3] = { NULL, NULL, NULL };
+    for (size_t p = 0; p < vertex.properties.size(); p++) {
+        const PLYProperty &property = vertex.properties[p];
+        for (int axis = 0; axis < 3; axis++) {
+            if (property.name == string(1, "xyz"[axis]) && property.countType == plyNone) {
+                axes[axis] = &property;
+            }
+        }
+    }
+    if (axes[0] == NULL || axes[1] == NULL || axes[2] == NULL) {
+        error("vertices have no x, y and z");
+        return false;
+    }
+    if (vertex.stride == 0) {
+        error("vertices with list properties are not supported");
+        return false;
+    }
+    if ((size - vertexStart) / vertex.stride < vertex.count) {
+        error("file is truncated");
+        return false;
+    }
+    if (vertex.count > std::numeric_limits<uint32_t>::max()) {
+        error("holds " + std::to_string(vertex.count) + " vertices, more than 32-bit indices can reach");
+        return false;
+    }
+    size_t vertexCount = vertex.count;
+
+    const PLYElement &face = elements[faceElement];
+    const PLYProperty* corners = NULL;
+    for (size_t p = 0; p < face.properties.size(); p++) {
+        const PLYProperty &property = face.properties[p];
+        if ((property.name == "vertex_indices" || property.name == "vertex_index") && property.countType != plyNone &&
+            property.type != plyFloat32 && property.type != plyFloat64) {
+            corners = &property;
+        }
+    }
+    if (corners == NULL) {
+        error("faces have no vertex_indices list");
+        return false;
+    }
+
+    if (threads <= 0) {
+        threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+    size_t records = std::max(vertexCount, (size_t)face.count);
+    threads = (int)std::max((size_t)1, std::min((size_t)threads, records / minParallelRecords));
+
+    // Vertices that are nothing but three aligned floats are used in place
+    const char* vertexData = data + vertexStart;
+    if (vertex.stride == sizeof(vec3) && axes[0]->type == plyFloat32 && axes[0]->offset == 0 &&
+        axes[1]->type == plyFloat32 && axes[1]->offset == 4 && axes[2]->type == plyFloat32 && axes[2]->offset == 8 &&
+        (uintptr_t)vertexData % alignof(vec3) == 0) {
+        mesh.adoptVertices(mapped, (const vec3*)vertexData, vertexCount);
+    } else {
+        std::vector<vec3> &vertices = mesh.getVertexBuffer();
+        vertices.resize(vertexCount);
+        parallelSlices(vertexCount, threads, [&](int, size_t begin, size_t end) {
+            for (size_t v = begin; v < end; v++) {
+                const char* record = vertexData + v * vertex.stride;
+                for (int axis = 0; axis < 3; axis++) {
+                    vertices[v][axis] = readScalar(record + axes[axis]->offset, axes[axis]->type);
+                }
+            }
+        });
+    }
+
+    // Faces written as a one byte count of 3 and three 32-bit indices, as
+    // most tools write triangle meshes, are converted in parallel. Anything
+    // else is read face by face.
+    std::vector<uint32_t> &indices = mesh.getIndexBuffer();
+    const char* faceData = data + faceStart;
+    size_t faceSize = size - faceStart;
+    const size_t triangleRecord = 1 + 3 * sizeof(uint32_t);
+    bool triangles = face.properties.size() == 1 && typeSize(corners->countType) == 1 && typeSize(corners->type) == 4 &&
+                     face.count <= maxTriangles && faceSize / triangleRecord >= face.count;
+    if (triangles) {
+        std::vector<char> sliceTriangles(threads, 1);
+        parallelSlices(face.count, threads, [&](int slice, size_t begin, size_t end) {
+            for (size_t f = begin; f < end; f++) {
+                if (faceData[f * triangleRecord] != 3) {
+                    sliceTriangles[slice] = 0;
+                    return;
+                }
+            }
+        });
+        triangles = std::find(sliceTriangles.begin(), sliceTriangles.end(), 0) == sliceTriangles.end();
+    }
+
+    if (triangles) {
+        indices.resize(face.count * 3);
+        std::vector<char> sliceValid(threads, 1);
+        parallelSlices(face.count, threads, [&](int slice, size_t begin, size_t end) {
+            for (size_t f = begin; f < end; f++) {
+                uint32_t corner[3];
+                memcpy(corner, faceData + f * triangleRecord + 1, sizeof(corner));
+                for (int c = 0; c < 3; c++) {
+                    // Negative int32 indices become huge unsigned ones
+                    if (corner[c] >= vertexCount) {
+                        sliceValid[slice] = 0;
+                    }
+                    indices[f * 3 + c] = corner[c];
+                }
+            }
+        });
+        if (std::find(sliceValid.begin(), sliceValid.end(), 0) != sliceValid.end()) {
+            error("face refers to a missing vertex");
+            mesh = Mesh();
+            return false;
+        }
+    } else {
+        size_t position = 0;
+        for (uint64_t f = 0; f < face.count; f++) {
+            for (size_t p = 0; p < face.properties.size(); p++) {
+                const PLYProperty &property = face.properties[p];
+                size_t count = 1;
+                if (property.countType != plyNone) {
+                    if (faceSize - position < typeSize(property.countType)) {
+                        error("file is truncated");
+                        mesh = Mesh();
+                        return false;
+                    }
+                    double n = readScalar(faceData + position, property.countType);
+                    position += typeSize(property.countType);
+                    count = n < 0 ? 0 : (size_t)n;
+                }
+                size_t length = typeSize(property.type);
+                if ((faceSize - position) / length < count) {
+                    error("file is truncated");
+                    mesh = Mesh();
+                    return false;
+                }
+                // Polygons become fans around their first corner, and faces
+                // with fewer than three corners are dropped
+                if (&property == corners && count >= 3) {
+                    uint32_t polygon[3];
+                    for (size_t c = 0; c < count; c++) {
+                        double index = readScalar(faceData + position + c * length, property.type);
+                        if (index < 0 || index >= vertexCount) {
+                            error("face " + std::to_string(f) + " refers to a missing vertex");
+                            mesh = Mesh();
+                            return false;
+                        }
+                        polygon[std::min(c, (size_t)2)] = (uint32_t)index;
+                        if (c >= 2) {
+                            indices.push_back(polygon[0]);
+                            indices.push_back(polygon[1]);
+                            indices.push_back(polygon[2]);
+                            polygon[1] = polygon[2];
+                        }
+                    }
+                }
+                position += count * length;
+            }
+        }
+        if (indices.size() / 3 > maxTriangles) {
+            error("holds more than " + std::to_string(maxTriangles) + " triangles");
+            mesh = Mesh();
+            return false;
+        }
+    }
+
+    return true;
+}
@@ -0,0 +1,39 @@
+//
+//  ply.hpp
+//  
+//
+//  Created by Brendan Martin on 10/19/26.
+//
+
+#ifndef ply_hpp
+#define ply_hpp
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string>
+#include "mesh.hpp"
+
+typedef std::string string;
+
+// Reads meshes from binary little-endian PLY files. The file is mapped
+// rather than read, and when its vertices are exactly three aligned floats
+// x, y and z the mesh uses them where they lie in the mapping instead of
+// copying them. Faces are always copied, as PLY stores a vertex count before
+// every face, and polygons with more than three corners are split into
+// fans of triangles.
+class PLYFile {
+    string filename;
+
+    void error(string message);
+
+public:
+    PLYFile();
+
+    // Replaces the mesh's vertices and triangles with those of the file,
+    // converting them on up to threads threads, threads <= 0 using one per
+    // hardware thread. The mesh's materials are left for the caller to set.
+    // Errors are printed and leave the mesh empty.
+    bool load(string file, Mesh &mesh, int threads = 0);
+};
+
+#endif /* ply_hpp */
@@ -0,0 +1,34 @@
+//
+//  random.cpp
+//  
+//
+//  Created by Brendan Martin on 10/19/26.
+//
+
+#include "random.hpp"
+#include <atomic>
+
+// Each thread's generator gets a different seed
+static std::atomic<unsigned int> nextSeed(1);
+
+// PCG32: 64 bits of state, so restarting it for every pixel costs no more
+// than drawing a number
+static thread_local uint64_t state = nextSeed.fetch_add(1) * 0x9e3779b97f4a7c15ull;
+
+float randomFloat() {
+    uint64_t old = state;
+    state = old * 6364136223846793005ull + 1442695040888963407ull;
+    uint32_t shifted = (uint32_t)(((old >> 18) ^ old) >> 27);
+    uint32_t rotation = (uint32_t)(old >> 59);
+    uint32_t value = (shifted >> rotation) | (shifted << ((32 - rotation) & 31));
+    return value * (1.0f / 4294967295.0f);
+}
+
+// Seeds that differ in a few bits are spread over the whole state first, so
+// that neighbouring pixels do not start on related sequences
+void seedRandom(uint64_t seed) {
+    seed += 0x9e3779b97f4a7c15ull;
+    seed = (seed ^ (seed >> 30)) * 0xbf58476d1ce4e5b9ull;
+    seed = (seed ^ (seed >> 27)) * 0x94d049bb133111ebull;
+    state = seed ^ (seed >> 31);
+}
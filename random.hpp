@@ -0,0 +1,22 @@
+//
+//  random.hpp
+//  
+//
+//  Created by Brendan Martin on 10/19/26.
+//
+
+#ifndef random_hpp
+#define random_hpp
+
+#include <stdio.h>
+#include <stdint.h>
+
+// Uniform random number in [0,1]. Every thread has its own generator, so
+// sampling from many render threads neither races nor waits on a lock.
+float randomFloat();
+
+// Restarts this thread's generator, so that work can be made to depend only
+// on what is being rendered rather than on which thread renders it
+void seedRandom(uint64_t seed);
+
+#endif /* random_hpp */
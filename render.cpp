@@ -0,0 +1,348 @@
+//
+//  render.cpp
+//  
+//
+//  Created by Brendan Martin on 10/19/26.
+//
+
+#include "render.hpp"
+#include "random.hpp"
+#include <limits>
+
+RenderSettings::RenderSettings() {
+    width = 500;
+    height = 500;
+    numSamples = 20;
+    timeBudget = 0;
+    firstSample = 0;
+    priority = 0;
+    lightSamples = 0;
+}
+
+// Rays traced by this thread in the current tile
+static thread_local unsigned long long threadRays = 0;
+
+Ray genCameraRay( Scene &scene, const RenderSettings &settings, int xCoor, int yCoor ) {
+    Camera &cam = scene.cam;
+    float screenHeight = settings.height;
+    float screenWidth = settings.width;
+    float worldHeight = screenHeight / 100;
+    float worldWidth = screenWidth / 100;
+    
+    vec3 right = glm::normalize( glm::cross( cam.direction, vec3(0.0,0.0,1.0) ) );
+    vec3 up = glm::normalize( glm::cross( right, cam.direction ) );
+    
+    float u = (-worldWidth/2) + worldWidth*(xCoor+0.5)/screenWidth;
+    float v = (-worldHeight/2) + worldHeight*(yCoor+0.5)/screenHeight;
+    
+    Ray camRay;
+    camRay.origin = cam.position;
+    // FreeImage begins at the lower left corner
+    camRay.path = (cam.focalLength * glm::normalize(cam.direction)) + (u*right) + (v*up);
+    
+    return camRay;
+}
+
+//vec3 genDirect(float cosThetaMax, vec3 location, Sphere light) {
+//
+//}
+
+// Moves a ray into an instance's group. The path is not normalized, so hit
+// times are the same in both spaces.
+static Ray toGroup(const Instance &instance, const Ray &ray) {
+    Ray local;
+    local.origin = vec3(instance.inverse * vec4(ray.origin, 1.0f));
+    local.path = vec3(instance.inverse * vec4(ray.path, 0.0f));
+    return local;
+}
+
+Material* findClosestObject(Scene &scene, Ray ray, vec3 &location, vec3 &normal, float &time, float minTime, float maxTime,
+                            const PagedHit* paged) {
+
+    // Every search only lowers the hit and records what it found, and the
+    // closest hit is worked out once at the end. Partitions and paged
+    // meshes hand back hits that are already worked out.
+    enum HitSource { HitNone, HitObject, HitInstance, HitParticle, HitTriangle, HitResolved };
+    Hit hit = { maxTime, -1, 0.0f, 0.0f };
+    HitSource source = HitNone;
+    // Instance, particle set or mesh of the hit
+    size_t owner = 0;
+    Material* resolved = NULL;
+
+    if (scene.bvh.intersects(ray, scene.objects.data(), hit, minTime)) {
+        source = HitObject;
+    }
+    if (scene.partitions) {
+        int material = scene.partitions->intersects(ray, location, normal, hit.time, minTime, hit.time);
+        if (material != -1) {
+            source = HitResolved;
+            resolved = &scene.materials[material];
+        }
+    }
+
+    scene.instanceBVH.traverse(ray, minTime, hit.time, [&](int i, float &maxTime) {
+        Group &group = scene.groups[scene.instances[i].group];
+        if (group.bvh.intersects(toGroup(scene.instances[i], ray), group.objects.data(), hit, minTime)) {
+            maxTime = hit.time;
+            source = HitInstance;
+            owner = i;
+        }
+        return false;
+    });
+    for (size_t p = 0; p < scene.particles.size(); p++) {
+        if (scene.particles[p].intersects(ray, hit, minTime)) {
+            source = HitParticle;
+            owner = p;
+        }
+    }
+    for (size_t m = 0; m < scene.meshes.size(); m++) {
+        if (scene.meshes[m].intersects(ray, hit, minTime)) {
+            source = HitTriangle;
+            owner = m;
+        }
+    }
+    if (paged != NULL) {
+        if (paged->material != NULL && paged->time < hit.time) {
+            location = paged->location;
+            normal = paged->normal;
+            hit.time = paged->time;
+            source = HitResolved;
+            resolved = paged->material;
+        }
+    } else {
+        for (size_t m = 0; m < scene.pagedMeshes.size(); m++) {
+            if (scene.pagedMeshes[m].intersects(ray, location, normal, hit.time, minTime, hit.time)) {
+                source = HitResolved;
+                resolved = scene.pagedMeshes[m].getMaterial();
+            }
+        }
+    }
+
+    if (source == HitNone) {
+        return NULL;
+    }
+    time = hit.time;
+    if (source == HitResolved) {
+        return resolved;
+    }
+    location = ray.origin + (time * ray.path);
+    switch (source) {
+        case HitObject:
+            normal = scene.objects[hit.primitive].getNormal(location);
+            return scene.objects[hit.primitive].getMaterial();
+        case HitInstance: {
+            // Normals are transformed by the inverse transpose
+            Instance &instance = scene.instances[owner];
+            Sphere &sphere = scene.groups[instance.group].objects[hit.primitive];
+            Ray local = toGroup(instance, ray);
+            vec3 groupNormal = sphere.getNormal(local.origin + (time * local.path));
+            normal = glm::normalize(glm::transpose(mat3(instance.inverse)) * groupNormal);
+            return sphere.getMaterial();
+        }
+        case HitParticle:
+            normal = scene.particles[owner].getNormal(hit.primitive, location);
+            return scene.particles[owner].getMaterial();
+        default:
+            normal = scene.meshes[owner].getNormal(hit.primitive);
+            return scene.meshes[owner].getMaterial(hit.primitive);
+    }
+}
+
+bool isOccluded(Scene &scene, Ray ray, float minTime, float maxTime) {
+    if (scene.bvh.occluded(ray, scene.objects.data(), minTime, maxTime)) {
+        return true;
+    }
+    if (scene.partitions && scene.partitions->occluded(ray, minTime, maxTime)) {
+        return true;
+    }
+    bool hit = false;
+    scene.instanceBVH.traverse(ray, minTime, maxTime, [&](int i, float &maxTime) {
+        Group &group = scene.groups[scene.instances[i].group];
+        hit = group.bvh.occluded(toGroup(scene.instances[i], ray), group.objects.data(), minTime, maxTime);
+        return hit;
+    });
+    if (hit) {
+        return true;
+    }
+    for (size_t p = 0; p < scene.particles.size(); p++) {
+        if (scene.particles[p].occluded(ray, minTime, maxTime)) {
+            return true;
+        }
+    }
+    for (size_t m = 0; m < scene.meshes.size(); m++) {
+        if (scene.meshes[m].occluded(ray, minTime, maxTime)) {
+            return true;
+        }
+    }
+    for (size_t m = 0; m < scene.pagedMeshes.size(); m++) {
+        if (scene.pagedMeshes[m].occluded(ray, minTime, maxTime)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Light reaching a point on a surface from one point sampled on a light
+static vec3 sampleDirect(Scene &scene, Sphere &light, Material* surface, vec3 location, vec3 normal, const Ray &ray) {
+    // sample a point on the spherical light
+    vec3 incoming;
+    float prob;
+    light.sampleLight(location, incoming, prob);
+    
+    // calculate distance to light source (shadowBound), which is also
+    // where the light itself is hit in the BVH and so just outside what is
+    // tested for shadows
+    Ray directRay = {location, incoming};
+    threadRays++;
+    float shadowBound;
+    if (!light.intersects(directRay, shadowBound, 0.01, std::numeric_limits<float>::infinity())) {
+        return vec3(0.0f);
+    }
+    
+    // Check if the light is obstructed, other lights included
+    if (isOccluded(scene, directRay, 0.01, shadowBound)) {
+        return vec3(0.0f);
+    }
+    
+    // If the light is not shadowed, calculate direct lighting contribution.
+    // Light from below the surface adds nothing; the light tree never
+    // picks lights entirely below it, so both ways of sampling agree.
+    float cos_theta = glm::dot(incoming, normal);
+    if (cos_theta <= 0.0f) {
+        return vec3(0.0f);
+    }
+    vec3 brdf = surface->BRDF(normal, incoming, -glm::normalize(ray.path));
+    return brdf * light.getMaterial()->getEmissive() * cos_theta / prob;
+}
+
+// Function is called once per view ray
+vec3 tracepath( Scene &scene, const RenderSettings &settings, Ray ray, int depth, const PagedHit* paged ) {
+    std::vector<int> &lights = scene.lights;
+    
+    vec3 color = vec3(0.0f);
+    
+    // Find the closest object
+    vec3 location = vec3(0.0f);
+    vec3 normal = vec3(0.0f);  // Expressed in space coordinates, not local
+    
+    
+    threadRays++;
+    float time = std::numeric_limits<float>::infinity();
+    Material* closestObj = findClosestObject(scene, ray, location, normal, time, 0.01, time, paged);
+    
+    // Lights are in the BVH with everything else, so the closest hit tells
+    // whether a light is in front of every object
+    if (closestObj != NULL && closestObj->isLight())
+    {
+        // Return the emission of the light
+        return vec3(0.0f);
+//        return closestObj->getEmissive();
+    }
+    
+    // Otherwise, if an object has been hit
+    if (closestObj != NULL)
+    {
+        
+        // Sample direct illumination
+//        if (depth == 0)
+//        {
+        if (settings.lightSamples > 0)
+        {
+            // A few lights picked by how much they are likely to add, each
+            // weighted by the chance of picking it, so the sum stays
+            // unbiased while its cost no longer grows with the lights
+            for (int s = 0; s < settings.lightSamples; s++)
+            {
+                float pick;
+                int l = scene.lightTree.pick(location, normal, pick);
+                if (l < 0)
+                {
+                    continue;
+                }
+                color += sampleDirect(scene, scene.objects[lights[l]], closestObj, location, normal, ray) /
+                         (pick * settings.lightSamples);
+            }
+        }
+        else
+        {
+            for (int l = 0; l < (int)lights.size(); l++)
+            { // for every light
+                color += sampleDirect(scene, scene.objects[lights[l]], closestObj, location, normal, ray);
+            }
+        }
+            
+//        }
+        
+        // Sample Indirect Lighting
+        
+        // Exit Condition: Russian Roulette
+        float rouletteCutoff = 0.2;
+        float roulette = randomFloat();
+        
+        if (roulette > rouletteCutoff)
+        {
+        
+            // Generate new random direction and the probability of choosing that direction
+            vec3 incoming;
+            vec3 prob;
+            closestObj->sampleDir(normal, -glm::normalize(ray.path), incoming, prob);
+            
+            // Calculate the amount of incoming light reflected in the outgoing direction
+            vec3 brdf = closestObj->BRDF(normal, incoming, -glm::normalize(ray.path));
+            
+            // Calculate the cos of angle between normal vector and incoming light
+            float cos_theta = glm::dot(incoming, normal);
+            
+            // Record new ray to trace
+            ray.origin = location;
+            ray.path = incoming;
+            
+            // Compute the transport equation, continue to recurse
+            color += brdf * tracepath(scene, settings, ray, depth+1) * cos_theta / (prob * (1-rouletteCutoff));
+        }
+    }
+    
+    return color;
+}
+
+// Random seed for one sample of image pixel (x, y)
+static uint64_t pixelSeed(int sample, int x, int y) {
+    return (uint64_t)(uint32_t)sample << 42 ^ (uint64_t)(uint32_t)y << 21 ^ (uint32_t)x;
+}
+
+unsigned long long renderTile(Scene &scene, const RenderSettings &settings, Framebuffer &film, int sample,
+                              int x0, int y0, int x1, int y1, int firstColumn, int firstRow) {
+    threadRays = 0;
+    if (scene.pagedMeshes.empty()) {
+        for (int j = y0; j < y1; j++) {
+            for (int i = x0; i < x1; i++) {
+                seedRandom(pixelSeed(sample, firstColumn + i, firstRow + j));
+                film.add(i, j, tracepath( scene, settings, genCameraRay(scene, settings, firstColumn + i, firstRow + j) ));
+            }
+        }
+        return threadRays;
+    }
+
+    // Camera rays of a tile are coherent, so they are traced through the
+    // paged meshes as one batch, which reads every chunk they need once.
+    // Later bounces read chunks as they reach them.
+    std::vector<Ray> rays;
+    for (int j = y0; j < y1; j++) {
+        for (int i = x0; i < x1; i++) {
+            rays.push_back(genCameraRay(scene, settings, firstColumn + i, firstRow + j));
+        }
+    }
+    PagedHit miss = { vec3(0.0f), vec3(0.0f), std::numeric_limits<float>::infinity(), NULL };
+    std::vector<PagedHit> hits(rays.size(), miss);
+    for (size_t m = 0; m < scene.pagedMeshes.size(); m++) {
+        scene.pagedMeshes[m].intersects(rays, hits, 0.01);
+    }
+    size_t r = 0;
+    for (int j = y0; j < y1; j++) {
+        for (int i = x0; i < x1; i++, r++) {
+            seedRandom(pixelSeed(sample, firstColumn + i, firstRow + j));
+            film.add(i, j, tracepath( scene, settings, rays[r], 0, &hits[r] ));
+        }
+    }
+    return threadRays;
+}
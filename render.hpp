@@ -0,0 +1,68 @@
+//
+//  render.hpp
+//  
+//
+//  Created by Brendan Martin on 10/19/26.
+//
+
+#ifndef render_hpp
+#define render_hpp
+
+#include <stdio.h>
+#include <glm/glm.hpp>
+#include "geometry.hpp"
+#include "scene.hpp"
+#include "framebuffer.hpp"
+
+typedef glm::vec3 vec3;
+
+// How an image is rendered. Everything about a render that is not part of
+// the scene lives here, so one scene can be rendered with many settings.
+struct RenderSettings {
+    // Image size in pixels
+    int width;
+    int height;
+
+    // Whole passes are rendered until numSamples are done or, with a
+    // positive time budget, until the next pass is predicted to overrun it
+    int numSamples;
+    float timeBudget;
+
+    // Index of the first sample. Every sample of every tile has its own
+    // random numbers, so renders of different sample ranges of one image
+    // can be added together.
+    int firstSample;
+
+    // Renders with a higher priority are served first when several share
+    // a Renderer
+    int priority;
+
+    // Lights sampled for direct lighting at every bounce, picked through
+    // the scene's light tree. 0 samples every light.
+    int lightSamples;
+
+    RenderSettings();
+};
+
+Ray genCameraRay( Scene &scene, const RenderSettings &settings, int xCoor, int yCoor );
+// Returns the material of the closest sphere, light, particle or triangle
+// hit, or NULL. A paged hit already found for the ray replaces tracing it
+// through the paged meshes.
+Material* findClosestObject(Scene &scene, Ray ray, vec3 &location, vec3 &normal, float &time, float minTime, float maxTime,
+                            const PagedHit* paged = NULL);
+// Whether any sphere, light, particle or triangle is hit within (minTime, maxTime)
+bool isOccluded(Scene &scene, Ray ray, float minTime, float maxTime);
+
+// Function is called once per view ray
+vec3 tracepath( Scene &scene, const RenderSettings &settings, Ray ray, int depth = 0, const PagedHit* paged = NULL );
+
+// Adds sample number sample to every pixel in columns [x0,x1) and rows
+// [y0,y1) of the film, whose bottom left pixel is image pixel (firstColumn,
+// firstRow). Every pixel's path is seeded from the sample and its place in
+// the image, so the result does not depend on how the image was divided.
+// Tiles that do not overlap can be rendered on different threads. Returns
+// the number of rays traced.
+unsigned long long renderTile(Scene &scene, const RenderSettings &settings, Framebuffer &film, int sample,
+                              int x0, int y0, int x1, int y1, int firstColumn = 0, int firstRow = 0);
+
+#endif /* render_hpp */
@@ -0,0 +1,49 @@
+//
+//  renderer.cpp
+//  
+//
+//  Created by Brendan Martin on 10/19/26.
+//
+
+#include "renderer.hpp"
+
+Renderer::Renderer(int threads) : scheduler(threads) {
+}
+
+int Renderer::getThreads() {
+    return scheduler.getThreads();
+}
+
+RenderResult Renderer::render(Scene &scene, const RenderSettings &settings, Framebuffer &film,
+                              PassCallback callback, const std::atomic<bool>* cancel) {
+    if (film.getWidth() != settings.width || film.getHeight() != settings.height) {
+        film.set(settings.width, settings.height);
+    }
+
+    RenderRequest request;
+    request.scene = &scene;
+    request.film = &film;
+    request.settings = settings;
+    request.callback = callback;
+    request.cancel = cancel;
+    return wait(submit(request));
+}
+
+RenderResult Renderer::renderBand(Scene &scene, const RenderSettings &settings, Framebuffer &band, int firstRow) {
+    // A time budget would give bands different sample counts
+    RenderRequest request;
+    request.scene = &scene;
+    request.film = &band;
+    request.firstRow = firstRow;
+    request.settings = settings;
+    request.settings.timeBudget = 0;
+    return wait(submit(request));
+}
+
+int Renderer::submit(RenderRequest request) {
+    return scheduler.submit(request);
+}
+
+RenderResult Renderer::wait(int job) {
+    return scheduler.wait(job);
+}
@@ -0,0 +1,45 @@
+//
+//  renderer.hpp
+//  
+//
+//  Created by Brendan Martin on 10/19/26.
+//
+
+#ifndef renderer_hpp
+#define renderer_hpp
+
+#include <stdio.h>
+#include <atomic>
+#include "scene.hpp"
+#include "framebuffer.hpp"
+#include "render.hpp"
+#include "scheduler.hpp"
+
+// The entry point of the library. A Renderer holds a pool of worker threads
+// and nothing about any scene, so any number of threads may render through
+// one Renderer at the same time, each with its own film and with the same or
+// different scenes. A scene must not be changed while it is being rendered.
+class Renderer {
+    Scheduler scheduler;
+
+public:
+    // threads <= 0 uses one worker per hardware thread
+    Renderer(int threads = 0);
+
+    int getThreads();
+
+    // Renders the whole image into film, which is resized to the settings
+    RenderResult render(Scene &scene, const RenderSettings &settings, Framebuffer &film,
+                        PassCallback callback = nullptr, const std::atomic<bool>* cancel = NULL);
+
+    // Renders settings.numSamples passes of the rows of the image that band
+    // holds, starting at image row firstRow
+    RenderResult renderBand(Scene &scene, const RenderSettings &settings, Framebuffer &band, int firstRow);
+
+    // Starts a render without waiting for it; the scene and film must stay
+    // alive until it has been waited for
+    int submit(RenderRequest request);
+    RenderResult wait(int job);
+};
+
+#endif /* renderer_hpp */
@@ -0,0 +1,210 @@
+//
+//  scene.cpp
+//  
+//
+//  Created by Brendan Martin on 10/19/26.
+//
+
+#include "scene.hpp"
+#include "parser.hpp"
+#include "scenefile.hpp"
+#include <map>
+#include <limits>
+
+Scene::Scene() {
+    frames = 1;
+}
+
+bool Scene::load(string file) {
+    if (SceneFile::isCompiled(file)) {
+        if (!SceneFile().load(file, *this)) {
+            return false;
+        }
+        lightTree.build(objects, lights);
+        return true;
+    }
+
+    Parser parse = Parser();
+    if (!parse.load(file, *this)) {
+        return false;
+    }
+    buildBVH();
+    return true;
+}
+
+// Puts spheres in the order the leaves reference them, so spheres that are
+// tested together are next to each other in memory. moved maps old indices
+// to new ones.
+static void sortLeaves(BVH &bvh, std::vector<Sphere> &spheres, std::vector<int> &moved) {
+    std::vector<int> &indices = bvh.getIndices();
+    std::vector<Sphere> sorted(spheres.size());
+    moved.resize(spheres.size());
+    for (size_t i = 0; i < indices.size(); i++) {
+        sorted[i] = spheres[indices[i]];
+        moved[indices[i]] = i;
+        indices[i] = i;
+    }
+    spheres.swap(sorted);
+}
+
+void Scene::buildBVH(int threads) {
+    bvh.build(objects, threads);
+    std::vector<int> moved;
+    sortLeaves(bvh, objects, moved);
+
+    for (size_t k = 0; k < keys.size(); k++) {
+        if (keys[k].target == KeyObject) {
+            keys[k].index = moved[keys[k].index];
+        }
+    }
+    for (size_t l = 0; l < lights.size(); l++) {
+        lights[l] = moved[lights[l]];
+    }
+    lightTree.build(objects, lights);
+
+    // Every group is built once however often it is placed
+    std::vector<BoundingBox> groupBoxes(groups.size());
+    for (size_t g = 0; g < groups.size(); g++) {
+        groups[g].bvh.build(groups[g].objects, threads);
+        sortLeaves(groups[g].bvh, groups[g].objects, moved);
+
+        // Empty groups get an empty box at their origin
+        BoundingBox &box = groupBoxes[g];
+        box.boundsMin = groups[g].objects.empty() ? vec3(0.0f) : vec3(std::numeric_limits<float>::infinity());
+        box.boundsMax = groups[g].objects.empty() ? vec3(0.0f) : vec3(-std::numeric_limits<float>::infinity());
+        for (size_t i = 0; i < groups[g].objects.size(); i++) {
+            Sphere &s = groups[g].objects[i];
+            box.boundsMin = glm::min(box.boundsMin, s.getPosition() - vec3(s.getRadius()));
+            box.boundsMax = glm::max(box.boundsMax, s.getPosition() + vec3(s.getRadius()));
+        }
+    }
+
+    // The world box of an instance is the box around its group's box
+    // after transforming all eight corners
+    std::vector<BoundingBox> instanceBoxes(instances.size());
+    for (size_t i = 0; i < instances.size(); i++) {
+        BoundingBox &group = groupBoxes[instances[i].group];
+        BoundingBox &box = instanceBoxes[i];
+        box.boundsMin = vec3(std::numeric_limits<float>::infinity());
+        box.boundsMax = vec3(-std::numeric_limits<float>::infinity());
+        for (int corner = 0; corner < 8; corner++) {
+            vec4 point((corner & 1) ? group.boundsMax.x : group.boundsMin.x, (corner & 2) ? group.boundsMax.y : group.boundsMin.y,
+                       (corner & 4) ? group.boundsMax.z : group.boundsMin.z, 1.0f);
+            vec3 world = vec3(instances[i].transform * point);
+            box.boundsMin = glm::min(box.boundsMin, world);
+            box.boundsMax = glm::max(box.boundsMax, world);
+        }
+    }
+    instanceBVH.build(instanceBoxes, threads);
+
+    for (size_t m = 0; m < meshes.size(); m++) {
+        meshes[m].build(threads);
+    }
+}
+
+void Scene::clear() {
+    materials.clear();
+    objects.clear();
+    lights.clear();
+    lightTree.clear();
+    bvh.clear();
+    particles.clear();
+    meshes.clear();
+    pagedMeshes.clear();
+    groups.clear();
+    instances.clear();
+    instanceBVH.clear();
+    partitions.reset();
+    cam = Camera();
+    frames = 1;
+    cameras.clear();
+    keys.clear();
+}
+
+bool Scene::isAnimated() {
+    return frames > 1 || cameras.size() > 1 || !keys.empty();
+}
+
+// For every keyframed target, the last key at or before the frame and the
+// first key after it, or -1
+typedef std::map< std::pair<int, int>, std::pair<int, int> > KeySpans;
+
+static void findKeys(std::vector<Keyframe> &keys, int frame, KeySpans &spans) {
+    for (int k = 0; k < (int)keys.size(); k++) {
+        std::pair<int, int> target((int)keys[k].target, keys[k].index);
+        if (spans.count(target) == 0) {
+            spans[target] = std::make_pair(-1, -1);
+        }
+        std::pair<int, int> &span = spans[target];
+        if (keys[k].frame <= frame) {
+            if (span.first < 0 || keys[k].frame >= keys[span.first].frame) {
+                span.first = k;
+            }
+        } else if (span.second < 0 || keys[k].frame < keys[span.second].frame) {
+            span.second = k;
+        }
+    }
+}
+
+static Keyframe interpolate(std::vector<Keyframe> &keys, std::pair<int, int> span, int frame) {
+    if (span.first < 0) {
+        return keys[span.second];
+    }
+    if (span.second < 0) {
+        return keys[span.first];
+    }
+    Keyframe &a = keys[span.first];
+    Keyframe &b = keys[span.second];
+    float t = (float)(frame - a.frame) / (b.frame - a.frame);
+
+    Keyframe key = a;
+    key.position = glm::mix(a.position, b.position, t);
+    key.direction = glm::mix(a.direction, b.direction, t);
+    key.value = a.value + (b.value - a.value) * t;
+    return key;
+}
+
+Camera Scene::getCamera(int camera, int frame) {
+    Camera result = camera < (int)cameras.size() ? cameras[camera] : cam;
+
+    KeySpans spans;
+    findKeys(keys, frame, spans);
+    KeySpans::iterator span = spans.find(std::make_pair((int)KeyCamera, camera));
+    if (span != spans.end()) {
+        Keyframe key = interpolate(keys, span->second, frame);
+        result.position = key.position;
+        result.direction = key.direction;
+        result.focalLength = key.value;
+    }
+    return result;
+}
+
+BVHUpdate Scene::setFrame(int frame, int threads) {
+    KeySpans spans;
+    findKeys(keys, frame, spans);
+
+    bool moved = false;
+    bool lightMoved = false;
+    for (KeySpans::iterator span = spans.begin(); span != spans.end(); span++) {
+        KeyTarget target = (KeyTarget)span->first.first;
+        if (target == KeyCamera) {
+            continue;
+        }
+
+        Keyframe key = interpolate(keys, span->second, frame);
+        Sphere &s = objects[target == KeyObject ? key.index : lights[key.index]];
+        if (s.getPosition() != key.position || s.getRadius() != key.value) {
+            s.set(key.position, key.value, s.getMaterial());
+            moved = true;
+            lightMoved = lightMoved || target == KeyLight;
+        }
+    }
+
+    if (lightMoved) {
+        lightTree.build(objects, lights);
+    }
+    if (!moved) {
+        return BVHUnchanged;
+    }
+    return bvh.update(objects, threads);
+}
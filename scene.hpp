@@ -0,0 +1,125 @@
+//
+//  scene.hpp
+//  
+//
+//  Created by Brendan Martin on 10/19/26.
+//
+
+#ifndef scene_hpp
+#define scene_hpp
+
+#include <stdio.h>
+#include <string>
+#include <vector>
+#include <memory>
+#include "geometry.hpp"
+#include "material.hpp"
+#include "bvh.hpp"
+#include "particles.hpp"
+#include "mesh.hpp"
+#include "pagedmesh.hpp"
+#include "partition.hpp"
+#include "lighttree.hpp"
+
+typedef std::string string;
+
+// What a keyframe moves
+enum KeyTarget {
+    KeyCamera,
+    KeyObject,
+    KeyLight
+};
+
+// Where a camera, sphere or light is at one frame. Between keys values are
+// interpolated linearly; before the first and after the last key they are
+// held.
+struct Keyframe {
+    KeyTarget target;
+    int index;
+    int frame;
+    vec3 position;
+    // Camera direction, unused for spheres
+    vec3 direction;
+    // Focal length for cameras, radius for spheres
+    float value;
+};
+
+// Spheres defined once between "group" and "endgroup" lines, with a BVH in
+// the group's own space that every instance of the group shares
+struct Group {
+    string name;
+    std::vector<Sphere> objects;
+    BVH bvh;
+};
+
+// A group placed in the world. Rays are moved into the group's space
+// rather than the spheres into the world, so copies cost no geometry.
+struct Instance {
+    int group;
+    // From group space to the world, and back
+    mat4 transform;
+    mat4 inverse;
+};
+
+// Everything that describes what is rendered. Objects, particle sets,
+// meshes and the spheres of groups point into materials, so materials must not be resized without
+// fixing them.
+struct Scene {
+    std::vector<Material> materials;
+    // Every sphere outside groups, lights included, so one trace through
+    // the BVH finds whichever is closest
+    std::vector<Sphere> objects;
+    // Indices into objects of the lights, in the order of the file, for
+    // sampling them directly
+    std::vector<int> lights;
+    // Picks among lights by how much they add, for sampling a few of many
+    LightTree lightTree;
+    // The camera being rendered
+    Camera cam;
+
+    // Animations have several frames, each rendered from every camera
+    int frames;
+    std::vector<Camera> cameras;
+    std::vector<Keyframe> keys;
+
+    // Acceleration structure over objects
+    BVH bvh;
+    // Loaded from their own files, each with its own BVH
+    std::vector<ParticleSet> particles;
+    // Triangles of the layout, each with its own BVH
+    std::vector<Mesh> meshes;
+    // Meshes read from disk in chunks as rays reach them, with the chunks in
+    // memory kept under one budget. The cache must outlive the meshes.
+    ChunkCache chunkCache;
+    std::vector<PagedMesh> pagedMeshes;
+    std::vector<Group> groups;
+    std::vector<Instance> instances;
+    // Acceleration structure over the world boxes of instances
+    BVH instanceBVH;
+    // Set once the spheres have been moved out to worker processes, which
+    // leaves objects empty
+    std::shared_ptr<PartitionSet> partitions;
+
+    Scene();
+
+    // Loads a layout file or a compiled scene and builds the BVH if needed
+    bool load(string file);
+    void clear();
+    // Builds the BVHs over objects, over the spheres of every group, over
+    // instances and over the triangles of every mesh, and reorders spheres
+    // and triangles to match them, keeping lights and keyframes pointed at
+    // their spheres. Also builds the light tree.
+    void buildBVH(int threads = 0);
+
+    // Whether the scene describes more than one image
+    bool isAnimated();
+    // A camera as it is at a frame
+    Camera getCamera(int camera, int frame);
+    // Moves keyframed spheres and lights to where they are at a frame. If a
+    // sphere actually moved the BVH is refitted on up to threads threads, or
+    // rebuilt once refitting has degraded it too far. The light tree is
+    // rebuilt whenever a light moved.
+    BVHUpdate setFrame(int frame, int threads = 0);
+};
+
+#endif /* scene_hpp */
@@ -0,0 +1,340 @@
+//
+//  scenefile.cpp
+//  
+//
+//  Created by Brendan Martin on 10/19/26.
+//
+
+#include "scenefile.hpp"
+#include "mappedfile.hpp"
+#include <algorithm>
+#include <fstream>
+#include <cstring>
+
+static const char sceneMagic[8] = { 'P', 'T', 'S', 'C', 'E', 'N', 'E', 0 };
+
+// Spheres are stored as five arrays: x, y, z, radius and material index
+static const size_t sphereFields = 5;
+
+static uint64_t align(uint64_t offset) {
+    return (offset + 63) & ~(uint64_t)63;
+}
+
+static void pad(std::ofstream &out, uint64_t offset) {
+    while ((uint64_t)out.tellp() < offset) {
+        out.put(0);
+    }
+}
+
+static bool copyName(char* dst, string name) {
+    if (name.size() >= 16) {
+        return false;
+    }
+    memset(dst, 0, 16);
+    memcpy(dst, name.data(), name.size());
+    return true;
+}
+
+static void writeSpheres(std::ofstream &out, std::vector<Sphere> &spheres, std::vector<Material> &materials) {
+    std::vector<float> field(spheres.size());
+    for (int axis = 0; axis < 3; axis++) {
+        for (size_t i = 0; i < spheres.size(); i++) {
+            field[i] = spheres[i].getPosition()[axis];
+        }
+        out.write((const char*)field.data(), field.size() * sizeof(float));
+    }
+    for (size_t i = 0; i < spheres.size(); i++) {
+        field[i] = spheres[i].getRadius();
+    }
+    out.write((const char*)field.data(), field.size() * sizeof(float));
+
+    std::vector<int32_t> mats(spheres.size());
+    for (size_t i = 0; i < spheres.size(); i++) {
+        mats[i] = spheres[i].getMaterial() - &materials[0];
+    }
+    out.write((const char*)mats.data(), mats.size() * sizeof(int32_t));
+}
+
+// Rebuilds spheres from the field arrays, returns false on a bad material index
+static bool readSpheres(const char* data, uint32_t count, std::vector<Sphere> &spheres, std::vector<Material> &materials) {
+    const float* x = (const float*)data;
+    const float* y = x + count;
+    const float* z = y + count;
+    const float* radius = z + count;
+    const int32_t* mats = (const int32_t*)(radius + count);
+
+    spheres.resize(count);
+    for (uint32_t i = 0; i < count; i++) {
+        if (mats[i] < 0 || mats[i] >= (int32_t)materials.size()) {
+            return false;
+        }
+        spheres[i].set(vec3(x[i], y[i], z[i]), radius[i], &materials[mats[i]]);
+    }
+    return true;
+}
+
+SceneFile::SceneFile() {
+
+}
+
+void SceneFile::error(string message) {
+    std::cerr << filename << ": " << message << std::endl;
+}
+
+bool SceneFile::save(string file, Scene &scene) {
+    filename = file;
+    std::vector<Material> &materials = scene.materials;
+    if (!scene.particles.empty()) {
+        error("particle sets can not be compiled yet");
+        return false;
+    }
+    if (!scene.groups.empty()) {
+        error("groups and instances can not be compiled yet");
+        return false;
+    }
+    if (!scene.meshes.empty() || !scene.pagedMeshes.empty()) {
+        error("meshes can not be compiled yet");
+        return false;
+    }
+
+    SceneHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, sceneMagic, 8);
+    header.version = version;
+    header.materialCount = materials.size();
+    header.objectCount = scene.objects.size();
+    header.lightCount = scene.lights.size();
+    header.nodeCount = scene.bvh.getNodes().size();
+    header.indexCount = scene.bvh.getIndices().size();
+
+    header.camera[0] = scene.cam.position.x;
+    header.camera[1] = scene.cam.position.y;
+    header.camera[2] = scene.cam.position.z;
+    header.camera[3] = scene.cam.direction.x;
+    header.camera[4] = scene.cam.direction.y;
+    header.camera[5] = scene.cam.direction.z;
+    header.camera[6] = scene.cam.focalLength;
+    header.frames = scene.frames;
+    header.cameraCount = scene.cameras.size();
+    header.keyCount = scene.keys.size();
+
+    header.materialOffset = align(sizeof(SceneHeader));
+    header.objectOffset = align(header.materialOffset + header.materialCount * sizeof(MaterialRecord));
+    header.lightOffset = align(header.objectOffset + header.objectCount * sphereFields * 4);
+    header.nodeOffset = align(header.lightOffset + header.lightCount * sizeof(int32_t));
+    header.indexOffset = align(header.nodeOffset + header.nodeCount * sizeof(WideNode));
+    header.cameraOffset = align(header.indexOffset + header.indexCount * sizeof(int));
+    header.keyOffset = align(header.cameraOffset + header.cameraCount * sizeof(CameraRecord));
+
+    std::vector<MaterialRecord> records(materials.size());
+    for (size_t m = 0; m < materials.size(); m++) {
+        MaterialRecord &r = records[m];
+        if (!copyName(r.method, materials[m].getMethod()) || !copyName(r.distribution, materials[m].getDistribution()) ||
+            !copyName(r.type, materials[m].getType())) {
+            error("material names must be shorter than 16 characters");
+            return false;
+        }
+        vec3 e = materials[m].getEmissive();
+        vec3 d = materials[m].getDiffuseColor();
+        vec3 f = materials[m].getFresnel();
+        for (int i = 0; i < 3; i++) {
+            r.emissive[i] = e[i];
+            r.diffuseColor[i] = d[i];
+            r.fresnel[i] = f[i];
+        }
+        r.roughness = materials[m].getRoughness();
+    }
+
+    std::vector<CameraRecord> cameras(scene.cameras.size());
+    for (size_t c = 0; c < cameras.size(); c++) {
+        Camera &cam = scene.cameras[c];
+        for (int i = 0; i < 3; i++) {
+            cameras[c].position[i] = cam.position[i];
+            cameras[c].direction[i] = cam.direction[i];
+        }
+        cameras[c].focalLength = cam.focalLength;
+    }
+
+    std::vector<KeyRecord> keys(scene.keys.size());
+    for (size_t k = 0; k < keys.size(); k++) {
+        Keyframe &key = scene.keys[k];
+        keys[k].target = key.target;
+        keys[k].index = key.index;
+        keys[k].frame = key.frame;
+        for (int i = 0; i < 3; i++) {
+            keys[k].position[i] = key.position[i];
+            keys[k].direction[i] = key.direction[i];
+        }
+        keys[k].value = key.value;
+    }
+
+    std::ofstream out(file, std::ios::binary);
+    if (!out.is_open()) {
+        error("could not write file");
+        return false;
+    }
+
+    out.write((const char*)&header, sizeof(header));
+    pad(out, header.materialOffset);
+    out.write((const char*)records.data(), records.size() * sizeof(MaterialRecord));
+    pad(out, header.objectOffset);
+    writeSpheres(out, scene.objects, materials);
+    pad(out, header.lightOffset);
+    out.write((const char*)scene.lights.data(), header.lightCount * sizeof(int32_t));
+    pad(out, header.nodeOffset);
+    out.write((const char*)scene.bvh.getNodes().data(), header.nodeCount * sizeof(WideNode));
+    pad(out, header.indexOffset);
+    out.write((const char*)scene.bvh.getIndices().data(), header.indexCount * sizeof(int));
+    pad(out, header.cameraOffset);
+    out.write((const char*)cameras.data(), cameras.size() * sizeof(CameraRecord));
+    pad(out, header.keyOffset);
+    out.write((const char*)keys.data(), keys.size() * sizeof(KeyRecord));
+
+    return out.good();
+}
+
+bool SceneFile::load(string file, Scene &scene) {
+    filename = file;
+    scene.clear();
+    std::vector<Material> &materials = scene.materials;
+
+    MappedFile buffer;
+    if (!buffer.open(file, AccessSequential)) {
+        error("could not open file");
+        return false;
+    }
+
+    const char* data = buffer.getData();
+    size_t size = buffer.getSize();
+    if (size < sizeof(SceneHeader) || memcmp(data, sceneMagic, 8) != 0) {
+        error("not a compiled scene");
+        return false;
+    }
+
+    SceneHeader header;
+    memcpy(&header, data, sizeof(header));
+    if (header.version != version) {
+        error("compiled with scene format version " + std::to_string(header.version) +
+              ", expected version " + std::to_string(version) + "; compile the layout again");
+        return false;
+    }
+
+    if (header.materialOffset + (uint64_t)header.materialCount * sizeof(MaterialRecord) > size ||
+        header.objectOffset + (uint64_t)header.objectCount * sphereFields * 4 > size ||
+        header.lightOffset + (uint64_t)header.lightCount * sizeof(int32_t) > size ||
+        header.nodeOffset + (uint64_t)header.nodeCount * sizeof(WideNode) > size ||
+        header.indexOffset + (uint64_t)header.indexCount * sizeof(int) > size ||
+        header.cameraOffset + (uint64_t)header.cameraCount * sizeof(CameraRecord) > size ||
+        header.keyOffset + (uint64_t)header.keyCount * sizeof(KeyRecord) > size ||
+        header.indexCount != header.objectCount) {
+        error("file is truncated or damaged");
+        return false;
+    }
+
+    const MaterialRecord* records = (const MaterialRecord*)(data + header.materialOffset);
+    materials.resize(header.materialCount);
+    for (uint32_t m = 0; m < header.materialCount; m++) {
+        const MaterialRecord &r = records[m];
+        materials[m].set(string(r.method, strnlen(r.method, 16)), string(r.distribution, strnlen(r.distribution, 16)),
+                         string(r.type, strnlen(r.type, 16)), vec3(r.emissive[0], r.emissive[1], r.emissive[2]), r.roughness,
+                         vec3(r.diffuseColor[0], r.diffuseColor[1], r.diffuseColor[2]), vec3(r.fresnel[0], r.fresnel[1], r.fresnel[2]));
+    }
+
+    if (!readSpheres(data + header.objectOffset, header.objectCount, scene.objects, materials)) {
+        scene.clear();
+        error("sphere refers to a missing material");
+        return false;
+    }
+    const int32_t* lights = (const int32_t*)(data + header.lightOffset);
+    scene.lights.assign(lights, lights + header.lightCount);
+    for (uint32_t l = 0; l < header.lightCount; l++) {
+        if (lights[l] < 0 || (uint32_t)lights[l] >= header.objectCount) {
+            scene.clear();
+            error("light refers to a missing sphere");
+            return false;
+        }
+    }
+
+    scene.cam.position = vec3(header.camera[0], header.camera[1], header.camera[2]);
+    scene.cam.direction = vec3(header.camera[3], header.camera[4], header.camera[5]);
+    scene.cam.focalLength = header.camera[6];
+    scene.frames = std::max(1u, header.frames);
+
+    const CameraRecord* cameras = (const CameraRecord*)(data + header.cameraOffset);
+    scene.cameras.resize(header.cameraCount);
+    for (uint32_t c = 0; c < header.cameraCount; c++) {
+        scene.cameras[c].position = vec3(cameras[c].position[0], cameras[c].position[1], cameras[c].position[2]);
+        scene.cameras[c].direction = vec3(cameras[c].direction[0], cameras[c].direction[1], cameras[c].direction[2]);
+        scene.cameras[c].focalLength = cameras[c].focalLength;
+    }
+
+    const KeyRecord* keys = (const KeyRecord*)(data + header.keyOffset);
+    scene.keys.resize(header.keyCount);
+    for (uint32_t k = 0; k < header.keyCount; k++) {
+        uint32_t count = keys[k].target == KeyCamera ? header.cameraCount :
+                         keys[k].target == KeyObject ? header.objectCount :
+                         keys[k].target == KeyLight ? header.lightCount : 0;
+        if (keys[k].index < 0 || (uint32_t)keys[k].index >= count) {
+            scene.clear();
+            error("keyframe refers to a missing camera or sphere");
+            return false;
+        }
+        Keyframe &key = scene.keys[k];
+        key.target = (KeyTarget)keys[k].target;
+        key.index = keys[k].index;
+        key.frame = keys[k].frame;
+        key.position = vec3(keys[k].position[0], keys[k].position[1], keys[k].position[2]);
+        key.direction = vec3(keys[k].direction[0], keys[k].direction[1], keys[k].direction[2]);
+        key.value = keys[k].value;
+    }
+
+    // The BVH is used exactly as it was built, only checked for bad links
+    std::vector<WideNode> &nodes = scene.bvh.getNodes();
+    std::vector<int> &indices = scene.bvh.getIndices();
+    const WideNode* fileNodes = (const WideNode*)(data + header.nodeOffset);
+    const int* fileIndices = (const int*)(data + header.indexOffset);
+    nodes.assign(fileNodes, fileNodes + header.nodeCount);
+    indices.assign(fileIndices, fileIndices + header.indexCount);
+
+    // Children always come after their node, so one pass gives every node
+    // its depth and keeps traversal within its stack
+    std::vector<int> depth(header.nodeCount, 1);
+    for (uint32_t n = 0; n < header.nodeCount; n++) {
+        bool valid = depth[n] <= maxTreeDepth;
+        for (int c = 0; c < 8; c++) {
+            uint32_t meta = nodes[n].meta[c];
+            if (nodes[n].interiorMask >> c & 1) {
+                uint64_t child = (uint64_t)nodes[n].childBase + meta;
+                valid = valid && child > n && child < header.nodeCount;
+                if (valid) {
+                    depth[child] = std::max(depth[child], depth[n] + 1);
+                }
+            } else if (meta != 0) {
+                valid = valid && (uint64_t)nodes[n].primitiveBase + (meta >> 3) + (meta & 7) <= header.indexCount;
+            }
+        }
+        if (!valid) {
+            scene.clear();
+            error("BVH is damaged");
+            return false;
+        }
+    }
+    for (uint32_t i = 0; i < header.indexCount; i++) {
+        if (indices[i] < 0 || (uint32_t)indices[i] >= header.objectCount) {
+            scene.clear();
+            error("BVH is damaged");
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool SceneFile::isCompiled(string file) {
+    std::ifstream in(file, std::ios::binary);
+    char magic[8];
+    if (!in.read(magic, 8)) {
+        return false;
+    }
+    return memcmp(magic, sceneMagic, 8) == 0;
+}
@@ -0,0 +1,89 @@
+//
+//  scenefile.hpp
+//  
+//
+//  Created by Brendan Martin on 10/19/26.
+//
+
+#ifndef scenefile_hpp
+#define scenefile_hpp
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string>
+#include "scene.hpp"
+
+typedef std::string string;
+
+// Compiled scenes hold everything needed to start tracing: materials, the
+// spheres as one array per field, the indices of the spheres that are
+// lights, the prebuilt BVH, and the cameras and keyframes of an animation.
+// Every array starts at a 64-byte aligned offset recorded in the header. Values
+// are stored in the byte order of the machine that compiled the scene.
+struct SceneHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t materialCount;
+    uint32_t objectCount;
+    uint32_t lightCount;
+    uint32_t nodeCount;
+    uint32_t indexCount;
+    float camera[7];
+    uint32_t frames;
+    uint32_t cameraCount;
+    uint32_t keyCount;
+    uint64_t materialOffset;
+    uint64_t objectOffset;
+    uint64_t lightOffset;
+    uint64_t nodeOffset;
+    uint64_t indexOffset;
+    uint64_t cameraOffset;
+    uint64_t keyOffset;
+};
+
+struct MaterialRecord {
+    char method[16];
+    char distribution[16];
+    char type[16];
+    float emissive[3];
+    float roughness;
+    float diffuseColor[3];
+    float fresnel[3];
+};
+
+struct CameraRecord {
+    float position[3];
+    float direction[3];
+    float focalLength;
+};
+
+struct KeyRecord {
+    int32_t target;
+    int32_t index;
+    int32_t frame;
+    float position[3];
+    float direction[3];
+    float value;
+};
+
+class SceneFile {
+    string filename;
+
+    void error(string message);
+
+public:
+    // Increased whenever the layout of the file changes
+    static const uint32_t version = 4;
+
+    SceneFile();
+
+    // Writes the scene and its BVH
+    bool save(string file, Scene &scene);
+    // Replaces the scene and its BVH with the contents of a compiled scene
+    bool load(string file, Scene &scene);
+
+    // Checks whether a file starts like a compiled scene
+    static bool isCompiled(string file);
+};
+
+#endif /* scenefile_hpp */
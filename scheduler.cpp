@@ -0,0 +1,208 @@
+//
+//  scheduler.cpp
+//  
+//
+//  Created by Brendan Martin on 10/19/26.
+//
+
+#include "scheduler.hpp"
+#include "render.hpp"
+
+typedef std::chrono::steady_clock steady_clock;
+
+RenderRequest::RenderRequest() {
+    scene = NULL;
+    film = NULL;
+    firstColumn = 0;
+    firstRow = 0;
+    callback = nullptr;
+    cancel = NULL;
+}
+
+Scheduler::Scheduler(int threads, int tileSize) {
+    if (threads <= 0) {
+        threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+    this->tileSize = std::max(1, tileSize);
+    nextJob = 1;
+    stopping = false;
+    for (int t = 0; t < threads; t++) {
+        workers.push_back(std::thread(&Scheduler::workerLoop, this));
+    }
+}
+
+Scheduler::~Scheduler() {
+    {
+        std::unique_lock<std::mutex> guard(lock);
+        stopping = true;
+    }
+    work.notify_all();
+    for (size_t t = 0; t < workers.size(); t++) {
+        workers[t].join();
+    }
+}
+
+int Scheduler::getThreads() {
+    return (int)workers.size();
+}
+
+int Scheduler::submit(RenderRequest request) {
+    std::shared_ptr<Job> job = std::make_shared<Job>();
+    job->request = request;
+    job->nextTile = 0;
+    job->tilesDone = 0;
+    job->passes = 0;
+    job->rays = 0;
+    job->passRays = 0;
+    job->start = steady_clock::now();
+
+    Framebuffer &film = *request.film;
+    for (int y = 0; y < film.getHeight(); y += tileSize) {
+        for (int x = 0; x < film.getWidth(); x += tileSize) {
+            Tile tile = { x, y, std::min(x + tileSize, film.getWidth()), std::min(y + tileSize, film.getHeight()) };
+            job->tiles.push_back(tile);
+        }
+    }
+    job->finished = job->tiles.empty();
+
+    std::unique_lock<std::mutex> guard(lock);
+    job->id = nextJob++;
+
+    // A new job starts level with the least served job of its priority, so
+    // it gets its share from now on rather than catching up on the past
+    int priority = request.settings.priority;
+    bool first = true;
+    job->consumed = 0;
+    for (std::map< int, std::shared_ptr<Job> >::iterator it = jobs.begin(); it != jobs.end(); it++) {
+        Job &other = *it->second;
+        if (!other.finished && other.request.settings.priority == priority && (first || other.consumed < job->consumed)) {
+            job->consumed = other.consumed;
+            first = false;
+        }
+    }
+
+    jobs[job->id] = job;
+    guard.unlock();
+    work.notify_all();
+    return job->id;
+}
+
+RenderResult Scheduler::wait(int id) {
+    RenderResult result = { 0, 0, 0 };
+    std::unique_lock<std::mutex> guard(lock);
+    if (jobs.count(id) == 0) {
+        return result;
+    }
+    std::shared_ptr<Job> job = jobs[id];
+
+    // Cancellation is a flag owned by the caller, so it is polled here in
+    // case no worker is left to notice it
+    while (!job->finished) {
+        if (isStopped(*job) && job->nextTile == job->tilesDone) {
+            job->finished = true;
+            break;
+        }
+        done.wait_for(guard, std::chrono::milliseconds(50));
+    }
+
+    jobs.erase(id);
+    result.passes = job->passes;
+    result.rays = job->rays;
+    result.seconds = std::chrono::duration<float>(steady_clock::now() - job->start).count();
+    return result;
+}
+
+bool Scheduler::isStopped(Job &job) {
+    return job.request.cancel != NULL && *job.request.cancel;
+}
+
+// Returns the job the next tile should come from, or NULL if no job has a
+// tile ready. Called with the lock held.
+std::shared_ptr<Scheduler::Job> Scheduler::pickJob() {
+    std::shared_ptr<Job> best;
+    for (std::map< int, std::shared_ptr<Job> >::iterator it = jobs.begin(); it != jobs.end(); it++) {
+        std::shared_ptr<Job> &job = it->second;
+        if (job->finished || job->nextTile >= job->tiles.size() || isStopped(*job)) {
+            continue;
+        }
+        int priority = job->request.settings.priority;
+        int bestPriority = best ? best->request.settings.priority : 0;
+        if (!best || priority > bestPriority || (priority == bestPriority && job->consumed < best->consumed)) {
+            best = job;
+        }
+    }
+    return best;
+}
+
+void Scheduler::workerLoop() {
+    std::unique_lock<std::mutex> guard(lock);
+    while (true) {
+        std::shared_ptr<Job> job;
+        while (!stopping && !(job = pickJob())) {
+            work.wait(guard);
+        }
+        if (stopping) {
+            return;
+        }
+
+        Tile tile = job->tiles[job->nextTile++];
+        int sample = job->request.settings.firstSample + job->passes;
+        guard.unlock();
+
+        RenderRequest &request = job->request;
+        steady_clock::time_point start = steady_clock::now();
+        unsigned long long rays = renderTile(*request.scene, request.settings, *request.film, sample,
+                                             tile.x0, tile.y0, tile.x1, tile.y1, request.firstColumn, request.firstRow);
+        double seconds = std::chrono::duration<double>(steady_clock::now() - start).count();
+
+        guard.lock();
+        job->consumed += seconds;
+        job->rays += rays;
+        job->passRays += rays;
+        job->tilesDone++;
+
+        if (job->tilesDone == job->tiles.size()) {
+            finishPass(guard, *job);
+        } else if (isStopped(*job) && job->tilesDone == job->nextTile) {
+            job->finished = true;
+            done.notify_all();
+        }
+    }
+}
+
+// Called with the lock held once every tile of a pass is finished. Decides
+// whether to start another pass, the same way a single threaded render would.
+void Scheduler::finishPass(std::unique_lock<std::mutex> &guard, Job &job) {
+    job.passes++;
+    unsigned long long passRays = job.passRays;
+    job.passRays = 0;
+    float elapsed = std::chrono::duration<float>(steady_clock::now() - job.start).count();
+
+    bool keepGoing = true;
+    if (job.request.callback) {
+        // No tile of this job can be handed out until the next pass starts,
+        // so the callback runs without holding up other jobs
+        guard.unlock();
+        keepGoing = job.request.callback(job.passes, elapsed);
+        guard.lock();
+    }
+
+    if (!keepGoing || isStopped(job)) {
+        job.finished = true;
+    } else if (job.request.settings.timeBudget <= 0) {
+        job.finished = job.passes >= job.request.settings.numSamples;
+    } else {
+        // Only start another pass if, at the rate measured so far, it
+        // finishes within the budget
+        float raysPerSec = job.rays / elapsed;
+        job.finished = elapsed + passRays / raysPerSec > job.request.settings.timeBudget;
+    }
+
+    if (job.finished) {
+        done.notify_all();
+    } else {
+        job.nextTile = 0;
+        job.tilesDone = 0;
+        work.notify_all();
+    }
+}
@@ -0,0 +1,109 @@
+//
+//  scheduler.hpp
+//  
+//
+//  Created by Brendan Martin on 10/19/26.
+//
+
+#ifndef scheduler_hpp
+#define scheduler_hpp
+
+#include <stdio.h>
+#include <vector>
+#include <map>
+#include <memory>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <chrono>
+#include <functional>
+#include "scene.hpp"
+#include "framebuffer.hpp"
+#include "render.hpp"
+
+// Called after every finished pass; returning false stops the render
+typedef std::function<bool(int passes, float elapsed)> PassCallback;
+
+// What to render. The scene and film must stay alive until the render has
+// been waited for.
+struct RenderRequest {
+    Scene* scene;
+    Framebuffer* film;
+    // Image pixel of the film's bottom left pixel, for films that hold part
+    // of the image
+    int firstColumn;
+    int firstRow;
+    RenderSettings settings;
+
+    PassCallback callback;
+    const std::atomic<bool>* cancel;
+
+    RenderRequest();
+};
+
+// What a finished render did
+struct RenderResult {
+    // Passes accumulated in the film, i.e. samples per pixel
+    int passes;
+    unsigned long long rays;
+    float seconds;
+};
+
+// Renders any number of jobs on one pool of worker threads. Every pass of a
+// job is split into tiles, and whenever a worker is free it takes the next
+// tile of the highest priority job. Jobs of equal priority share the pool by
+// worker time: the one that has used the least goes next. Because workers
+// choose again after every tile, a new high priority job takes over the
+// pool within one tile time.
+class Scheduler {
+    struct Tile {
+        int x0, y0, x1, y1;
+    };
+
+    struct Job {
+        int id;
+        RenderRequest request;
+        std::vector<Tile> tiles;
+
+        // Tiles of the current pass that were handed out and finished
+        size_t nextTile;
+        size_t tilesDone;
+        int passes;
+        bool finished;
+
+        // Worker seconds spent on this job, used for fair sharing
+        double consumed;
+        unsigned long long rays;
+        unsigned long long passRays;
+        std::chrono::steady_clock::time_point start;
+    };
+
+    std::vector<std::thread> workers;
+    std::map< int, std::shared_ptr<Job> > jobs;
+    std::mutex lock;
+    std::condition_variable work;
+    std::condition_variable done;
+    int nextJob;
+    int tileSize;
+    bool stopping;
+
+    void workerLoop();
+    std::shared_ptr<Job> pickJob();
+    bool isStopped(Job &job);
+    void finishPass(std::unique_lock<std::mutex> &guard, Job &job);
+
+public:
+    // threads <= 0 uses one worker per hardware thread
+    Scheduler(int threads = 0, int tileSize = 32);
+    ~Scheduler();
+
+    int getThreads();
+
+    // Queues a render and returns its job id
+    int submit(RenderRequest request);
+    // Blocks until the job has stopped
+    RenderResult wait(int job);
+};
+
+#endif /* scheduler_hpp */
@@ -0,0 +1,435 @@
+//
+//  server.cpp
+//  
+//
+//  Created by Brendan Martin on 10/19/26.
+//
+
+#include "server.hpp"
+#include "parser.hpp"
+#include "render.hpp"
+#include "imagewriter.hpp"
+#include <thread>
+#include <vector>
+#include <cstring>
+#include <csignal>
+#include <cstdlib>
+#include <cerrno>
+#include <climits>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+// ServerClient
+
+bool ServerClient::send(string line) {
+    line += "\n";
+    return send((const unsigned char*)line.data(), line.size());
+}
+
+bool ServerClient::send(const unsigned char* data, size_t size) {
+    std::unique_lock<std::mutex> guard(lock);
+    while (size > 0 && connected) {
+        ssize_t sent = ::send(socket, data, size, 0);
+        if (sent <= 0) {
+            connected = false;
+            return false;
+        }
+        data += sent;
+        size -= sent;
+    }
+    return connected;
+}
+
+
+// RenderServer
+
+// Splits off the first word of a command, leaving the rest of the line
+static string_view nextWord(string_view &line) {
+    size_t start = line.find_first_not_of(" \t");
+    if (start == string_view::npos) {
+        line = string_view();
+        return string_view();
+    }
+    size_t end = line.find_first_of(" \t", start);
+    if (end == string_view::npos) {
+        end = line.size();
+    }
+    string_view word = line.substr(start, end - start);
+    line = line.substr(end);
+    return word;
+}
+
+// Reads a whole word as a number. Words with anything after the number,
+// or numbers out of range, are rejected rather than cut short.
+static bool readInt(const string &word, int &value) {
+    char* end;
+    errno = 0;
+    long number = strtol(word.c_str(), &end, 10);
+    if (word.empty() || *end != '\0' || errno == ERANGE || number < INT_MIN || number > INT_MAX) {
+        return false;
+    }
+    value = number;
+    return true;
+}
+
+static bool readFloat(const string &word, float &value) {
+    char* end;
+    errno = 0;
+    float number = strtof(word.c_str(), &end);
+    if (word.empty() || *end != '\0' || errno == ERANGE) {
+        return false;
+    }
+    value = number;
+    return true;
+}
+
+RenderServer::RenderServer(int threads) : renderer(threads) {
+    nextJob = 1;
+    stopping = false;
+}
+
+bool RenderServer::run(string socketPath) {
+    // A client that disconnects mid-reply must not kill the server
+    signal(SIGPIPE, SIG_IGN);
+
+    int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (listener < 0 || socketPath.size() >= sizeof(address.sun_path)) {
+        std::cerr << socketPath << ": could not create socket" << std::endl;
+        return false;
+    }
+    strcpy(address.sun_path, socketPath.c_str());
+
+    unlink(socketPath.c_str());
+    if (bind(listener, (sockaddr*)&address, sizeof(address)) != 0 || listen(listener, 8) != 0) {
+        std::cerr << socketPath << ": could not listen on socket" << std::endl;
+        close(listener);
+        return false;
+    }
+    std::cout << "Listening on " << socketPath << " with " << renderer.getThreads() << " render threads" << std::endl;
+
+    // The server runs until the process is stopped, so neither the command
+    // thread nor the accept loop ever finishes
+    std::thread(&RenderServer::commandLoop, this).detach();
+
+    while (true) {
+        int connection = accept(listener, NULL, NULL);
+        if (connection < 0) {
+            continue;
+        }
+        std::shared_ptr<ServerClient> client = std::make_shared<ServerClient>();
+        client->socket = connection;
+        client->connected = true;
+        std::thread(&RenderServer::serveClient, this, client).detach();
+    }
+}
+
+void RenderServer::serveClient(std::shared_ptr<ServerClient> client) {
+    string buffer;
+    char data[4096];
+    std::vector< std::shared_ptr<ServerJob> > submitted;
+
+    while (client->connected) {
+        size_t newline = buffer.find('\n');
+        if (newline == string::npos) {
+            ssize_t received = recv(client->socket, data, sizeof(data), 0);
+            if (received <= 0) {
+                break;
+            }
+            buffer.append(data, received);
+            continue;
+        }
+
+        string line = buffer.substr(0, newline);
+        buffer.erase(0, newline + 1);
+        if (!line.empty() && line.back() == '\r') {
+            line.pop_back();
+        }
+
+        string_view rest = line;
+        string_view command = nextWord(rest);
+        if (command.empty()) {
+            continue;
+        }
+
+        // Cancelling and quitting are handled right away, everything else is queued
+        if (command == "quit") {
+            break;
+        } else if (command == "cancel") {
+            string word = string(nextWord(rest));
+            int id;
+            if (!readInt(word, id)) {
+                client->send("error " + word + " no such job");
+                continue;
+            }
+            std::unique_lock<std::mutex> guard(lock);
+            if (active.count(id) > 0) {
+                active[id]->cancel = true;
+                client->send("cancelling " + std::to_string(id));
+            } else {
+                client->send("error " + std::to_string(id) + " no such job");
+            }
+            continue;
+        }
+
+        std::shared_ptr<ServerJob> job = std::make_shared<ServerJob>();
+        job->command = line;
+        job->client = client;
+        job->submitted = std::chrono::steady_clock::now();
+        job->cancel = false;
+        {
+            std::unique_lock<std::mutex> guard(lock);
+            job->id = nextJob++;
+            queue.push_back(job);
+            active[job->id] = job;
+        }
+        submitted.push_back(job);
+        client->send("queued " + std::to_string(job->id));
+        wake.notify_one();
+    }
+
+    // Renders have nowhere to go once the client is gone, but scene changes
+    // are kept
+    client->connected = false;
+    for (size_t j = 0; j < submitted.size(); j++) {
+        if (submitted[j]->command.compare(0, 6, "render") == 0) {
+            submitted[j]->cancel = true;
+        }
+    }
+    close(client->socket);
+}
+
+void RenderServer::commandLoop() {
+    while (true) {
+        std::shared_ptr<ServerJob> job;
+        {
+            std::unique_lock<std::mutex> guard(lock);
+            while (queue.empty() && !stopping) {
+                wake.wait(guard);
+            }
+            if (queue.empty()) {
+                return;
+            }
+            job = queue.front();
+            queue.pop_front();
+        }
+
+        if (job->cancel) {
+            job->client->send("cancelled " + std::to_string(job->id));
+            finishJob(*job);
+        } else {
+            runJob(job);
+        }
+    }
+}
+
+// Forgets a job once it has been answered, so it can no longer be cancelled
+void RenderServer::finishJob(ServerJob &job) {
+    std::unique_lock<std::mutex> guard(lock);
+    active.erase(job.id);
+}
+
+// Blocks until no render is reading the scene, so it can be changed
+void RenderServer::waitForRenders(Scene* scene) {
+    std::unique_lock<std::mutex> guard(lock);
+    while (rendering[scene] > 0) {
+        idle.wait(guard);
+    }
+    rendering.erase(scene);
+}
+
+void RenderServer::runJob(std::shared_ptr<ServerJob> job) {
+    string id = std::to_string(job->id);
+    string_view rest = job->command;
+    string_view command = nextWord(rest);
+    string name = string(nextWord(rest));
+
+    if (name.empty()) {
+        job->client->send("error " + id + " missing scene name");
+    } else if (command == "load") {
+        // Renders of a scene that is replaced keep their own copy alive
+        string file = string(nextWord(rest));
+        std::shared_ptr<Scene> scene = std::make_shared<Scene>();
+        if (scene->load(file)) {
+            scenes[name] = scene;
+            job->client->send("ok " + id + " loaded " + std::to_string(scene->objects.size() - scene->lights.size()) + " objects and " +
+                              std::to_string(scene->lights.size()) + " lights");
+        } else {
+            job->client->send("error " + id + " could not load " + file);
+        }
+    } else if (scenes.count(name) == 0) {
+        job->client->send("error " + id + " no scene named " + name);
+    } else if (command == "render") {
+        // Finishes on its own once the render is done
+        renderJob(job, scenes[name], string(rest));
+        return;
+    } else if (command == "unload") {
+        scenes.erase(name);
+        job->client->send("ok " + id + " unloaded " + name);
+    } else if (command == "edit") {
+        Scene &scene = *scenes[name];
+        waitForRenders(&scene);
+
+        // The BVH only needs rebuilding when spheres, instances or triangles
+        // were added
+        size_t objectCount = scene.objects.size();
+        size_t instanceCount = scene.instances.size();
+        size_t meshCount = scene.meshes.size();
+        Parser parse = Parser();
+        parse.setFilename(name);
+        if (parse.append(rest.data(), rest.size(), scene)) {
+            if (scene.objects.size() != objectCount || scene.instances.size() != instanceCount ||
+                scene.meshes.size() != meshCount) {
+                scene.buildBVH();
+            }
+            job->client->send("ok " + id + " edited " + name);
+        } else {
+            job->client->send("error " + id + " invalid layout line");
+        }
+    } else if (command == "material") {
+        Scene &scene = *scenes[name];
+        waitForRenders(&scene);
+
+        // Replacing a material in place keeps every pointer to it valid
+        int index = -1;
+        readInt(string(nextWord(rest)), index);
+        string line = "material" + string(rest);
+        Scene parsed;
+        Parser parse = Parser();
+        parse.setFilename(name);
+        if (index >= 0 && index < (int)scene.materials.size() &&
+            parse.parse(line.data(), line.size(), parsed) && parsed.materials.size() == 1) {
+            scene.materials[index] = parsed.materials[0];
+            // The light tree weighs lights by their materials' emission
+            scene.lightTree.build(scene.objects, scene.lights);
+            job->client->send("ok " + id + " replaced material " + std::to_string(index));
+        } else {
+            job->client->send("error " + id + " invalid material");
+        }
+    } else {
+        job->client->send("error " + id + " unknown command " + string(command));
+    }
+
+    finishJob(*job);
+}
+
+void RenderServer::renderJob(std::shared_ptr<ServerJob> job, std::shared_ptr<Scene> scene, string arguments) {
+    string id = std::to_string(job->id);
+
+    RenderRequest request;
+    request.scene = scene.get();
+    request.cancel = &job->cancel;
+    string output;
+    string_view rest = arguments;
+    while (true) {
+        string_view option = nextWord(rest);
+        if (option.empty()) {
+            break;
+        }
+        string value = string(nextWord(rest));
+
+        bool valid = true;
+        int number = 0;
+        float seconds = 0.0f;
+        if (option == "samples" || option == "priority" || option == "lights" || option == "width" || option == "height") {
+            valid = readInt(value, number);
+        } else if (option == "budget" || option == "deadline") {
+            valid = readFloat(value, seconds);
+        }
+        if (!valid) {
+            job->client->send("error " + id + " invalid value for " + string(option));
+            finishJob(*job);
+            return;
+        }
+
+        if (option == "samples") {
+            request.settings.numSamples = std::max(1, number);
+        } else if (option == "budget") {
+            float budget = seconds;
+            request.settings.timeBudget = request.settings.timeBudget > 0 ? std::min(request.settings.timeBudget, budget) : budget;
+        } else if (option == "deadline") {
+            // Deadlines count from when the job was received, so time spent
+            // waiting in the queue comes out of the render time
+            float waited = std::chrono::duration<float>(std::chrono::steady_clock::now() - job->submitted).count();
+            float budget = seconds - waited;
+            if (budget <= 0) {
+                job->client->send("error " + id + " deadline already passed");
+                finishJob(*job);
+                return;
+            }
+            request.settings.timeBudget = request.settings.timeBudget > 0 ? std::min(request.settings.timeBudget, budget) : budget;
+        } else if (option == "priority") {
+            request.settings.priority = number;
+        } else if (option == "lights") {
+            request.settings.lightSamples = std::max(0, number);
+        } else if (option == "width") {
+            request.settings.width = std::max(1, number);
+        } else if (option == "height") {
+            request.settings.height = std::max(1, number);
+        } else if (option == "output") {
+            output = value;
+        } else {
+            job->client->send("error " + id + " unknown option " + string(option));
+            finishJob(*job);
+            return;
+        }
+    }
+
+    std::shared_ptr<Framebuffer> film = std::make_shared<Framebuffer>(request.settings.width, request.settings.height);
+    request.film = film.get();
+    request.callback = [job, id](int passes, float elapsed) {
+        job->client->send("progress " + id + " " + std::to_string(passes) + " " + std::to_string(elapsed));
+        return job->client->connected.load();
+    };
+
+    {
+        std::unique_lock<std::mutex> guard(lock);
+        rendering[scene.get()]++;
+    }
+    int render = renderer.submit(request);
+
+    // The command loop moves on while the render runs; this thread waits for
+    // it and sends the image
+    std::thread([this, job, scene, film, render, output, id]() {
+        RenderResult result = renderer.wait(render);
+        int passes = result.passes;
+        string seconds = std::to_string(result.seconds);
+        {
+            std::unique_lock<std::mutex> guard(lock);
+            rendering[scene.get()]--;
+        }
+        idle.notify_all();
+
+        if (job->cancel || passes == 0) {
+            job->client->send("cancelled " + id);
+        } else if (!output.empty() && FreeImage_GetFIFFromFilename(output.c_str()) != FIF_PNG) {
+            if (film->saveHDR(output, passes)) {
+                job->client->send("done " + id + " " + std::to_string(passes) + " " + seconds + " " + output);
+            } else {
+                job->client->send("error " + id + " could not write " + output);
+            }
+        } else {
+            FIBITMAP* bitmap = FreeImage_Allocate(film->getWidth(), film->getHeight(), 24);
+            film->toBitmap(bitmap, passes);
+
+            if (!output.empty()) {
+                if (saveParallelPNG(bitmap, output)) {
+                    job->client->send("done " + id + " " + std::to_string(passes) + " " + seconds + " " + output);
+                } else {
+                    job->client->send("error " + id + " could not write " + output);
+                }
+            } else {
+                std::vector<unsigned char> png;
+                encodeParallelPNG(bitmap, png);
+                job->client->send("image " + id + " " + std::to_string(png.size()));
+                job->client->send(png.data(), png.size());
+                job->client->send("done " + id + " " + std::to_string(passes) + " " + seconds);
+            }
+            FreeImage_Unload(bitmap);
+        }
+        finishJob(*job);
+    }).detach();
+}
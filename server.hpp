@@ -0,0 +1,100 @@
+//
+//  server.hpp
+//  
+//
+//  Created by Brendan Martin on 10/19/26.
+//
+
+#ifndef server_hpp
+#define server_hpp
+
+#include <stdio.h>
+#include <string>
+#include <map>
+#include <deque>
+#include <memory>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include "scene.hpp"
+#include "renderer.hpp"
+
+typedef std::string string;
+
+// One connected client. Replies from the render thread and from the
+// client's own thread are serialized through the lock.
+struct ServerClient {
+    int socket;
+    std::mutex lock;
+    std::atomic<bool> connected;
+
+    bool send(string line);
+    bool send(const unsigned char* data, size_t size);
+};
+
+// A queued command. Commands are taken in the order they were received, and
+// renders then run on a shared worker pool. A command that changes a scene
+// first waits for that scene's renders, so a camera move sent after a render
+// never affects that render.
+struct ServerJob {
+    int id;
+    string command;
+    std::shared_ptr<ServerClient> client;
+    std::chrono::steady_clock::time_point submitted;
+    std::atomic<bool> cancel;
+};
+
+// Keeps scenes loaded between render jobs and accepts jobs over a Unix
+// socket. The protocol is line based:
+//
+//   load <scene> <file>            load a layout file or compiled scene
+//   unload <scene>
+//   edit <scene> <layout line>     apply a camera, material, sphere or light line
+//   material <scene> <index> <method> <distribution> <type> <emissive> <roughness> <diffuse> <fresnel>
+//                                  replace a material in place
+//   render <scene> [samples N] [budget S] [deadline S] [priority P]
+//          [lights L] [width W] [height H] [output FILE]
+//   cancel <job>
+//   quit                           close the connection
+//
+// Cancel and quit take effect immediately; cancel answers "cancelling
+// <job>". Every other command is answered with "queued <job>", then later "ok <job> ...",
+// "error <job> ...", or for renders any number of "progress <job> <passes>
+// <seconds>" lines and finally "done <job> <passes> <seconds> [file]".
+// Without an output file, "done" is preceded by "image <job> <bytes>" and
+// the PNG itself. Renders with a higher priority (default 0) take over the
+// workers from lower ones; renders of equal priority share them. "lights"
+// samples that many lights per bounce through the light tree instead of
+// every light.
+class RenderServer {
+    std::map< string, std::shared_ptr<Scene> > scenes;
+
+    std::deque< std::shared_ptr<ServerJob> > queue;
+    std::map< int, std::shared_ptr<ServerJob> > active;
+    std::mutex lock;
+    std::condition_variable wake;
+    int nextJob;
+    bool stopping;
+
+    // Renders in progress on each scene
+    Renderer renderer;
+    std::map<Scene*, int> rendering;
+    std::condition_variable idle;
+
+    void commandLoop();
+    void serveClient(std::shared_ptr<ServerClient> client);
+    void runJob(std::shared_ptr<ServerJob> job);
+    void renderJob(std::shared_ptr<ServerJob> job, std::shared_ptr<Scene> scene, string arguments);
+    void finishJob(ServerJob &job);
+    void waitForRenders(Scene* scene);
+
+public:
+    // threads <= 0 uses one render worker per hardware thread
+    RenderServer(int threads = 0);
+    // Listens on the socket until the process is stopped. Returns false only
+    // if the socket could not be set up.
+    bool run(string socketPath);
+};
+
+#endif /* server_hpp */
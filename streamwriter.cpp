@@ -0,0 +1,87 @@
+//
+//  streamwriter.cpp
+//  
+//
+//  Created by Brendan Martin on 10/19/26.
+//
+
+#include "streamwriter.hpp"
+#include <algorithm>
+
+StreamWriter::StreamWriter() {
+    hdr = false;
+    width = 0;
+    height = 0;
+    rowsWritten = 0;
+}
+
+bool StreamWriter::open(string file, int w, int h) {
+    width = w;
+    height = h;
+    rowsWritten = 0;
+    hdr = file.size() >= 4 && file.compare(file.size() - 4, 4, ".pfm") == 0;
+
+    out.open(file, std::ios::binary);
+    if (!out.is_open()) {
+        return false;
+    }
+
+    if (hdr) {
+        out << "PF\n" << width << " " << height << "\n-1.0\n";
+        line.resize(3 * width * sizeof(float));
+    } else {
+        out << "P6\n" << width << " " << height << "\n255\n";
+        line.resize(3 * width);
+    }
+    return out.good();
+}
+
+bool StreamWriter::close() {
+    out.close();
+    return rowsWritten == height && !out.fail();
+}
+
+bool StreamWriter::isBottomUp() {
+    return hdr;
+}
+
+int StreamWriter::nextBand(int rows) {
+    rows = std::min(rows, height - rowsWritten);
+    if (isBottomUp()) {
+        return rowsWritten;
+    }
+    return height - rowsWritten - rows;
+}
+
+bool StreamWriter::writeBand(Framebuffer& band, int samples) {
+    float scale = 1.0f / samples;
+    int rows = band.getHeight();
+
+    for (int r = 0; r < rows; r++) {
+        // Bands are stored bottom-up like the rest of the image
+        vec3* row = band.getRow(isBottomUp() ? r : rows - 1 - r);
+
+        if (hdr) {
+            float* dst = (float*)line.data();
+            for (int i = 0; i < width; i++) {
+                // Channels are swapped to match the PNG output
+                dst[3*i + 0] = row[i].z * scale;
+                dst[3*i + 1] = row[i].y * scale;
+                dst[3*i + 2] = row[i].x * scale;
+            }
+        } else {
+            unsigned char* dst = (unsigned char*)line.data();
+            for (int i = 0; i < width; i++) {
+                dst[3*i + 0] = (unsigned char)(int)std::min(row[i].z * scale, 255.0f);
+                dst[3*i + 1] = (unsigned char)(int)std::min(row[i].y * scale, 255.0f);
+                dst[3*i + 2] = (unsigned char)(int)std::min(row[i].x * scale, 255.0f);
+            }
+        }
+        out.write(line.data(), line.size());
+    }
+
+    rowsWritten += rows;
+    // Flushed so that a failed write shows at this band rather than at close
+    out.flush();
+    return out.good();
+}
@@ -0,0 +1,44 @@
+//
+//  streamwriter.hpp
+//  
+//
+//  Created by Brendan Martin on 10/19/26.
+//
+
+#ifndef streamwriter_hpp
+#define streamwriter_hpp
+
+#include <stdio.h>
+#include <fstream>
+#include <string>
+#include <vector>
+#include "framebuffer.hpp"
+
+typedef std::string string;
+
+// Writes an image to disk one band of rows at a time, so that only the band
+// currently being rendered has to be kept in memory. Files ending in ".pfm"
+// are written as floating point PFM, anything else as a binary 8-bit PPM.
+class StreamWriter {
+    std::ofstream out;
+    bool hdr;
+    int width;
+    int height;
+    int rowsWritten;
+    std::vector<char> line;
+
+public:
+    StreamWriter();
+    bool open(string file, int w, int h);
+    bool close();
+
+    // PFM stores the bottom row first, PPM the top row first
+    bool isBottomUp();
+    // Returns the first image row of the next band of the given size
+    int nextBand(int rows);
+
+    // Appends every row of a band (accumulated over the given number of samples)
+    bool writeBand(Framebuffer& band, int samples);
+};
+
+#endif /* streamwriter_hpp */